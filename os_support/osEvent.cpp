@@ -31,6 +31,11 @@
 
 #ifdef _WIN32
 #include <Windows.h>
+#elif __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 #endif
 #include <iomanip>
 #include <stdio.h>
@@ -43,23 +48,15 @@ osEvent* osEvent::InstanceList[osEvent::INSTANCE_MAX];
 osMutex osEvent::ListMutex("Event List");
 
 osEvent::osEvent(const char* name)
-    :
-#ifdef __linux__
-    m_test(false)
-    ,
-#endif
-    pending(nullptr)
+    : State(0)
+    , pending(nullptr)
 {
+    Name[0] = 0;
     if (name)
     {
         strncpy(Name, name, NAME_LENGTH_MAX - 1);
+        Name[NAME_LENGTH_MAX - 1] = 0;
     }
-#ifdef _WIN32
-    Handle = CreateEvent(nullptr, true, false, name);
-#elif __linux__
-    pthread_mutex_init(&m_mutex, nullptr);
-    pthread_cond_init(&m_condition, nullptr);
-#endif
     ListMutex.Take(__FILE__, __LINE__);
     for (int i = 0; i < INSTANCE_MAX; i++)
     {
@@ -82,64 +79,119 @@ osEvent::~osEvent()
             InstanceList[i] = nullptr;
         }
     }
-#ifdef WIN32
-    CloseHandle(Handle);
-#elif __linux__
-    pthread_cond_destroy(&m_condition);
-    pthread_mutex_destroy(&m_mutex);
-#endif
     ListMutex.Give();
 }
 
 void osEvent::Notify()
 {
-#ifdef _WIN32
-    SetEvent(Handle);
-#elif __linux__
-    pthread_mutex_lock(&m_mutex);
-    m_test = true;
-    pthread_cond_signal(&m_condition);
-    pthread_mutex_unlock(&m_mutex);
-#endif
+    // Already signaled and nobody to wake, e.g. several segments received between reads
+    if (State.load(std::memory_order_relaxed) == SIGNALED)
+    {
+        return;
+    }
+    uint32_t state = State.fetch_or(SIGNALED);
+    if (state >= WAITER)
+    {
+        Wake();
+    }
+}
+
+bool osEvent::TryConsume(uint32_t& state)
+{
+    while (state & SIGNALED)
+    {
+        if (State.compare_exchange_weak(state, state & ~SIGNALED))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 bool osEvent::Wait(const char* file, int line, int msTimeout)
 {
-#ifdef _WIN32
-    uint32_t rc = 0;
-    osThread* caller = osThread::GetCurrent();
-    caller->SetState(osThread::THREAD_STATE::PENDING_EVENT, file, line, this);
-    if (msTimeout == -1)
+    uint32_t state = State.load();
+    if (TryConsume(state))
     {
-        WaitForSingleObject(Handle, INFINITE);
+        return true;
     }
-    else
+    if (msTimeout == 0)
     {
-        rc = WaitForSingleObject(Handle, msTimeout);
+        return false;
     }
-    caller->ClearState();
-    return (rc) ? false : true;
-#elif __linux__
+
     osThread* thread = osThread::GetCurrent();
     if (thread)
     {
         thread->SetState(osThread::PENDING_EVENT, file, line, this);
         pending = thread;
     }
-    pthread_mutex_lock(&m_mutex);
-    int rc = 0;
-    while (m_test == false && rc == 0)
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msTimeout);
+    bool rc = false;
+    state = State.fetch_add(WAITER) + WAITER;
+    while (true)
     {
-        rc = pthread_cond_wait(&m_condition, &m_mutex);
+        // Consume the signal and stop being a waiter in one step
+        if (state & SIGNALED)
+        {
+            if (State.compare_exchange_weak(state, state - WAITER - SIGNALED))
+            {
+                rc = true;
+                break;
+            }
+            continue;
+        }
+
+        int64_t remaining = -1;
+        if (msTimeout > 0)
+        {
+            remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+                            deadline - std::chrono::steady_clock::now())
+                            .count();
+            if (remaining <= 0)
+            {
+                State.fetch_sub(WAITER);
+                break;
+            }
+        }
+        Block(state, remaining);
+        state = State.load();
     }
-    m_test = false;
+
     if (thread)
     {
         thread->ClearState();
         pending = nullptr;
     }
-    pthread_mutex_unlock(&m_mutex);
-    return true;
+    return rc;
+}
+
+void osEvent::Block(uint32_t state, int64_t usTimeout)
+{
+#ifdef _WIN32
+    WaitOnAddress(
+        &State, &state, sizeof(state), usTimeout < 0 ? INFINITE : (DWORD)((usTimeout + 999) / 1000));
+#elif __linux__
+    struct timespec timeout;
+    struct timespec* ptimeout = nullptr;
+    if (usTimeout >= 0)
+    {
+        timeout.tv_sec = usTimeout / 1000000;
+        timeout.tv_nsec = (usTimeout % 1000000) * 1000;
+        ptimeout = &timeout;
+    }
+    // Returns straight away if State no longer holds state
+    syscall(SYS_futex, (uint32_t*)&State, FUTEX_WAIT_PRIVATE, state, ptimeout, nullptr, 0);
+#endif
+}
+
+void osEvent::Wake()
+{
+#ifdef _WIN32
+    WakeByAddressSingle(&State);
+#elif __linux__
+    syscall(SYS_futex, (uint32_t*)&State, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
 #endif
 }
 
@@ -160,17 +212,18 @@ void osEvent::dump_info(std::ostream& out)
         if (e)
         {
             osThread* thread = e->pending;
+            uint32_t state = e->State.load(std::memory_order_relaxed);
             out << std::setw(30) << std::left << e->GetName() << std::setw(0) << "|";
             if (thread)
             {
                 out << std::setw(20) << std::left << thread->GetName() << std::setw(0) << "|";
-                out << std::setw(10) << std::left << "" << std::setw(0) << "\n";
             }
             else
             {
                 out << std::setw(20) << std::left << "" << std::setw(0) << "|";
-                out << std::setw(10) << std::left << "" << std::setw(0) << "\n";
             }
+            out << std::setw(10) << std::left << ((state & SIGNALED) ? "signaled" : "");
+            out << std::setw(0) << " " << state / WAITER << " waiting\n";
         }
     }
 }
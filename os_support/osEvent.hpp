@@ -31,15 +31,20 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <inttypes.h>
 #include <iostream>
 
-#ifdef __linux__
-#include "pthread.h"
-#endif
-
 #include "osMutex.hpp"
 
+// osEvent is an auto-reset signal. Notify sets it and Wait consumes it, so a Notify with
+// nobody waiting is remembered for the next Wait.
+//
+// The signal and the number of blocked waiters share one word. Notify with nobody blocked
+// is a single atomic operation, blocked waiters sleep in the kernel (futex on Linux,
+// WaitOnAddress on Windows) and are only woken when there is someone to wake.
+
 class osEvent
 {
 public:
@@ -49,20 +54,48 @@ public:
 
     void Notify();
 
+    /// @param msTimeout Milliseconds to wait for the signal, -1 waits forever
+    /// @return true if the signal was consumed, false on timeout
     bool Wait(const char* file, int line, int msTimeout = -1);
 
+    /// @brief Wait until ready() returns true, checking it again after every signal so
+    /// spurious or stale signals are harmless
+    /// @return The last result of ready(), false only on timeout
+    template <typename Predicate>
+    bool Wait(const char* file, int line, Predicate ready, int msTimeout = -1)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msTimeout);
+        while (!ready())
+        {
+            int remaining = -1;
+            if (msTimeout >= 0)
+            {
+                auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+                    deadline - std::chrono::steady_clock::now());
+                remaining = (left.count() > 0 ? (int)((left.count() + 999) / 1000) : 0);
+            }
+            if (!Wait(file, line, remaining))
+            {
+                return ready();
+            }
+        }
+        return true;
+    }
+
     const char* GetName();
 
     static void dump_info(std::ostream&);
 
 private:
-#ifdef _WIN32
-    void* Handle;
-#elif __linux__
-    pthread_mutex_t m_mutex;
-    pthread_cond_t m_condition;
-    bool m_test;
-#endif
+    static const uint32_t SIGNALED = 1;
+    static const uint32_t WAITER = 2; // Added to State for each blocked waiter
+
+    bool TryConsume(uint32_t& state);
+    // Sleep while State holds state, for at most usTimeout microseconds or forever if negative
+    void Block(uint32_t state, int64_t usTimeout);
+    void Wake();
+
+    std::atomic<uint32_t> State;
     static const int NAME_LENGTH_MAX = 80;
     char Name[NAME_LENGTH_MAX];
     osThread* pending;
@@ -31,141 +31,391 @@
 
 #ifdef _WIN32
 #include <Windows.h>
+#elif __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 #include <iomanip>
 #include <stdio.h>
 #include <string>
+#include <thread>
 
 #include "osMutex.hpp"
 #include "osThread.hpp"
+#include "osTime.hpp"
+
+// Number of times a contended Take polls the lock before sleeping
+#define MUTEX_SPIN_COUNT (100)
 
 osMutex* osMutex::MutexList[MAX_MUTEX];
 
-#ifdef __linux__
 // Can't use osMutex to lock the MutexList because you can't create an osMutex
-// without locking the MutexList, so make a private mutex
-pthread_mutex_t osMutex::MutexListMutex;
-#endif
+// without locking the MutexList, so use a constant initialized spin lock. It is only
+// taken when mutexes are created and by dump_info.
+static std::atomic<bool> MutexListLock(false);
+
+std::atomic<bool> osMutex::Profiling(false);
+
+// Profile counters of one thread, indexed by osMutex::Index. Only the owning thread writes
+// them so updates are plain load/store pairs rather than locked read-modify-writes.
+struct osMutexShard
+{
+    static const int SHARD_MAX = 64;
+
+    struct Counters
+    {
+        std::atomic<uint64_t> Takes;
+        std::atomic<uint64_t> Contended;
+        std::atomic<uint64_t> WaitTotal_ns;
+        std::atomic<uint64_t> WaitMax_ns;
+        std::atomic<uint64_t> Hold[osMutex::HOLD_BUCKETS];
+    };
+    Counters Mutex[MAX_MUTEX];
+    bool Registered;
+
+    static void Add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static void Fold(Counters& to, const Counters& from)
+    {
+        to.Takes.fetch_add(from.Takes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.Contended.fetch_add(from.Contended.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+        to.WaitTotal_ns.fetch_add(from.WaitTotal_ns.load(std::memory_order_relaxed),
+                                  std::memory_order_relaxed);
+        uint64_t wait_max = from.WaitMax_ns.load(std::memory_order_relaxed);
+        if (wait_max > to.WaitMax_ns.load(std::memory_order_relaxed))
+        {
+            to.WaitMax_ns.store(wait_max, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < osMutex::HOLD_BUCKETS; i++)
+        {
+            to.Hold[i].fetch_add(from.Hold[i].load(std::memory_order_relaxed),
+                                 std::memory_order_relaxed);
+        }
+    }
+
+    static void Clear(Counters& counters)
+    {
+        counters.Takes.store(0, std::memory_order_relaxed);
+        counters.Contended.store(0, std::memory_order_relaxed);
+        counters.WaitTotal_ns.store(0, std::memory_order_relaxed);
+        counters.WaitMax_ns.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < osMutex::HOLD_BUCKETS; i++)
+        {
+            counters.Hold[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Counters& Get(int index);
+    ~osMutexShard();
+};
+
+// Shards of running threads and the counts of threads that have exited, protected by
+// MutexListLock
+static osMutexShard* ShardList[osMutexShard::SHARD_MAX];
+static osMutexShard::Counters RetiredCounters[MAX_MUTEX];
+static thread_local osMutexShard ThreadShard;
+
+osMutexShard::Counters& osMutexShard::Get(int index)
+{
+    if (!Registered)
+    {
+        // A thread that finds the list full still counts, its counts are seen once it exits
+        Registered = true;
+        osMutex::LockListMutex();
+        for (int i = 0; i < SHARD_MAX; i++)
+        {
+            if (ShardList[i] == nullptr)
+            {
+                ShardList[i] = this;
+                break;
+            }
+        }
+        osMutex::UnlockListMutex();
+    }
+    return Mutex[index];
+}
+
+osMutexShard::~osMutexShard()
+{
+    if (Registered)
+    {
+        osMutex::LockListMutex();
+        for (int i = 0; i < SHARD_MAX; i++)
+        {
+            if (ShardList[i] == this)
+            {
+                ShardList[i] = nullptr;
+            }
+        }
+        for (int i = 0; i < MAX_MUTEX; i++)
+        {
+            Fold(RetiredCounters[i], Mutex[i]);
+        }
+        osMutex::UnlockListMutex();
+    }
+}
 
 osMutex::osMutex(const char* name)
-    : Name(name)
+    : State(UNLOCKED)
+    , Name(name)
+    , Index(-1)
+    , HoldStart(0)
     , OwnerFile(nullptr)
+    , OwnerLine(0)
     , OwnerThread(nullptr)
 {
-#ifdef _WIN32
-    Handle = CreateMutex(nullptr, false, name);
-#elif __linux__
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&m_mutex, &attr);
-#endif
-
-    StaticInit();
+    Owner.store(nullptr, std::memory_order_relaxed);
     LockListMutex();
     for (int i = 0; i < MAX_MUTEX; i++)
     {
         if (MutexList[i] == nullptr)
         {
             MutexList[i] = this;
+            Index = i;
             break;
         }
     }
     UnlockListMutex();
+
+    if (Index < 0)
+    {
+        printf("osMutex %s, more than %d mutexes, not listed or profiled\n", Name, MAX_MUTEX);
+    }
 }
 
-void osMutex::Give()
+osMutex::~osMutex()
+{
+    if (Index >= 0)
+    {
+        // The next mutex given this index starts its profile from zero
+        LockListMutex();
+        MutexList[Index] = nullptr;
+        osMutexShard::Clear(RetiredCounters[Index]);
+        for (int i = 0; i < osMutexShard::SHARD_MAX; i++)
+        {
+            if (ShardList[i] != nullptr)
+            {
+                osMutexShard::Clear(ShardList[i]->Mutex[Index]);
+            }
+        }
+        UnlockListMutex();
+    }
+}
+
+void osMutex::TakeContended()
+{
+    int expected;
+    for (int i = 0; i < MUTEX_SPIN_COUNT; i++)
+    {
+        expected = UNLOCKED;
+        if (State.load(std::memory_order_relaxed) == UNLOCKED &&
+            State.compare_exchange_weak(
+                expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+
+    // Mark the lock contended so that Give knows to wake a sleeper. Whoever takes the
+    // lock from here on leaves it marked contended, which costs at most one extra wake.
+    while (State.exchange(CONTENDED, std::memory_order_acquire) != UNLOCKED)
+    {
+        Wait();
+    }
+}
+
+void osMutex::TakeProfiled()
+{
+    uint64_t start = osTime::GetTime_ns();
+    bool contended = !TryTake();
+    if (contended)
+    {
+        TakeContended();
+    }
+    Acquired(contended, start);
+}
+
+void osMutex::Acquired(bool contended, uint64_t start)
+{
+    uint64_t now = osTime::GetTime_ns();
+    if (Index >= 0)
+    {
+        osMutexShard::Counters& counters = ThreadShard.Get(Index);
+        osMutexShard::Add(counters.Takes, 1);
+        if (contended)
+        {
+            uint64_t wait_ns = now - start;
+            osMutexShard::Add(counters.Contended, 1);
+            osMutexShard::Add(counters.WaitTotal_ns, wait_ns);
+            if (wait_ns > counters.WaitMax_ns.load(std::memory_order_relaxed))
+            {
+                counters.WaitMax_ns.store(wait_ns, std::memory_order_relaxed);
+            }
+        }
+        // Never zero so Give can tell a profiled hold
+        HoldStart = now | 1;
+    }
+}
+
+void osMutex::Released()
+{
+    uint64_t hold_ns = osTime::GetTime_ns() - HoldStart;
+    HoldStart = 0;
+    int bucket = 0;
+    uint64_t limit = 256;
+    while (bucket < HOLD_BUCKETS - 1 && hold_ns >= limit)
+    {
+        bucket++;
+        limit <<= 2;
+    }
+    osMutexShard::Add(ThreadShard.Get(Index).Hold[bucket], 1);
+}
+
+void osMutex::Wait()
 {
-    osThread* thread = osThread::GetCurrent();
-    if (thread != OwnerThread) {}
-    OwnerFile = nullptr;
-    OwnerLine = 0;
-    OwnerThread = nullptr;
 #ifdef _WIN32
-    ReleaseMutex(Handle);
+    int contended = CONTENDED;
+    WaitOnAddress(&State, &contended, sizeof(contended), INFINITE);
 #elif __linux__
-    pthread_mutex_unlock(&m_mutex);
+    syscall(SYS_futex, (int*)&State, FUTEX_WAIT_PRIVATE, CONTENDED, nullptr, nullptr, 0);
 #endif
 }
 
-void osMutex::Take(const char* file, int line)
+void osMutex::Wake()
 {
 #ifdef _WIN32
-    DWORD rc = -1;
+    WakeByAddressSingle(&State);
+#elif __linux__
+    syscall(SYS_futex, (int*)&State, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+#ifdef OS_MUTEX_DEBUG
+void osMutex::TakeTracked(const char* file, int line)
+{
+    osThread* thread = osThread::GetCurrent();
+    if (thread != nullptr && thread == OwnerThread)
+    {
+        printf("mutex \"%s\" taken recursively at %s:%d, held from %s:%d\n",
+               Name,
+               file,
+               line,
+               OwnerFile,
+               OwnerLine);
+    }
 
-    if (Handle)
+    bool profiling = Profiling.load(std::memory_order_relaxed);
+    uint64_t start = (profiling ? osTime::GetTime_ns() : 0);
+    bool contended = !TryTake();
+    if (contended)
     {
-        osThread* thread = osThread::GetCurrent();
         if (thread)
         {
-            thread->SetState(osThread::THREAD_STATE::PENDING_MUTEX, file, line, this);
+            thread->SetState(osThread::PENDING_MUTEX, file, line, this);
         }
-        rc = WaitForSingleObject(Handle, INFINITE);
+        TakeContended();
         if (thread)
         {
             thread->ClearState();
-            OwnerThread = thread;
         }
-        OwnerFile = file;
-        OwnerLine = line;
-    }
-#elif __linux__
-    osThread* thread = osThread::GetCurrent();
-    if (thread)
-    {
-        thread->SetState(osThread::PENDING_MUTEX, file, line, this);
     }
-    pthread_mutex_lock(&m_mutex);
-    if (thread)
+    if (profiling)
     {
-        thread->ClearState();
+        Acquired(contended, start);
     }
+    OwnerThread = thread;
     OwnerFile = file;
     OwnerLine = line;
-#endif
 }
 
-void osMutex::Take()
+void osMutex::ClearOwner()
 {
-#ifdef _WIN32
-    WaitForSingleObject(Handle, INFINITE) == 0;
-#elif __linux__
-    pthread_mutex_lock(&m_mutex);
-#endif
+    OwnerFile = nullptr;
+    OwnerLine = 0;
+    OwnerThread = nullptr;
 }
+#endif
 
 const char* osMutex::GetName()
 {
     return Name;
 }
 
-void osMutex::StaticInit()
+osMutex::Profile osMutex::GetProfile() const
 {
-    static bool IsInitialized = false;
-    if (!IsInitialized)
+    Profile profile = {};
+    if (Index >= 0)
     {
-        IsInitialized = true;
-#ifdef __linux__
-        pthread_mutexattr_t attr;
-        pthread_mutexattr_init(&attr);
-        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-        pthread_mutex_init(&MutexListMutex, &attr);
-#endif
+        LockListMutex();
+        profile = GetProfileLocked(Index);
+        UnlockListMutex();
+    }
+    return profile;
+}
+
+osMutex::Profile osMutex::GetProfileLocked(int index)
+{
+    Profile profile;
+    osMutexShard::Counters total;
+    osMutexShard::Clear(total);
+    osMutexShard::Fold(total, RetiredCounters[index]);
+    for (int i = 0; i < osMutexShard::SHARD_MAX; i++)
+    {
+        if (ShardList[i] != nullptr)
+        {
+            osMutexShard::Fold(total, ShardList[i]->Mutex[index]);
+        }
+    }
+
+    profile.Takes = total.Takes.load(std::memory_order_relaxed);
+    profile.Contended = total.Contended.load(std::memory_order_relaxed);
+    profile.WaitTotal_ns = total.WaitTotal_ns.load(std::memory_order_relaxed);
+    profile.WaitMax_ns = total.WaitMax_ns.load(std::memory_order_relaxed);
+    for (int i = 0; i < HOLD_BUCKETS; i++)
+    {
+        profile.Hold[i] = total.Hold[i].load(std::memory_order_relaxed);
+    }
+    return profile;
+}
+
+void osMutex::EnableProfile(bool enable)
+{
+    Profiling.store(enable, std::memory_order_relaxed);
+}
+
+void osMutex::ResetProfile()
+{
+    LockListMutex();
+    for (int i = 0; i < MAX_MUTEX; i++)
+    {
+        osMutexShard::Clear(RetiredCounters[i]);
+        for (int j = 0; j < osMutexShard::SHARD_MAX; j++)
+        {
+            if (ShardList[j] != nullptr)
+            {
+                osMutexShard::Clear(ShardList[j]->Mutex[i]);
+            }
+        }
     }
+    UnlockListMutex();
 }
 
 void osMutex::LockListMutex()
 {
-#ifdef __linux__
-    pthread_mutex_lock(&MutexListMutex);
-#endif
+    while (MutexListLock.exchange(true, std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
 }
 
 void osMutex::UnlockListMutex()
 {
-#ifdef __linux__
-    pthread_mutex_unlock(&MutexListMutex);
-#endif
+    MutexListLock.store(false, std::memory_order_release);
 }
 
 void osMutex::dump_info(std::ostream& out)
@@ -183,6 +433,16 @@ void osMutex::dump_info(std::ostream& out)
             std::string name = mutex->Name;
             std::string state;
             std::string owner;
+            switch (mutex->State.load(std::memory_order_relaxed))
+            {
+            case UNLOCKED: state = "free"; break;
+            case LOCKED: state = "taken"; break;
+            default: state = "wait"; break;
+            }
+            if (mutex->OwnerThread)
+            {
+                owner = mutex->OwnerThread->GetName();
+            }
             int line = -1;
             std::string file;
             if (mutex->OwnerFile)
@@ -199,3 +459,52 @@ void osMutex::dump_info(std::ostream& out)
     }
     UnlockListMutex();
 }
+
+void osMutex::dump_profile(std::ostream& out)
+{
+    out << "profiling is " << (IsProfileEnabled() ? "on" : "off") << "\n";
+    out << "--------------------+----------+----------+----------+----------+"
+           "----------------------------------------------\n";
+    out << " Name               |    Takes | Contended| Avg wait | Max wait |"
+           " Hold <256ns <1us <4us <16us <64us <256us <1ms more\n";
+    out << "--------------------+----------+----------+----------+----------+"
+           "----------------------------------------------\n";
+
+    // Copied under the list mutex, a mutex may be destroyed as soon as it is released
+    std::string names[MAX_MUTEX];
+    Profile profiles[MAX_MUTEX];
+    LockListMutex();
+    for (int i = 0; i < MAX_MUTEX; i++)
+    {
+        if (MutexList[i] != nullptr)
+        {
+            names[i] = MutexList[i]->Name;
+            profiles[i] = GetProfileLocked(i);
+        }
+        else
+        {
+            profiles[i].Takes = 0;
+        }
+    }
+    UnlockListMutex();
+
+    for (int i = 0; i < MAX_MUTEX; i++)
+    {
+        const Profile& profile = profiles[i];
+        if (profile.Takes == 0)
+        {
+            continue;
+        }
+        uint64_t average_wait = (profile.Contended ? profile.WaitTotal_ns / profile.Contended : 0);
+        out << std::setw(20) << names[i] << std::setw(0) << "|";
+        out << std::setw(10) << profile.Takes << std::setw(0) << "|";
+        out << std::setw(10) << profile.Contended << std::setw(0) << "|";
+        out << std::setw(8) << average_wait << "ns|";
+        out << std::setw(8) << profile.WaitMax_ns << "ns|";
+        for (int j = 0; j < HOLD_BUCKETS; j++)
+        {
+            out << " " << profile.Hold[j];
+        }
+        out << "\n";
+    }
+}
@@ -31,50 +31,161 @@
 
 #pragma once
 
-#ifdef _WIN32
-#elif __linux__
-#include <pthread.h>
-#endif
-
+#include <atomic>
+#include <cassert>
 #include <iostream>
+#include <stdint.h>
 
 class osThread;
 
-#define MAX_MUTEX (16)
+#define MAX_MUTEX (64)
+
+// osMutex is a non-recursive lock. An uncontended Take is a single compare-and-swap,
+// contended takers spin briefly and then sleep in the kernel (futex on Linux,
+// WaitOnAddress on Windows).
+//
+// Builds without NDEBUG assert that a thread never takes a mutex it already holds, which
+// would otherwise wait on itself forever. Building with OS_MUTEX_DEBUG also records the owning
+// osThread, file and line of every Take for dump_info and the thread pending state.
+//
+// Contention profiling is switched on at runtime with EnableProfile. Counters are kept in
+// per-thread shards so profiled takes don't share cache lines between threads, and are
+// summed when read.
 
 class osMutex
 {
     friend class osThread;
+    friend struct osMutexShard;
 
 public:
     osMutex(const char* name);
+    ~osMutex();
 
-    void Give();
-
-    void Take(const char* file, int line);
+    void Give()
+    {
+#ifndef NDEBUG
+        Owner.store(nullptr, std::memory_order_relaxed);
+#endif
+        if (HoldStart != 0)
+        {
+            Released();
+        }
+#ifdef OS_MUTEX_DEBUG
+        ClearOwner();
+#endif
+        if (State.exchange(UNLOCKED, std::memory_order_release) == CONTENDED)
+        {
+            Wake();
+        }
+    }
+
+    void Take(const char* file, int line)
+    {
+#ifndef NDEBUG
+        assert(Owner.load(std::memory_order_relaxed) != CurrentThread() &&
+               "osMutex taken recursively");
+#endif
+#ifdef OS_MUTEX_DEBUG
+        TakeTracked(file, line);
+#else
+        (void)file;
+        (void)line;
+        if (Profiling.load(std::memory_order_relaxed))
+        {
+            TakeProfiled();
+        }
+        else
+        {
+            int expected = UNLOCKED;
+            if (!State.compare_exchange_strong(
+                    expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                TakeContended();
+            }
+        }
+#endif
+#ifndef NDEBUG
+        Owner.store(CurrentThread(), std::memory_order_relaxed);
+#endif
+    }
+
+    bool TryTake()
+    {
+        int expected = UNLOCKED;
+        bool rc = State.compare_exchange_strong(
+            expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+#ifndef NDEBUG
+        if (rc)
+        {
+            Owner.store(CurrentThread(), std::memory_order_relaxed);
+        }
+#endif
+        return rc;
+    }
 
     const char* GetName();
 
     static void dump_info(std::ostream&);
 
+    static const int HOLD_BUCKETS = 8;
+
+    struct Profile
+    {
+        uint64_t Takes;
+        uint64_t Contended;   // Takes that found the mutex held
+        uint64_t WaitTotal_ns;
+        uint64_t WaitMax_ns;
+        // Hold time histogram, bucket 0 is under 256ns and each bucket after is 4 times wider
+        uint64_t Hold[HOLD_BUCKETS];
+    };
+    Profile GetProfile() const;
+
+    static void EnableProfile(bool enable);
+    static bool IsProfileEnabled() { return Profiling.load(std::memory_order_relaxed); }
+    /// @brief Zero the counters of every mutex, counts racing with the reset may survive it
+    static void ResetProfile();
+    static void dump_profile(std::ostream&);
+
 private:
-#ifdef _WIN32
-    void* Handle;
-#elif __linux__
-    pthread_mutex_t m_mutex;
-
-    // Can't use osMutex to lock the MutexList because you can't create an osMutex
-    // without locking the MutexList, so make a private mutex
-    static pthread_mutex_t MutexListMutex;
+    enum
+    {
+        UNLOCKED = 0,
+        LOCKED = 1,
+        CONTENDED = 2
+    };
+
+    void TakeContended();
+    void TakeProfiled();
+    void Acquired(bool contended, uint64_t start);
+    void Released();
+    void Wait();
+    void Wake();
+#ifdef OS_MUTEX_DEBUG
+    void TakeTracked(const char* file, int line);
+    void ClearOwner();
 #endif
 
-    static void StaticInit();
     static void LockListMutex();
     static void UnlockListMutex();
+    // Sum the counters of a list index, call with the list mutex held
+    static Profile GetProfileLocked(int index);
+
+    // A per-thread address, cheaper to get than a thread id
+    static const void* CurrentThread()
+    {
+        static thread_local char tag;
+        return &tag;
+    }
 
-    void Take();
+    std::atomic<int> State;
     const char* Name;
+    int Index; // Position in MutexList and in the profile shards, -1 if the list was full
+    uint64_t HoldStart; // osTime ns of the profiled Take, only touched by the owner
     static osMutex* MutexList[];
+    static std::atomic<bool> Profiling;
+    // The thread holding the mutex, only kept without NDEBUG but always present so the layout
+    // doesn't depend on it
+    std::atomic<const void*> Owner;
 
     const char* OwnerFile;
     int OwnerLine;
@@ -0,0 +1,356 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+#include <iomanip>
+#include <stdio.h>
+
+#include "osMutex.hpp"
+#include "osPool.hpp"
+
+static osPool* PoolList[MAX_POOL];
+static osMutex PoolListLock("pool list lock");
+static std::atomic<uint32_t> NextGeneration(1);
+// Pools destroyed so far, a thread only looks for magazines to reclaim when it has changed
+static std::atomic<uint32_t> DestroyedCount(0);
+
+// Magazines of one thread, one per pool it has used. Returned to the pools that still exist
+// when the thread exits.
+struct osPoolCache
+{
+    // Enough for the pools of two stacks, a thread that uses more leaves the rest uncached
+    static const int POOL_MAX = 16;
+    static const uint32_t FLUSH_HITS = 64;
+
+    struct Magazine
+    {
+        osPool* Pool;
+        uint32_t Generation;
+        uint32_t Count;
+        uint32_t Hits; // Counted here and added to the pool in batches
+        uint32_t Items[osPool::MAGAZINE_MAX];
+    };
+    Magazine Magazines[POOL_MAX];
+    // DestroyedCount when Reclaim last found every magazine in use
+    uint32_t ReclaimedAt;
+
+    Magazine* Find(osPool* pool)
+    {
+        Magazine* free = nullptr;
+
+        for (int i = 0; i < POOL_MAX; i++)
+        {
+            Magazine& magazine = Magazines[i];
+            if (magazine.Pool == pool)
+            {
+                if (magazine.Generation != pool->Generation)
+                {
+                    // Left by a destroyed pool at the same address, its objects are gone
+                    Claim(magazine, pool);
+                }
+                return &magazine;
+            }
+            if (magazine.Pool == nullptr && free == nullptr)
+            {
+                free = &magazine;
+            }
+        }
+        if (free == nullptr)
+        {
+            free = Reclaim();
+        }
+        if (free != nullptr)
+        {
+            Claim(*free, pool);
+        }
+        // nullptr when this thread uses too many pools, the rest go straight to the freelist
+        return free;
+    }
+
+    // @return true if pool is listed and is still the pool of that generation, call with
+    // PoolListLock held
+    static bool IsLive(osPool* pool, uint32_t generation)
+    {
+        for (size_t i = 0; i < MAX_POOL && pool != nullptr; i++)
+        {
+            if (PoolList[i] == pool)
+            {
+                return pool->Generation == generation;
+            }
+        }
+        return false;
+    }
+
+    static void Claim(Magazine& magazine, osPool* pool)
+    {
+        magazine.Pool = pool;
+        magazine.Generation = pool->Generation;
+        magazine.Count = 0;
+        magazine.Hits = 0;
+    }
+
+    // @return A magazine of a pool that has since been destroyed, nullptr if there is none
+    Magazine* Reclaim()
+    {
+        Magazine* rc = nullptr;
+        uint32_t destroyed = DestroyedCount.load(std::memory_order_acquire);
+
+        if (destroyed == ReclaimedAt)
+        {
+            // No pool has gone since the last look, so Get and Put of a pool this thread can't
+            // cache stay off the lock
+            return nullptr;
+        }
+
+        PoolListLock.Take(__FILE__, __LINE__);
+        for (int i = 0; i < POOL_MAX && rc == nullptr; i++)
+        {
+            if (!IsLive(Magazines[i].Pool, Magazines[i].Generation))
+            {
+                rc = &Magazines[i];
+            }
+        }
+        PoolListLock.Give();
+
+        if (rc == nullptr)
+        {
+            ReclaimedAt = destroyed;
+        }
+        return rc;
+    }
+
+    ~osPoolCache()
+    {
+        // Held so a pool can't be destroyed while its objects are being returned
+        PoolListLock.Take(__FILE__, __LINE__);
+        for (int i = 0; i < POOL_MAX; i++)
+        {
+            Magazine& magazine = Magazines[i];
+            if (magazine.Pool == nullptr || !IsLive(magazine.Pool, magazine.Generation))
+            {
+                continue;
+            }
+            while (magazine.Count > 0)
+            {
+                magazine.Pool->Push(magazine.Items[--magazine.Count]);
+            }
+            magazine.Pool->CacheHitCounter.fetch_add(magazine.Hits, std::memory_order_relaxed);
+        }
+        PoolListLock.Give();
+    }
+};
+
+static thread_local osPoolCache ThreadCache;
+
+osPool::osPool(
+    const char* name, void* base, size_t elementSize, int count, std::atomic<uint32_t>* links)
+    : Name(name)
+    , Generation(NextGeneration.fetch_add(1, std::memory_order_relaxed))
+    , Base((uint8_t*)base)
+    , ElementSize(elementSize)
+    , Capacity(count)
+    , MagazineSize(count / 8 < MAGAZINE_MAX ? count / 8 : MAGAZINE_MAX)
+    , Links(links)
+    , Head(EMPTY)
+    , FreeCount(0)
+    , LowWater(0)
+    , GetCounter(0)
+    , PutCounter(0)
+    , EmptyCounter(0)
+    , CacheHitCounter(0)
+{
+    bool registered = false;
+
+    PoolListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_POOL && !registered; i++)
+    {
+        if (PoolList[i] == nullptr)
+        {
+            PoolList[i] = this;
+            registered = true;
+        }
+    }
+    PoolListLock.Give();
+
+    if (!registered)
+    {
+        // Magazines are only emptied into pools that are registered, so an unlisted pool must
+        // not use them or objects cached by exiting threads would be lost
+        printf("osPool %s, more than %d pools, not listed and not cached\n",
+               Name,
+               MAX_POOL);
+        MagazineSize = 0;
+    }
+}
+
+osPool::~osPool()
+{
+    // Unlisted, exiting threads no longer return objects to it and the magazines other
+    // threads hold for it are dropped the next time they look, by the generation
+    PoolListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_POOL; i++)
+    {
+        if (PoolList[i] == this)
+        {
+            PoolList[i] = nullptr;
+        }
+    }
+    DestroyedCount.fetch_add(1, std::memory_order_release);
+    PoolListLock.Give();
+}
+
+void osPool::Fill()
+{
+    for (int i = Capacity - 1; i >= 0; i--)
+    {
+        Push(i);
+    }
+    LowWater.store(Capacity, std::memory_order_relaxed);
+}
+
+uint32_t osPool::Pop()
+{
+    uint64_t head = Head.load(std::memory_order_acquire);
+    uint64_t next;
+    uint32_t index;
+
+    do
+    {
+        index = (uint32_t)head;
+        if (index == EMPTY)
+        {
+            return EMPTY;
+        }
+        // The link may be stale if another thread popped this entry first, the tag then
+        // makes the exchange fail
+        next = (head & 0xFFFFFFFF00000000ULL) + (1ULL << 32);
+        next |= Links[index].load(std::memory_order_relaxed);
+    } while (!Head.compare_exchange_weak(
+        head, next, std::memory_order_acquire, std::memory_order_acquire));
+
+    int count = FreeCount.fetch_sub(1, std::memory_order_relaxed) - 1;
+    int low = LowWater.load(std::memory_order_relaxed);
+    while (count < low && !LowWater.compare_exchange_weak(low, count, std::memory_order_relaxed))
+    {
+    }
+    return index;
+}
+
+void osPool::Push(uint32_t index)
+{
+    uint64_t head = Head.load(std::memory_order_relaxed);
+    uint64_t next;
+
+    do
+    {
+        Links[index].store((uint32_t)head, std::memory_order_relaxed);
+        next = ((head & 0xFFFFFFFF00000000ULL) + (1ULL << 32)) | index;
+    } while (!Head.compare_exchange_weak(
+        head, next, std::memory_order_release, std::memory_order_relaxed));
+
+    FreeCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* osPool::Get()
+{
+    osPoolCache::Magazine* magazine = (MagazineSize > 0 ? ThreadCache.Find(this) : nullptr);
+
+    if (magazine != nullptr && magazine->Count > 0)
+    {
+        if (++magazine->Hits == osPoolCache::FLUSH_HITS)
+        {
+            CacheHitCounter.fetch_add(magazine->Hits, std::memory_order_relaxed);
+            magazine->Hits = 0;
+        }
+        return Object(magazine->Items[--magazine->Count]);
+    }
+
+    uint32_t index = Pop();
+    if (index == EMPTY)
+    {
+        EmptyCounter.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    GetCounter.fetch_add(1, std::memory_order_relaxed);
+    return Object(index);
+}
+
+void osPool::Put(void* object)
+{
+    uint32_t index = (uint32_t)(((uint8_t*)object - Base) / ElementSize);
+    osPoolCache::Magazine* magazine = (MagazineSize > 0 ? ThreadCache.Find(this) : nullptr);
+
+    // Only cache while the freelist has plenty, when it runs low a thread that found it empty
+    // may be waiting for this object
+    if (magazine != nullptr && magazine->Count < (uint32_t)MagazineSize &&
+        FreeCount.load(std::memory_order_relaxed) > MagazineSize)
+    {
+        magazine->Items[magazine->Count++] = index;
+        return;
+    }
+
+    PutCounter.fetch_add(1, std::memory_order_relaxed);
+    Push(index);
+}
+
+osPool::Statistics osPool::GetStatistics() const
+{
+    Statistics rc;
+    rc.Gets = GetCounter.load(std::memory_order_relaxed);
+    rc.Puts = PutCounter.load(std::memory_order_relaxed);
+    rc.CacheHits = CacheHitCounter.load(std::memory_order_relaxed);
+    rc.Empty = EmptyCounter.load(std::memory_order_relaxed);
+    rc.LowWater = LowWater.load(std::memory_order_relaxed);
+    return rc;
+}
+
+void osPool::dump_info(std::ostream& out)
+{
+    // Free is the shared freelist, objects cached in the threads' magazines are not counted
+    out << "Pool          |Size |Free |Low  |Gets        |Cache hits  |Empty\n";
+    out << "--------------+-----+-----+-----+------------+------------+----------\n";
+    PoolListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_POOL; i++)
+    {
+        osPool* pool = PoolList[i];
+        if (pool != nullptr)
+        {
+            Statistics stats = pool->GetStatistics();
+            out << std::setw(14) << std::left << pool->GetName() << "|";
+            out << std::setw(5) << pool->GetCapacity() << "|";
+            out << std::setw(5) << pool->GetCount() << "|";
+            out << std::setw(5) << stats.LowWater << "|";
+            out << std::setw(12) << stats.Gets << "|";
+            out << std::setw(12) << stats.CacheHits << "|";
+            out << stats.Empty << "\n";
+        }
+    }
+    PoolListLock.Give();
+}
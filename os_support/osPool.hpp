@@ -0,0 +1,117 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <inttypes.h>
+#include <iostream>
+
+// Pools that are listed and can be cached, StackShards checks a full set of shards fits
+#define MAX_POOL (128)
+
+/// A fixed set of objects handed out without a lock. Free objects sit on a freelist of array
+/// indexes whose head carries a tag against ABA. Each thread also keeps a small magazine of
+/// objects per pool so most Get/Put pairs never touch the shared freelist.
+///
+/// Objects cached in a thread's magazine go back to the freelist when the thread exits, if the
+/// pool still exists. Each pool has its own generation so a magazine left behind by a destroyed
+/// pool is never mistaken for one of a new pool built in the same place.
+class osPool
+{
+public:
+    /// @param base The first of count objects of elementSize bytes each, laid out as an array
+    /// @param links Storage for the freelist, one entry per object
+    osPool(const char* name,
+           void* base,
+           size_t elementSize,
+           int count,
+           std::atomic<uint32_t>* links);
+    ~osPool();
+
+    /// @brief Free every object, normally done once the objects are constructed
+    void Fill();
+
+    /// @return An object or nullptr if none are free
+    void* Get();
+    void Put(void* object);
+
+    const char* GetName() const { return Name; }
+    int GetCapacity() const { return Capacity; }
+    /// @return Objects on the shared freelist. Up to MAGAZINE_MAX more per thread may be free
+    /// in the threads' magazines, those are not counted so reading this never touches them.
+    int GetCount() const { return FreeCount.load(std::memory_order_relaxed); }
+
+    struct Statistics
+    {
+        uint64_t Gets;      // Taken from the shared freelist
+        uint64_t Puts;      // Returned to the shared freelist
+        uint64_t CacheHits; // Gets served from a thread's magazine
+        uint64_t Empty;     // Gets that found no free object
+        int LowWater;       // Fewest objects ever on the shared freelist
+    };
+    Statistics GetStatistics() const;
+
+    static void dump_info(std::ostream&);
+
+    static const int MAGAZINE_MAX = 8;
+
+private:
+    friend struct osPoolCache;
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+
+    uint32_t Pop();
+    void Push(uint32_t index);
+    void* Object(uint32_t index) const { return Base + index * ElementSize; }
+
+    const char* Name;
+    uint32_t Generation;
+    uint8_t* Base;
+    size_t ElementSize;
+    int Capacity;
+    // At most an eighth of the pool so objects cached by idle threads can't starve the others
+    int MagazineSize;
+    std::atomic<uint32_t>* Links;
+
+    // Padded off the line of the read-only fields above, as alignas would only be honoured by
+    // operator new from C++17
+    char PadHead[64];
+    // Tag in the upper 32 bits, index of the first free object in the lower
+    std::atomic<uint64_t> Head;
+    std::atomic<int> FreeCount;
+    std::atomic<int> LowWater;
+    std::atomic<uint64_t> GetCounter;
+    std::atomic<uint64_t> PutCounter;
+    std::atomic<uint64_t> EmptyCounter;
+    std::atomic<uint64_t> CacheHitCounter;
+
+    osPool(osPool&);
+};
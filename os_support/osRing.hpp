@@ -0,0 +1,265 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <inttypes.h>
+
+// Cache line size used to keep the producer and consumer indexes apart. The indexes are kept
+// apart by padding rather than alignas, operator new only honours over-alignment from C++17.
+#define OS_RING_CACHE_LINE (64)
+
+enum class osRingType
+{
+    SPSC, // One producer and one consumer at a time
+    MPMC  // Any number of producers and consumers
+};
+
+/// @return The smallest power of two that is at least count, for sizing an osRing
+constexpr size_t osRingSize(size_t count)
+{
+    size_t size = 1;
+    while (size < count)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+/// A bounded FIFO of T without a lock, header only. N must be a power of two so indexes wrap
+/// with a mask. Put fails when the ring is full and Get when it is empty, neither blocks.
+///
+/// The SPSC variant only needs the producer and consumer to be single threaded with respect to
+/// themselves, which an outside lock also satisfies. The MPMC variant is the bounded queue of
+/// Dmitry Vyukov, each slot carries a sequence number that says whose turn it is.
+template <typename T, size_t N, osRingType TYPE = osRingType::MPMC>
+class osRing;
+
+template <typename T, size_t N>
+class osRing<T, N, osRingType::SPSC>
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "osRing size must be a power of two");
+
+public:
+    osRing()
+        : In(0)
+        , Out(0)
+    {
+    }
+
+    bool Put(const T& item) { return PutN(&item, 1) == 1; }
+
+    bool Get(T& item) { return GetN(&item, 1) == 1; }
+
+    /// @return The number of items put, from the front of items
+    size_t PutN(const T* items, size_t count)
+    {
+        size_t in = In.load(std::memory_order_relaxed);
+        size_t space = N - (in - Out.load(std::memory_order_acquire));
+        if (count > space)
+        {
+            count = space;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            Slots[(in + i) & MASK] = items[i];
+        }
+        In.store(in + count, std::memory_order_release);
+        return count;
+    }
+
+    /// @return The number of items taken into items
+    size_t GetN(T* items, size_t count)
+    {
+        size_t out = Out.load(std::memory_order_relaxed);
+        size_t available = In.load(std::memory_order_acquire) - out;
+        if (count > available)
+        {
+            count = available;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            items[i] = Slots[(out + i) & MASK];
+        }
+        Out.store(out + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t GetCount() const
+    {
+        return In.load(std::memory_order_acquire) - Out.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t GetCapacity() { return N; }
+
+private:
+    static const size_t MASK = N - 1;
+
+    char PadHead[OS_RING_CACHE_LINE]; // Off the line of whatever precedes the ring
+    std::atomic<size_t> In;
+    char PadIn[OS_RING_CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> Out;
+    char PadOut[OS_RING_CACHE_LINE - sizeof(std::atomic<size_t>)];
+    T Slots[N];
+
+    osRing(osRing&);
+};
+
+template <typename T, size_t N>
+class osRing<T, N, osRingType::MPMC>
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "osRing size must be a power of two");
+
+public:
+    osRing()
+        : In(0)
+        , Out(0)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            Slots[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool Put(const T& item)
+    {
+        Slot* slot;
+        size_t in = In.load(std::memory_order_relaxed);
+        while (true)
+        {
+            slot = &Slots[in & MASK];
+            intptr_t turn = (intptr_t)slot->Sequence.load(std::memory_order_acquire) - (intptr_t)in;
+            if (turn == 0)
+            {
+                // The slot is free for position in, claim it
+                if (In.compare_exchange_weak(in, in + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (turn < 0)
+            {
+                // The slot still holds the item from one lap ago, the ring is full
+                return false;
+            }
+            else
+            {
+                in = In.load(std::memory_order_relaxed);
+            }
+        }
+        slot->Item = item;
+        slot->Sequence.store(in + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Get(T& item)
+    {
+        Slot* slot;
+        size_t out = Out.load(std::memory_order_relaxed);
+        while (true)
+        {
+            slot = &Slots[out & MASK];
+            intptr_t turn =
+                (intptr_t)slot->Sequence.load(std::memory_order_acquire) - (intptr_t)(out + 1);
+            if (turn == 0)
+            {
+                if (Out.compare_exchange_weak(out, out + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (turn < 0)
+            {
+                // Nothing has been put in this slot yet, the ring is empty
+                return false;
+            }
+            else
+            {
+                out = Out.load(std::memory_order_relaxed);
+            }
+        }
+        item = slot->Item;
+        slot->Sequence.store(out + N, std::memory_order_release);
+        return true;
+    }
+
+    /// @return The number of items put, from the front of items
+    size_t PutN(const T* items, size_t count)
+    {
+        size_t i = 0;
+        while (i < count && Put(items[i]))
+        {
+            i++;
+        }
+        return i;
+    }
+
+    /// @return The number of items taken into items
+    size_t GetN(T* items, size_t count)
+    {
+        size_t i = 0;
+        while (i < count && Get(items[i]))
+        {
+            i++;
+        }
+        return i;
+    }
+
+    /// @return The number of items, only exact when no other thread is using the ring
+    size_t GetCount() const
+    {
+        size_t out = Out.load(std::memory_order_acquire);
+        size_t in = In.load(std::memory_order_acquire);
+        return (in > out ? in - out : 0);
+    }
+
+    static constexpr size_t GetCapacity() { return N; }
+
+private:
+    static const size_t MASK = N - 1;
+
+    struct Slot
+    {
+        std::atomic<size_t> Sequence;
+        T Item;
+    };
+
+    char PadHead[OS_RING_CACHE_LINE]; // Off the line of whatever precedes the ring
+    std::atomic<size_t> In;
+    char PadIn[OS_RING_CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> Out;
+    char PadOut[OS_RING_CACHE_LINE - sizeof(std::atomic<size_t>)];
+    Slot Slots[N];
+
+    osRing(osRing&);
+};
@@ -0,0 +1,178 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#include <iomanip>
+#include <stdio.h>
+
+#include "osMutex.hpp"
+#include "osThreadPool.hpp"
+#include "osTime.hpp"
+
+static const size_t MAX_THREAD_POOL_COUNT = 8;
+static osThreadPool* ThreadPoolList[MAX_THREAD_POOL_COUNT];
+static osMutex ThreadPoolListLock("thread pool list lock");
+
+osThreadPool::osThreadPool(const char* name)
+    : Name(name)
+    , WorkerCount(0)
+    , Queue()
+    , WorkAvailable(name)
+    , SubmitCounter(0)
+    , CompleteCounter(0)
+    , RejectCounter(0)
+    , QueueWaitTotal(0)
+    , QueueWaitMax(0)
+    , BusyCount(0)
+    , QueueHighWater(0)
+{
+    ThreadPoolListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_THREAD_POOL_COUNT; i++)
+    {
+        if (ThreadPoolList[i] == nullptr)
+        {
+            ThreadPoolList[i] = this;
+            break;
+        }
+    }
+    ThreadPoolListLock.Give();
+}
+
+void osThreadPool::Start(int workerCount, int stackSize, int priority)
+{
+    if (WorkerCount != 0)
+    {
+        return;
+    }
+    if (workerCount > WORKER_MAX)
+    {
+        printf("osThreadPool %s limited to %d workers\n", Name, WORKER_MAX);
+        workerCount = WORKER_MAX;
+    }
+    for (int i = 0; i < workerCount; i++)
+    {
+        Workers[i].Create(WorkerEntry, Name, stackSize, priority, this);
+    }
+    WorkerCount = workerCount;
+}
+
+bool osThreadPool::Submit(ThreadEntryPtr entry, void* param)
+{
+    Work work = {entry, param, osTime::GetTime()};
+    if (!Queue.Put(work))
+    {
+        RejectCounter.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    SubmitCounter.fetch_add(1, std::memory_order_relaxed);
+
+    int count = (int)Queue.GetCount();
+    int highWater = QueueHighWater.load(std::memory_order_relaxed);
+    while (count > highWater && !QueueHighWater.compare_exchange_weak(highWater, count))
+    {
+    }
+
+    WorkAvailable.Notify();
+    return true;
+}
+
+void osThreadPool::WorkerEntry(void* param)
+{
+    ((osThreadPool*)param)->Worker();
+}
+
+void osThreadPool::Worker()
+{
+    Work work;
+    while (true)
+    {
+        WorkAvailable.Wait(__FILE__, __LINE__, [&]() { return Queue.Get(work); });
+
+        // Notify only wakes one worker, pass the wake on if there is more to do
+        if (Queue.GetCount() > 0)
+        {
+            WorkAvailable.Notify();
+        }
+
+        uint64_t wait_us = osTime::GetTime() - work.Queued_us;
+        QueueWaitTotal.fetch_add(wait_us, std::memory_order_relaxed);
+        uint64_t waitMax = QueueWaitMax.load(std::memory_order_relaxed);
+        while (wait_us > waitMax && !QueueWaitMax.compare_exchange_weak(waitMax, wait_us))
+        {
+        }
+
+        BusyCount.fetch_add(1, std::memory_order_relaxed);
+        work.Entry(work.Param);
+        BusyCount.fetch_sub(1, std::memory_order_relaxed);
+        CompleteCounter.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+osThreadPool::Statistics osThreadPool::GetStatistics() const
+{
+    Statistics stats;
+    stats.Submitted = SubmitCounter.load(std::memory_order_relaxed);
+    stats.Completed = CompleteCounter.load(std::memory_order_relaxed);
+    stats.Rejected = RejectCounter.load(std::memory_order_relaxed);
+    stats.QueueWaitTotal_us = QueueWaitTotal.load(std::memory_order_relaxed);
+    stats.QueueWaitMax_us = QueueWaitMax.load(std::memory_order_relaxed);
+    stats.Busy = BusyCount.load(std::memory_order_relaxed);
+    stats.QueueHighWater = QueueHighWater.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void osThreadPool::dump_info(std::ostream& out)
+{
+    out << "Thread Pool   |Workers|Busy |Queued|High |Completed   |Rejected |Avg wait |Max wait\n";
+    out << "--------------+-------+-----+------+-----+------------+---------+---------+---------\n";
+    ThreadPoolListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_THREAD_POOL_COUNT; i++)
+    {
+        osThreadPool* pool = ThreadPoolList[i];
+        if (pool != nullptr)
+        {
+            Statistics stats = pool->GetStatistics();
+            // Every started item has added its wait
+            uint64_t started = stats.Completed + stats.Busy;
+            uint64_t average = (started ? stats.QueueWaitTotal_us / started : 0);
+            out << std::setw(14) << std::left << pool->GetName() << "|";
+            out << std::setw(7) << pool->GetWorkerCount() << "|";
+            out << std::setw(5) << stats.Busy << "|";
+            out << std::setw(6) << pool->GetQueueCount() << "|";
+            out << std::setw(5) << stats.QueueHighWater << "|";
+            out << std::setw(12) << stats.Completed << "|";
+            out << std::setw(9) << stats.Rejected << "|";
+            out << std::setw(7) << average << "us|";
+            out << stats.QueueWaitMax_us << "us\n";
+        }
+    }
+    ThreadPoolListLock.Give();
+}
@@ -0,0 +1,107 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <atomic>
+#include <inttypes.h>
+#include <iostream>
+
+#include "osEvent.hpp"
+#include "osRing.hpp"
+#include "osThread.hpp"
+
+/// A fixed set of worker threads that run work items taken from a queue. Work is a function
+/// and a parameter, the same as an osThread entry, so code written for a thread per item can
+/// move to the pool unchanged.
+///
+/// The pool records how long items wait in the queue before a worker picks them up.
+class osThreadPool
+{
+public:
+    static const int WORKER_MAX = 16;
+    static const int QUEUE_MAX = 64;
+
+    osThreadPool(const char* name);
+
+    /// @brief Create the worker threads, only done once
+    /// @param workerCount Number of workers, at most WORKER_MAX
+    void Start(int workerCount, int stackSize, int priority);
+
+    /// @return false if the queue is full, the work is not run
+    bool Submit(ThreadEntryPtr entry, void* param);
+
+    const char* GetName() const { return Name; }
+    int GetWorkerCount() const { return WorkerCount; }
+    int GetQueueCount() const { return (int)Queue.GetCount(); }
+
+    struct Statistics
+    {
+        uint64_t Submitted;
+        uint64_t Completed;
+        uint64_t Rejected; // Submits that found the queue full
+        uint64_t QueueWaitTotal_us;
+        uint64_t QueueWaitMax_us;
+        int Busy;          // Workers running an item now
+        int QueueHighWater; // Most items ever waiting
+    };
+    Statistics GetStatistics() const;
+
+    static void dump_info(std::ostream&);
+
+private:
+    struct Work
+    {
+        ThreadEntryPtr Entry;
+        void* Param;
+        uint64_t Queued_us;
+    };
+
+    static void WorkerEntry(void* param);
+    void Worker();
+
+    const char* Name;
+    int WorkerCount;
+    osThread Workers[WORKER_MAX];
+    osRing<Work, QUEUE_MAX> Queue;
+    osEvent WorkAvailable;
+
+    std::atomic<uint64_t> SubmitCounter;
+    std::atomic<uint64_t> CompleteCounter;
+    std::atomic<uint64_t> RejectCounter;
+    std::atomic<uint64_t> QueueWaitTotal;
+    std::atomic<uint64_t> QueueWaitMax;
+    std::atomic<int> BusyCount;
+    std::atomic<int> QueueHighWater;
+
+    osThreadPool(osThreadPool&);
+};
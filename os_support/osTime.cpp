@@ -34,11 +34,35 @@
 #elif __linux__
 #include <time.h>
 #endif
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define OS_TIME_TSC
+#endif
+#include <atomic>
 #include <stdio.h>
 
 #include "osTime.hpp"
 
-uint64_t osTime::GetTime()
+// TSC ticks convert to ns as Base_ns + ((ticks - BaseTicks) * Mult) >> 32, anchored to the
+// system clock when calibrated so both sources share an epoch
+struct TSCClock
+{
+    uint64_t BaseTicks;
+    uint64_t Base_ns;
+    uint64_t Mult;
+    uint64_t Frequency;
+};
+static TSCClock TSC;
+
+// Constant initialized so times read by other static constructors are safe, -1 until the
+// first read picks a source
+static std::atomic<int> Source(-1);
+
+// Time cached by the innermost Batch on this thread, 0 outside of a Batch
+static thread_local uint64_t BatchNow_ns;
+
+static uint64_t ReadSystem_ns()
 {
 #ifdef _WIN32
     FILETIME ftime;
@@ -51,15 +75,149 @@ uint64_t osTime::GetTime()
     time <<= 32;
     time += ftime.dwLowDateTime;
 
-    return time;
+    return time * 100;
 #elif __linux__
     timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    uint64_t rc = ts.tv_sec * 1000000 + (ts.tv_nsec / 1000);
-    return rc;
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static bool CalibrateTSC()
+{
+#ifdef OS_TIME_TSC
+    if (!osTime::IsTSCInvariant())
+    {
+        return false;
+    }
+
+    uint64_t start_ns = ReadSystem_ns();
+    uint64_t start_ticks = __rdtsc();
+    timespec delay = {0, 10000000};
+    nanosleep(&delay, nullptr);
+    uint64_t end_ns = ReadSystem_ns();
+    uint64_t end_ticks = __rdtsc();
+
+    uint64_t ns = end_ns - start_ns;
+    uint64_t ticks = end_ticks - start_ticks;
+    if (ns == 0 || (int64_t)ticks <= 0)
+    {
+        return false;
+    }
+    TSC.Mult = (uint64_t)(((unsigned __int128)ns << 32) / ticks);
+    TSC.Frequency = ticks * 1000000000 / ns;
+    TSC.BaseTicks = end_ticks;
+    TSC.Base_ns = end_ns;
+    return true;
+#else
+    return false;
 #endif
 }
 
+static bool TSCAvailable()
+{
+    // A function static so that threads racing to the first read calibrate once
+    static const bool calibrated = CalibrateTSC();
+    return calibrated;
+}
+
+static int InitializeSource()
+{
+    int expected = -1;
+    int source = (TSCAvailable() ? osTime::SOURCE_TSC : osTime::SOURCE_SYSTEM);
+    if (!Source.compare_exchange_strong(expected, source, std::memory_order_acq_rel))
+    {
+        // SetClockSource got there first
+        source = expected;
+    }
+    return source;
+}
+
+uint64_t osTime::GetTime_ns()
+{
+    int source = Source.load(std::memory_order_acquire);
+    if (source < 0)
+    {
+        source = InitializeSource();
+    }
+#ifdef OS_TIME_TSC
+    if (source == SOURCE_TSC)
+    {
+        // Another core's TSC may be a few ticks behind the one that was calibrated
+        int64_t ticks = (int64_t)(__rdtsc() - TSC.BaseTicks);
+        if (ticks < 0)
+        {
+            ticks = 0;
+        }
+        return TSC.Base_ns + (uint64_t)(((unsigned __int128)ticks * TSC.Mult) >> 32);
+    }
+#endif
+    return ReadSystem_ns();
+}
+
+uint64_t osTime::Now_ns()
+{
+    uint64_t now = BatchNow_ns;
+    return (now != 0 ? now : GetTime_ns());
+}
+
+bool osTime::SetClockSource(ClockSource source)
+{
+    if (source == SOURCE_TSC && !TSCAvailable())
+    {
+        return false;
+    }
+    Source.store(source, std::memory_order_release);
+    return true;
+}
+
+osTime::ClockSource osTime::GetClockSource()
+{
+    int source = Source.load(std::memory_order_acquire);
+    if (source < 0)
+    {
+        source = InitializeSource();
+    }
+    return (ClockSource)source;
+}
+
+bool osTime::IsTSCInvariant()
+{
+#ifdef OS_TIME_TSC
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+
+    // CPUID 0x80000007 EDX bit 8, the TSC runs at a constant rate in every P, C and T state
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x80000007 &&
+        __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    {
+        return (edx & (1 << 8)) != 0;
+    }
+#endif
+    return false;
+}
+
+uint64_t osTime::GetTSCFrequency()
+{
+    return (GetClockSource() == SOURCE_TSC ? TSC.Frequency : 0);
+}
+
+osTime::Batch::Batch()
+    : Saved_ns(BatchNow_ns)
+{
+    if (Saved_ns == 0)
+    {
+        BatchNow_ns = GetTime_ns();
+    }
+}
+
+osTime::Batch::~Batch()
+{
+    BatchNow_ns = Saved_ns;
+}
+
 const char* osTime::GetTimestamp()
 {
     static char s[64];
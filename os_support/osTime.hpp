@@ -29,6 +29,7 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //----------------------------------------------------------------------------
 
+
 #pragma once
 
 #include <inttypes.h>
@@ -36,7 +37,46 @@
 class osTime
 {
 public:
+    enum ClockSource
+    {
+        SOURCE_SYSTEM, // clock_gettime(CLOCK_MONOTONIC)
+        SOURCE_TSC     // Calibrated invariant TSC, a few ns a read
+    };
+
     static const char* GetTimestamp();
 
-    static uint64_t GetTime();
+    /// @return Monotonic time in microseconds, the same as GetTime_us
+    static uint64_t GetTime() { return GetTime_ns() / 1000; }
+    static uint64_t GetTime_us() { return GetTime_ns() / 1000; }
+    static uint64_t GetTime_ns();
+
+    /// @return The time cached by the innermost Batch on this thread, or the current time
+    /// when there is no Batch
+    static uint64_t Now_us() { return Now_ns() / 1000; }
+    static uint64_t Now_ns();
+
+    /// @brief Select the clock behind GetTime. TSC is the default where the processor reports
+    /// an invariant TSC. Best called at start up, the TSC is anchored to the system clock
+    /// when calibrated but drifts from it by the calibration error.
+    /// @return false if the source is not available, the current source is unchanged
+    static bool SetClockSource(ClockSource);
+    static ClockSource GetClockSource();
+    static bool IsTSCInvariant();
+    /// @return The measured TSC rate in Hz, 0 if the TSC is not used
+    static uint64_t GetTSCFrequency();
+
+    /// Reads the clock once and serves that time from Now_us and Now_ns until destroyed, so
+    /// everything timed while handling a received frame or a timer tick costs one read.
+    /// A Batch nested in another keeps the outer Batch's time.
+    class Batch
+    {
+    public:
+        Batch();
+        ~Batch();
+
+    private:
+        uint64_t Saved_ns;
+
+        Batch(Batch&);
+    };
 };
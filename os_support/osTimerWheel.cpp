@@ -0,0 +1,371 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#include <iomanip>
+#include <stdio.h>
+
+#include "osTime.hpp"
+#include "osTimerWheel.hpp"
+
+static const size_t MAX_TIMER_WHEEL_COUNT = 8;
+static osTimerWheel* TimerWheelList[MAX_TIMER_WHEEL_COUNT];
+static osMutex TimerWheelListLock("timer wheel list lock");
+
+osTimer::osTimer(const char* name, osTimerCallback callback, void* param)
+    : Name(name)
+    , Callback(callback)
+    , Param(param)
+    , Expires(0)
+    , Pending(false)
+    , Level(0)
+    , Slot(0)
+    , Next(nullptr)
+    , Prev(nullptr)
+{
+}
+
+osTimerWheel::osTimerWheel(const char* name, uint32_t tick_us)
+    : Name(name)
+    , Tick_us(tick_us)
+    , NextTick(osTime::GetTime() / tick_us)
+    , Count(0)
+    , Slots()
+    , Occupied()
+    , Lock(name)
+    , Changed(name)
+    , WakeTick(0)
+{
+    TimerWheelListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_TIMER_WHEEL_COUNT; i++)
+    {
+        if (TimerWheelList[i] == nullptr)
+        {
+            TimerWheelList[i] = this;
+            break;
+        }
+    }
+    TimerWheelListLock.Give();
+}
+
+osTimerWheel::~osTimerWheel()
+{
+    TimerWheelListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_TIMER_WHEEL_COUNT; i++)
+    {
+        if (TimerWheelList[i] == this)
+        {
+            TimerWheelList[i] = nullptr;
+        }
+    }
+    TimerWheelListLock.Give();
+}
+
+void osTimerWheel::Start(osTimer* timer, uint64_t delay_us, uint64_t now_us)
+{
+    bool wake;
+
+    Lock.Take(__FILE__, __LINE__);
+    if (timer->Pending)
+    {
+        Unlink(timer);
+    }
+    // Round up so a timer never fires early
+    timer->Expires = (now_us + delay_us + Tick_us - 1) / Tick_us;
+    Insert(timer);
+    wake = (WakeTick != 0 && timer->Expires < WakeTick);
+    Lock.Give();
+
+    if (wake)
+    {
+        Changed.Notify();
+    }
+}
+
+void osTimerWheel::Start(osTimer* timer, uint64_t delay_us)
+{
+    Start(timer, delay_us, osTime::Now_us());
+}
+
+void osTimerWheel::Stop(osTimer* timer)
+{
+    Lock.Take(__FILE__, __LINE__);
+    if (timer->Pending)
+    {
+        Unlink(timer);
+    }
+    Lock.Give();
+}
+
+void osTimerWheel::Insert(osTimer* timer)
+{
+    uint64_t slotTick = timer->Expires;
+    int64_t delta = (int64_t)(timer->Expires - NextTick);
+    int level;
+
+    if (delta < 0)
+    {
+        // Already due, runs on the next tick processed
+        level = 0;
+        slotTick = NextTick;
+    }
+    else
+    {
+        level = 0;
+        while (level < LEVELS - 1 && delta >= ((int64_t)1 << (SLOT_BITS * (level + 1))))
+        {
+            level++;
+        }
+        if (delta >= ((int64_t)1 << (SLOT_BITS * LEVELS)))
+        {
+            // Beyond the wheel, park it in the furthest slot and place it again from there
+            slotTick = NextTick + ((uint64_t)1 << (SLOT_BITS * LEVELS)) - 1;
+        }
+    }
+
+    int slot = (int)(slotTick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    osTimer*& head = Slots[level][slot];
+    timer->Level = (uint8_t)level;
+    timer->Slot = (uint8_t)slot;
+    timer->Prev = nullptr;
+    timer->Next = head;
+    if (head != nullptr)
+    {
+        head->Prev = timer;
+    }
+    head = timer;
+    Occupied[level] |= (uint64_t)1 << slot;
+    timer->Pending = true;
+    Count++;
+}
+
+void osTimerWheel::Unlink(osTimer* timer)
+{
+    if (timer->Prev != nullptr)
+    {
+        timer->Prev->Next = timer->Next;
+    }
+    else
+    {
+        Slots[timer->Level][timer->Slot] = timer->Next;
+        if (timer->Next == nullptr)
+        {
+            Occupied[timer->Level] &= ~((uint64_t)1 << timer->Slot);
+        }
+    }
+    if (timer->Next != nullptr)
+    {
+        timer->Next->Prev = timer->Prev;
+    }
+    timer->Next = nullptr;
+    timer->Prev = nullptr;
+    timer->Pending = false;
+    Count--;
+}
+
+void osTimerWheel::Cascade(int level, int slot)
+{
+    osTimer* timer;
+    while ((timer = Slots[level][slot]) != nullptr)
+    {
+        Unlink(timer);
+        Insert(timer);
+    }
+}
+
+int osTimerWheel::Advance(uint64_t now_us)
+{
+    uint64_t target = now_us / Tick_us;
+    int fired = 0;
+
+    Lock.Take(__FILE__, __LINE__);
+    while (NextTick <= target)
+    {
+        if (Count == 0)
+        {
+            NextTick = target + 1;
+            break;
+        }
+
+        int index = (int)(NextTick & (SLOTS - 1));
+        if (index == 0)
+        {
+            // Bring the next block of timers down from each level that has wrapped
+            for (int level = 1; level < LEVELS; level++)
+            {
+                int slot = (int)(NextTick >> (SLOT_BITS * level)) & (SLOTS - 1);
+                Cascade(level, slot);
+                if (slot != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (Occupied[0] == 0)
+        {
+            // Nothing due before the next cascade
+            uint64_t boundary = (NextTick | (SLOTS - 1)) + 1;
+            NextTick = (boundary < target + 1 ? boundary : target + 1);
+            continue;
+        }
+
+        NextTick++;
+        osTimer* timer;
+        while ((timer = Slots[0][index]) != nullptr)
+        {
+            Unlink(timer);
+            Lock.Give();
+            timer->Callback(timer->Param);
+            fired++;
+            Lock.Take(__FILE__, __LINE__);
+        }
+    }
+    Lock.Give();
+
+    return fired;
+}
+
+// Lowest k >= first with bit (index + k) % 64 set, or 64 + first if there is none
+static int FirstSlotFrom(uint64_t occupied, int index, int first)
+{
+    for (int k = first; k < first + 64; k++)
+    {
+        if (occupied & ((uint64_t)1 << ((index + k) & 63)))
+        {
+            return k;
+        }
+    }
+    return 64 + first;
+}
+
+uint64_t osTimerWheel::NextExpiryTick()
+{
+    uint64_t next = UINT64_MAX;
+
+    if (Count == 0)
+    {
+        return next;
+    }
+
+    if (Occupied[0] != 0)
+    {
+        // Everything on level 0 is due within SLOTS ticks
+        next = NextTick + FirstSlotFrom(Occupied[0], (int)(NextTick & (SLOTS - 1)), 0);
+    }
+    for (int level = 1; level < LEVELS; level++)
+    {
+        if (Occupied[level] != 0)
+        {
+            // A slot is cascaded when NextTick reaches its start, the current slot has
+            // already been unless NextTick is exactly on its start
+            int shift = SLOT_BITS * level;
+            uint64_t unit = NextTick >> shift;
+            int first = ((NextTick & (((uint64_t)1 << shift) - 1)) == 0 ? 0 : 1);
+            int k = FirstSlotFrom(Occupied[level], (int)(unit & (SLOTS - 1)), first);
+            uint64_t tick = (unit + k) << shift;
+            if (tick < next)
+            {
+                next = tick;
+            }
+        }
+    }
+
+    return next;
+}
+
+uint64_t osTimerWheel::GetNextExpiry_us()
+{
+    Lock.Take(__FILE__, __LINE__);
+    uint64_t tick = NextExpiryTick();
+    Lock.Give();
+    return (tick == UINT64_MAX ? UINT64_MAX : tick * Tick_us);
+}
+
+void osTimerWheel::WaitForNext(int msTimeout)
+{
+    uint64_t now_us = osTime::GetTime();
+    uint64_t limit = (now_us + (uint64_t)msTimeout * 1000) / Tick_us;
+
+    Lock.Take(__FILE__, __LINE__);
+    uint64_t wake = NextExpiryTick();
+    if (wake > limit)
+    {
+        wake = limit;
+    }
+    WakeTick = (wake == 0 ? 1 : wake);
+    Lock.Give();
+
+    uint64_t wake_us = wake * Tick_us;
+    if (wake_us > now_us)
+    {
+        Changed.Wait(__FILE__, __LINE__, (int)((wake_us - now_us + 999) / 1000));
+    }
+
+    Lock.Take(__FILE__, __LINE__);
+    WakeTick = 0;
+    Lock.Give();
+}
+
+void osTimerWheel::dump_info(std::ostream& out)
+{
+    uint64_t now_us = osTime::GetTime();
+
+    TimerWheelListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_TIMER_WHEEL_COUNT; i++)
+    {
+        osTimerWheel* wheel = TimerWheelList[i];
+        if (wheel == nullptr)
+        {
+            continue;
+        }
+        out << "Timer wheel " << wheel->Name << ", tick " << wheel->Tick_us << "us, "
+            << wheel->Count << " pending\n";
+        out << "Timer                    |Due in ms\n";
+        out << "-------------------------+----------\n";
+        wheel->Lock.Take(__FILE__, __LINE__);
+        for (int level = 0; level < LEVELS; level++)
+        {
+            for (int slot = 0; slot < SLOTS; slot++)
+            {
+                for (osTimer* timer = wheel->Slots[level][slot]; timer; timer = timer->Next)
+                {
+                    int64_t due_us = (int64_t)(timer->Expires * wheel->Tick_us - now_us);
+                    out << std::setw(25) << std::left << timer->Name << "|";
+                    out << due_us / 1000 << "\n";
+                }
+            }
+        }
+        wheel->Lock.Give();
+        out << "\n";
+    }
+    TimerWheelListLock.Give();
+}
@@ -0,0 +1,129 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <inttypes.h>
+#include <iostream>
+
+#include "osEvent.hpp"
+#include "osMutex.hpp"
+
+typedef void (*osTimerCallback)(void* param);
+
+class osTimerWheel;
+
+/// A timer owned by its user, usually a member of the object it times. Starting and stopping
+/// a timer never allocates.
+class osTimer
+{
+public:
+    osTimer(const char* name, osTimerCallback callback, void* param);
+
+    const char* GetName() const { return Name; }
+    bool IsPending() const { return Pending; }
+
+private:
+    friend class osTimerWheel;
+
+    const char* Name;
+    osTimerCallback Callback;
+    void* Param;
+    uint64_t Expires; // In wheel ticks
+    bool Pending;
+    uint8_t Level;
+    uint8_t Slot;
+    osTimer* Next;
+    osTimer* Prev;
+
+    osTimer(osTimer&);
+};
+
+/// Hierarchical timing wheel. Starting and stopping a timer are O(1) and a tick with nothing
+/// due costs a bitmask test. Four levels of 64 slots cover 2^24 ticks; later timers are parked
+/// in the last slot and placed again when it comes round.
+///
+/// Time only moves when Advance is called, callbacks run from Advance without the wheel's lock
+/// held so they may start and stop timers. WaitForNext sleeps until the next timer is due,
+/// or until a timer is started that is due sooner, so an idle wheel costs nothing.
+class osTimerWheel
+{
+public:
+    /// @param tick_us Resolution, timers expire on a tick boundary at or after their time
+    osTimerWheel(const char* name, uint32_t tick_us);
+    ~osTimerWheel();
+
+    /// @brief Start or restart a timer delay_us after now_us
+    void Start(osTimer*, uint64_t delay_us, uint64_t now_us);
+    /// @brief Start or restart a timer delay_us from osTime::Now_us
+    void Start(osTimer*, uint64_t delay_us);
+    void Stop(osTimer*);
+
+    /// @brief Run every timer due at or before now_us
+    /// @return The number of callbacks run
+    int Advance(uint64_t now_us);
+
+    /// @return The time Advance next has work to do, UINT64_MAX if no timer is pending
+    uint64_t GetNextExpiry_us();
+
+    /// @brief Block until the next timer is due, a sooner timer is started or msTimeout
+    void WaitForNext(int msTimeout);
+
+    const char* GetName() const { return Name; }
+    int GetCount() const { return Count; }
+    uint32_t GetTick_us() const { return Tick_us; }
+
+    static void dump_info(std::ostream&);
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    void Insert(osTimer*);
+    void Unlink(osTimer*);
+    void Cascade(int level, int slot);
+    uint64_t NextExpiryTick();
+
+    const char* Name;
+    uint32_t Tick_us;
+    uint64_t NextTick; // Next tick Advance will process
+    int Count;
+    osTimer* Slots[LEVELS][SLOTS];
+    uint64_t Occupied[LEVELS]; // Bit per non-empty slot
+
+    osMutex Lock;
+    osEvent Changed;
+    uint64_t WakeTick; // When WaitForNext intends to wake, 0 if nobody is waiting
+
+    osTimerWheel(osTimerWheel&);
+};
@@ -36,22 +36,32 @@
 #include <winsock.h>
 #elif __linux__
 #include <errno.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
+#include <linux/filter.h>
 #include <linux/icmp.h>
 #include <linux/if_arp.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <linux/if_tun.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 #endif
 #include <cstring>
 #include <stdio.h>
 
+#include "DataBuffer.hpp"
 #include "InterfaceMAC.hpp"
 #include "PacketIO.hpp"
 #include "Utility.hpp"
+#include "osTime.hpp"
 
 #define Max_Num_Adapter 10
 char AdapterList[Max_Num_Adapter][1024];
@@ -306,9 +316,99 @@ void PacketIO::TxData(void* packet, size_t length)
         fprintf(stderr, "\nError sending the packet: %s\n", pcap_geterr(adhandle));
     }
 }
+
+void PacketIO::TxData(DataBuffer* buffer)
+{
+    // pcap has no gather send
+    u_char packet[DATA_BUFFER_JUMBO_SIZE];
+    size_t length = 0;
+
+    for (DataBuffer* segment = buffer; segment != nullptr; segment = segment->Next)
+    {
+        if (length + segment->Length > sizeof(packet))
+        {
+            fprintf(stderr, "\nError sending the packet: too large\n");
+            return;
+        }
+        memcpy(&packet[length], segment->Packet, segment->Length);
+        length += segment->Length;
+    }
+    TxData(packet, length);
+}
 #elif __linux__
 
-PacketIO::PacketIO() {}
+PacketIO::PacketIO()
+    : m_RawSocket(-1)
+    , m_IfIndex(0)
+    , m_FrameSize(ETH_FRAME_LEN)
+    , m_RxDropCount(0)
+    , m_RxMode(RX_SOCKET)
+    , m_BlockSize(PACKET_RING_BLOCK_SIZE)
+    , m_BlockCount(PACKET_RING_BLOCK_COUNT)
+    , m_BlockTimeout_ms(PACKET_RING_BLOCK_TIMEOUT_MS)
+    , m_Ring(nullptr)
+    , m_RxKernelDropCount(0)
+    , m_TxLock("PacketIO tx")
+    , m_TxQueue()
+    , m_TxCount(0)
+    , m_TxThreshold(1)
+    , m_TxTimers(nullptr)
+    , m_TxTimer("PacketIO tx flush", TxTimeout, this)
+    , m_TapName()
+    , m_TapQueues(0)
+    , m_TapFd()
+    , m_TapNextQueue(0)
+    , m_ReplayPath(nullptr)
+    , m_ReplayRealtime(false)
+    , m_Replay()
+    , m_Capture()
+    , m_FilterAddress()
+    , m_Filtered(false)
+    , m_FanoutGroup(0)
+    , m_FanoutShard(0)
+    , m_FanoutCount(0)
+{
+}
+
+void PacketIO::SetTap(const char* name, int queues)
+{
+    strncpy(m_TapName, name, sizeof(m_TapName) - 1);
+    m_TapQueues = (queues < 1 ? 1 : queues > PACKET_TAP_QUEUE_MAX ? PACKET_TAP_QUEUE_MAX : queues);
+}
+
+uint32_t PacketIO::GetChecksumOffload() const
+{
+    // The kernel completes a checksum described in the virtio_net_hdr, not the IPv4 header's
+    return (m_TapQueues > 0 ? InterfaceMAC::OFFLOAD_TX_L4_CHECKSUM : 0);
+}
+
+void PacketIO::SetReplay(const char* path, bool realtime)
+{
+    m_ReplayPath = path;
+    m_ReplayRealtime = realtime;
+}
+
+bool PacketIO::SetCapture(const char* path)
+{
+    m_TxLock.Take(__FILE__, __LINE__);
+    bool rc = m_Capture.Open(path);
+    m_TxLock.Give();
+    return rc;
+}
+
+// Capture files are stamped with the wall clock, the stack's clock is only monotonic
+static uint64_t CaptureTime_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void PacketIO::SetRingSize(uint32_t blockSize, uint32_t blockCount)
+{
+    m_BlockSize = blockSize;
+    m_BlockCount = blockCount;
+}
 
 void PacketIO::DisplayDevices()
 {
@@ -377,7 +477,7 @@ void PacketIO::GetInterface(char* name)
     }
 }
 
-void PacketIO::Start(RxDataHandler rxData)
+bool PacketIO::Open()
 {
     m_RawSocket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
     if (m_RawSocket == -1)
@@ -391,42 +491,838 @@ void PacketIO::Start(RxDataHandler rxData)
         {
             printf("Error while creating socket. Aborting...\n");
         }
+        return false;
     }
-    else
+
+    // Filter before anything else is queued on the socket
+    if (m_Filtered)
+    {
+        AttachAddressFilter(m_RawSocket, m_FilterAddress);
+    }
+
+    struct ifreq ifr;
+    PacketIO::GetInterface(ifr.ifr_name);
+    printf("Using interface '%s'\n", ifr.ifr_name);
+
+    // Find the socket index for tx later
+    if (ioctl(m_RawSocket, SIOCGIFINDEX, &ifr) == -1)
+    {
+        printf("oh crap %s\n", strerror(errno));
+    }
+    m_IfIndex = ifr.ifr_ifindex;
+
+    // Size receive buffers for the largest frame the interface will pass up
+    m_FrameSize = ETH_FRAME_LEN;
+    if (ioctl(m_RawSocket, SIOCGIFMTU, &ifr) == 0)
+    {
+        m_FrameSize = ifr.ifr_mtu + ETH_HLEN;
+    }
+
+    // Set socket to promiscuous mode
+    struct packet_mreq mreq;
+    mreq.mr_ifindex = m_IfIndex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    mreq.mr_alen = 6;
+    if (setsockopt(
+            m_RawSocket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, (socklen_t)sizeof(mreq)) < 0)
+    {
+        printf("promiscuous membership error %s", strerror(errno));
+    }
+
+    return true;
+}
+
+bool PacketIO::SetAddressFilter(const uint8_t* address)
+{
+    if (address == nullptr)
+    {
+        m_Filtered = false;
+        if (m_RawSocket != -1 &&
+            setsockopt(m_RawSocket, SOL_SOCKET, SO_DETACH_FILTER, nullptr, 0) < 0)
+        {
+            printf("failed to remove the address filter %s\n", strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    memcpy(m_FilterAddress, address, sizeof(m_FilterAddress));
+    m_Filtered = true;
+    // Replaces the filter of an open socket in one step, Open attaches it otherwise
+    return (m_RawSocket == -1 || AttachAddressFilter(m_RawSocket, m_FilterAddress));
+}
+
+bool PacketIO::AttachAddressFilter(int fd, const uint8_t* address)
+{
+    uint32_t low = Unpack32(address, 2);
+    uint32_t high = Unpack16(address, 0);
+
+    // Destination address, bytes 2 to 5 then 0 and 1, equal to address or broadcast
+    struct sock_filter program[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 2),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, low, 0, 2),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, high, 3, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xFFFFFFFF, 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xFFFF, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0x40000), // Accept the whole frame
+        BPF_STMT(BPF_RET | BPF_K, 0),       // Drop
+    };
+    struct sock_fprog filter;
+    filter.len = sizeof(program) / sizeof(program[0]);
+    filter.filter = program;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0)
+    {
+        printf("failed to attach the address filter %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void PacketIO::SetFanout(uint16_t group, int shard, int shardCount)
+{
+    m_FanoutGroup = group;
+    m_FanoutShard = shard;
+    m_FanoutCount = shardCount;
+}
+
+// Shards that have joined each fanout group, the kernel numbers members in the order they join
+struct FanoutGroup
+{
+    bool InUse;
+    uint16_t Group;
+    std::atomic<int> Joined;
+};
+static osMutex FanoutLock("fanout lock");
+static FanoutGroup FanoutGroups[PACKET_FANOUT_GROUP_MAX];
+
+// @return The entry for group, a free one is claimed the first time a group is seen
+static FanoutGroup* FindFanoutGroup(uint16_t group)
+{
+    FanoutGroup* rc = nullptr;
+
+    FanoutLock.Take(__FILE__, __LINE__);
+    for (int i = 0; i < PACKET_FANOUT_GROUP_MAX && rc == nullptr; i++)
+    {
+        if (FanoutGroups[i].InUse && FanoutGroups[i].Group == group)
+        {
+            rc = &FanoutGroups[i];
+        }
+    }
+    for (int i = 0; i < PACKET_FANOUT_GROUP_MAX && rc == nullptr; i++)
+    {
+        if (!FanoutGroups[i].InUse)
+        {
+            rc = &FanoutGroups[i];
+            rc->InUse = true;
+            rc->Group = group;
+            rc->Joined = 0;
+        }
+    }
+    FanoutLock.Give();
+
+    return rc;
+}
+
+bool PacketIO::JoinFanout()
+{
+    if (m_FanoutCount == 0)
+    {
+        return true;
+    }
+
+    FanoutGroup* group = FindFanoutGroup(m_FanoutGroup);
+    if (group == nullptr)
+    {
+        printf("failed to join fanout group %d, %d groups are supported\n",
+               m_FanoutGroup,
+               PACKET_FANOUT_GROUP_MAX);
+        return false;
+    }
+    if (m_FanoutShard == 0)
+    {
+        // Shard 0 joins first, anything counted before it is from an earlier start
+        group->Joined = 0;
+    }
+
+    for (int i = 0; i < 1000 && group->Joined.load() < m_FanoutShard; i++)
+    {
+        osThread::Sleep(1, __FILE__, __LINE__);
+    }
+    if (group->Joined.load() != m_FanoutShard)
+    {
+        printf("fanout shard %d joining out of order, frames may reach the wrong shard\n",
+               m_FanoutShard);
+    }
+
+    // No fallback to the kernel's flow hash, it would keep each connection on one shard but
+    // not on the shard that opened it
+    bool rc = true;
+    int arg = m_FanoutGroup | (PACKET_FANOUT_CBPF << 16);
+    if (setsockopt(m_RawSocket, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0)
+    {
+        printf("failed to join fanout group %d %s\n", m_FanoutGroup, strerror(errno));
+        rc = false;
+    }
+    else if (!AttachFanoutProgram(m_RawSocket))
+    {
+        rc = false;
+    }
+
+    // Counted even on failure so the shards above are not held up
+    group->Joined++;
+    return rc;
+}
+
+bool PacketIO::FanoutProgramAvailable()
+{
+    // An ethertype nothing uses, the socket only has to be running to join a group
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_802_EX1));
+    if (fd == -1)
+    {
+        printf("failed to open the fanout probe socket %s\n", strerror(errno));
+        return false;
+    }
+
+    // The kernel picks an unused group id, it goes away with the socket
+    int arg = (PACKET_FANOUT_CBPF | PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+    bool rc = setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == 0 &&
+              AttachFanoutProgram(fd);
+    close(fd);
+    return rc;
+}
+
+bool PacketIO::AttachFanoutProgram(int fd)
+{
+    // Offsets from SKF_NET_OFF are from the IPv4 header wherever the frame starts. The result
+    // is taken modulo the number of sockets in the group.
+    const uint32_t net = SKF_NET_OFF;
+    const uint32_t protocol = SKF_AD_OFF + SKF_AD_PROTOCOL;
+    struct sock_filter program[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, protocol),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 22),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, net + 9),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 0, 20),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, net + 6),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, 18, 0), // Fragment, no ports
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, net + 12),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, net + 16),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ST, 0),                      // M[0] = source ^ target address
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, net), // X = IPv4 header length
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, net),
+        BPF_STMT(BPF_ST, 1), // M[1] = source port
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, net + 2),
+        BPF_STMT(BPF_LDX | BPF_MEM, 1),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_LDX | BPF_MEM, 0),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ST, 0),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_LDX | BPF_MEM, 0),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0), // Fold in the top half
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0), // Shard 0
+    };
+    struct sock_fprog filter;
+    filter.len = sizeof(program) / sizeof(program[0]);
+    filter.filter = program;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT_DATA, &filter, sizeof(filter)) < 0)
+    {
+        printf("failed to attach the fanout program %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// struct virtio_net_hdr, linux/virtio_net.h can't be included from C++
+struct VirtioNetHeader
+{
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+};
+static const uint8_t VIRTIO_NET_HDR_F_NEEDS_CSUM = 1;
+static const uint8_t VIRTIO_NET_HDR_F_DATA_VALID = 2;
+static const uint8_t VIRTIO_NET_HDR_GSO_NONE = 0;
+
+// Point iov at each segment of a chained frame
+// @return The number of segments, 0 if there are more than max
+static int GatherSegments(DataBuffer* buffer, struct iovec* iov, int max)
+{
+    int count = 0;
+
+    for (DataBuffer* segment = buffer; segment != nullptr; segment = segment->Next)
+    {
+        if (count == max)
+        {
+            printf("tx error, more than %d segments\n", max);
+            return 0;
+        }
+        iov[count].iov_base = segment->Packet;
+        iov[count].iov_len = segment->Length;
+        count++;
+    }
+    return count;
+}
+
+bool PacketIO::OpenTap()
+{
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, m_TapName, IFNAMSIZ - 1);
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    if (m_TapQueues > 1)
+    {
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+
+    for (int i = 0; i < m_TapQueues; i++)
+    {
+        int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+        if (fd < 0)
+        {
+            printf("can't open /dev/net/tun %s\n", strerror(errno));
+            return false;
+        }
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+        {
+            printf("can't attach to tap '%s' %s\n", m_TapName, strerror(errno));
+            close(fd);
+            return false;
+        }
+        int headerSize = sizeof(VirtioNetHeader);
+        ioctl(fd, TUNSETVNETHDRSZ, &headerSize);
+        // Let the kernel hand over frames with the checksum left undone. They come from its
+        // own memory so they are taken as verified.
+        if (ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0)
+        {
+            printf("tap checksum offload not supported %s\n", strerror(errno));
+        }
+        m_TapFd[i] = fd;
+    }
+
+    // A name like "tap%d" is filled in by the kernel
+    strncpy(m_TapName, ifr.ifr_name, sizeof(m_TapName) - 1);
+
+    // Bring the device up and size frames from its MTU through an ordinary socket
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock >= 0)
+    {
+        if (ioctl(sock, SIOCGIFMTU, &ifr) == 0)
+        {
+            m_FrameSize = ifr.ifr_mtu + ETH_HLEN;
+        }
+        if (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0 && (ifr.ifr_flags & IFF_UP) == 0)
+        {
+            ifr.ifr_flags |= IFF_UP;
+            if (ioctl(sock, SIOCSIFFLAGS, &ifr) < 0)
+            {
+                printf("can't bring up tap '%s' %s\n", m_TapName, strerror(errno));
+            }
+        }
+        close(sock);
+    }
+
+    printf("Using tap '%s' with %d queue%s\n", m_TapName, m_TapQueues, m_TapQueues > 1 ? "s" : "");
+    return true;
+}
+
+void PacketIO::ReceiveTap(InterfaceMAC* mac, RxBufferHandler rxBuffer, RxDataHandler rxData)
+{
+    struct pollfd pfd[PACKET_TAP_QUEUE_MAX];
+    VirtioNetHeader header;
+    struct iovec iov[2];
+    uint8_t* data = (rxData != nullptr ? (uint8_t*)malloc(m_FrameSize) : nullptr);
+
+    for (int i = 0; i < m_TapQueues; i++)
+    {
+        pfd[i].fd = m_TapFd[i];
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    while (1)
+    {
+        if (poll(pfd, m_TapQueues, -1) <= 0)
+        {
+            continue;
+        }
+
+        osTime::Batch batch;
+        for (int i = 0; i < m_TapQueues; i++)
+        {
+            if ((pfd[i].revents & POLLIN) == 0)
+            {
+                continue;
+            }
+
+            // Drain the queue, the descriptors are non-blocking
+            while (1)
+            {
+                DataBuffer* buffer = nullptr;
+                if (rxData != nullptr)
+                {
+                    iov[1].iov_base = data;
+                    iov[1].iov_len = m_FrameSize;
+                }
+                else
+                {
+                    // A tap can't be peeked for the length of its next frame, take a buffer
+                    // that holds the largest
+                    buffer = mac->GetRxBuffer(m_FrameSize);
+                    if (buffer == nullptr)
+                    {
+                        // Out of buffers, reading into the header alone drops the frame
+                        m_RxDropCount++;
+                        if (readv(m_TapFd[i], iov, 1) < 0)
+                        {
+                            break;
+                        }
+                        continue;
+                    }
+                    iov[1].iov_base = buffer->Packet;
+                    iov[1].iov_len = buffer->GetSize();
+                }
+
+                ssize_t length = readv(m_TapFd[i], iov, 2) - (ssize_t)sizeof(header);
+                if (length <= 0 || header.gso_type != VIRTIO_NET_HDR_GSO_NONE)
+                {
+                    if (buffer != nullptr)
+                    {
+                        mac->FreeRxBuffer(buffer);
+                    }
+                    if (length < 0 && errno == EAGAIN)
+                    {
+                        break;
+                    }
+                    m_RxDropCount++;
+                    continue;
+                }
+
+                if (rxData != nullptr)
+                {
+                    rxData(data, length);
+                    continue;
+                }
+                buffer->Length = length;
+                uint8_t verified = VIRTIO_NET_HDR_F_NEEDS_CSUM | VIRTIO_NET_HDR_F_DATA_VALID;
+                buffer->ChecksumVerified = (header.flags & verified) != 0;
+                rxBuffer(buffer);
+            }
+        }
+
+        // End of the receive batch
+        FlushTx();
+    }
+}
+
+void PacketIO::TxTap(DataBuffer* buffer)
+{
+    static const int MAX_SEGMENTS = 16;
+    static thread_local int queue = -1;
+    VirtioNetHeader header;
+    struct iovec iov[1 + MAX_SEGMENTS];
+
+    if (queue < 0)
+    {
+        queue = m_TapNextQueue.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    memset(&header, 0, sizeof(header));
+    if (buffer->ChecksumNeeded)
+    {
+        // The field already holds the pseudo header sum, as virtio expects
+        header.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        header.csum_start = buffer->GetChecksumStart();
+        header.csum_offset = buffer->GetChecksumOffset();
+    }
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+
+    int count = GatherSegments(buffer, &iov[1], MAX_SEGMENTS);
+    if (count == 0)
+    {
+        return;
+    }
+    if (writev(m_TapFd[queue % m_TapQueues], iov, count + 1) < 0)
+    {
+        printf("tx error %s\n", strerror(errno));
+    }
+}
+
+void PacketIO::Replay(InterfaceMAC* mac, RxBufferHandler rxBuffer, RxDataHandler rxData)
+{
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t first_ns = 0;
+    uint64_t start_ns;
+    struct timespec cpuStart;
+    struct timespec cpuEnd;
+
+    if (!m_Replay.Open(m_ReplayPath))
+    {
+        return;
+    }
+    // Read into frame first, a buffer is only taken once the length is known so it comes from
+    // the smallest class that holds the frame
+    uint8_t* frame = (uint8_t*)malloc(m_FrameSize);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+    start_ns = osTime::GetTime_ns();
+    while (1)
+    {
+        uint64_t time_ns;
+
+        int length = m_Replay.Next(frame, m_FrameSize, &time_ns);
+        if (length < 0)
+        {
+            break;
+        }
+
+        if (m_ReplayRealtime)
+        {
+            if (frames == 0)
+            {
+                first_ns = time_ns;
+            }
+            uint64_t due_ns = start_ns + (time_ns > first_ns ? time_ns - first_ns : 0);
+            uint64_t now_ns = osTime::GetTime_ns();
+            if (due_ns > now_ns)
+            {
+                // Idle until the frame is due, like the end of a receive batch
+                FlushTx();
+                struct timespec wait;
+                wait.tv_sec = (due_ns - now_ns) / 1000000000ULL;
+                wait.tv_nsec = (due_ns - now_ns) % 1000000000ULL;
+                nanosleep(&wait, nullptr);
+            }
+        }
+        frames++;
+        bytes += length;
+
+        if (length == 0 || (size_t)length > m_FrameSize)
+        {
+            // Also frames coalesced by receive offload when captured, larger than the MTU
+            m_RxDropCount++;
+            continue;
+        }
+        if (rxData != nullptr)
+        {
+            rxData(frame, length);
+            continue;
+        }
+        DataBuffer* buffer = mac->GetRxBuffer(length);
+        if (buffer == nullptr)
+        {
+            m_RxDropCount++;
+            continue;
+        }
+        memcpy(buffer->Packet, frame, length);
+        buffer->Length = length;
+        rxBuffer(buffer);
+    }
+    FlushTx();
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+    double elapsed = (osTime::GetTime_ns() - start_ns) / 1e9;
+    double cpu = (cpuEnd.tv_sec - cpuStart.tv_sec) + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e9;
+    printf("replayed %" PRIu64 " frames, %" PRIu64 " bytes in %.3f s, %.0f frames/s, "
+           "%.3f us CPU per frame, %" PRIu64 " dropped, %" PRIu64 " not Ethernet\n",
+           frames,
+           bytes,
+           elapsed,
+           (elapsed > 0 ? frames / elapsed : 0),
+           (frames > 0 ? cpu * 1e6 / frames : 0),
+           m_RxDropCount,
+           m_Replay.GetSkipCount());
+    m_Replay.Close();
+    free(frame);
+}
+
+bool PacketIO::OpenRing()
+{
+    // Frame size only lays out TPACKET_V1 and V2 rings but the kernel still checks it
+    const uint32_t frameSize = 2048;
+    if (m_BlockSize % getpagesize() != 0 || m_BlockSize < m_FrameSize + TPACKET3_HDRLEN ||
+        m_BlockSize % frameSize != 0 || m_BlockCount == 0)
+    {
+        printf("rx ring block size %u is not a multiple of the page size or is too small\n",
+               m_BlockSize);
+        return false;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(m_RawSocket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        printf("TPACKET_V3 not supported %s\n", strerror(errno));
+        return false;
+    }
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = m_BlockSize;
+    req.tp_block_nr = m_BlockCount;
+    req.tp_frame_size = frameSize;
+    req.tp_frame_nr = (m_BlockSize / frameSize) * m_BlockCount;
+    req.tp_retire_blk_tov = m_BlockTimeout_ms;
+    if (setsockopt(m_RawSocket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        printf("rx ring setup failed %s\n", strerror(errno));
+        return false;
+    }
+
+    void* ring = mmap(nullptr,
+                      (size_t)m_BlockSize * m_BlockCount,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      m_RawSocket,
+                      0);
+    if (ring == MAP_FAILED)
+    {
+        printf("rx ring mmap failed %s\n", strerror(errno));
+        // Release the ring so frames queue on the socket again
+        memset(&req, 0, sizeof(req));
+        setsockopt(m_RawSocket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+        return false;
+    }
+    m_Ring = (uint8_t*)ring;
+
+    printf("rx ring %u blocks of %u bytes, %ums block timeout\n",
+           m_BlockCount,
+           m_BlockSize,
+           m_BlockTimeout_ms);
+    return true;
+}
+
+void PacketIO::ReceiveRing(InterfaceMAC* mac, RxBufferHandler rxBuffer, RxDataHandler rxData)
+{
+    struct pollfd pfd;
+    uint32_t block = 0;
+
+    pfd.fd = m_RawSocket;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    while (1)
+    {
+        tpacket_block_desc* desc = (tpacket_block_desc*)(m_Ring + (size_t)block * m_BlockSize);
+        uint32_t status = __atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE);
+        if ((status & TP_STATUS_USER) == 0)
+        {
+            // Sleep until the kernel retires the block, full or timed out
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (status & TP_STATUS_LOSING)
+        {
+            ReadRingStatistics();
+        }
+
+        // Every frame in the block shares one timestamp
+        osTime::Batch batch;
+        uint32_t count = desc->hdr.bh1.num_pkts;
+        uint8_t* next = (uint8_t*)desc + desc->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            tpacket3_hdr* frame = (tpacket3_hdr*)next;
+            uint8_t* data = next + frame->tp_mac;
+            uint32_t length = frame->tp_snaplen;
+            next += frame->tp_next_offset;
+
+            if (length != frame->tp_len)
+            {
+                // Truncated to fit the block
+                m_RxDropCount++;
+                continue;
+            }
+
+            if (rxData != nullptr)
+            {
+                // Handled in place, the frame stays in the ring until the block is returned
+                rxData(data, length);
+                continue;
+            }
+
+            if (!mac->Classify(data, length))
+            {
+                // Counted by the stack, no buffer or copy spent on it
+                continue;
+            }
+
+            DataBuffer* buffer = mac->GetRxBuffer(length);
+            if (buffer == nullptr || length > buffer->GetSize())
+            {
+                m_RxDropCount++;
+                if (buffer != nullptr)
+                {
+                    mac->FreeRxBuffer(buffer);
+                }
+                continue;
+            }
+            memcpy(buffer->Packet, data, length);
+            buffer->Length = length;
+            buffer->Classified = true;
+            rxBuffer(buffer);
+        }
+
+        // Hand the block back to the kernel and send what the block queued
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        FlushTx();
+        block = (block + 1 == m_BlockCount ? 0 : block + 1);
+    }
+}
+
+void PacketIO::ReadRingStatistics()
+{
+    struct tpacket_stats_v3 stats;
+    socklen_t length = sizeof(stats);
+
+    // Reading the counters clears them
+    if (getsockopt(m_RawSocket, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == 0)
     {
-        struct ifreq ifr;
-        PacketIO::GetInterface(ifr.ifr_name);
-        printf("Using interface '%s'\n", ifr.ifr_name);
+        m_RxKernelDropCount += stats.tp_drops;
+        m_RxDropCount += stats.tp_drops;
+    }
+}
 
-        // Find the socket index for tx later
-        if (ioctl(m_RawSocket, SIOCGIFINDEX, &ifr) == -1)
+void PacketIO::Start(RxDataHandler rxData)
+{
+    if (m_ReplayPath != nullptr)
+    {
+        Replay(nullptr, nullptr, rxData);
+        return;
+    }
+
+    if (m_TapQueues > 0)
+    {
+        if (OpenTap())
         {
-            printf("oh crap %s\n", strerror(errno));
+            ReceiveTap(nullptr, nullptr, rxData);
         }
-        m_IfIndex = ifr.ifr_ifindex;
+        return;
+    }
 
-        // Set socket to promiscuous mode
-        struct packet_mreq mreq;
-        mreq.mr_ifindex = ifr.ifr_ifindex;
-        mreq.mr_type = PACKET_MR_PROMISC;
-        mreq.mr_alen = 6;
-        if (setsockopt(
-                m_RawSocket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, (socklen_t)sizeof(mreq)) < 0)
+    if (Open())
+    {
+        bool ring = (m_RxMode == RX_RING && OpenRing());
+        // Setting up the ring rejoins a fanout group at the end, join once it is done. A socket
+        // left out of the group would receive the frames of every shard.
+        if (!JoinFanout())
         {
-            printf("promiscuous membership error %s", strerror(errno));
+            return;
+        }
+        if (ring)
+        {
+            ReceiveRing(nullptr, nullptr, rxData);
         }
 
-        void* pkt_data = (void*)malloc(ETH_FRAME_LEN);
+        void* pkt_data = (void*)malloc(m_FrameSize);
         while (1)
         {
-            int length = recvfrom(m_RawSocket, pkt_data, ETH_FRAME_LEN, 0, nullptr, nullptr);
+            int length = recv(m_RawSocket, pkt_data, m_FrameSize, MSG_DONTWAIT);
+            if (length < 0 && errno == EAGAIN)
+            {
+                // End of the receive batch, send what it queued before sleeping
+                FlushTx();
+                length = recv(m_RawSocket, pkt_data, m_FrameSize, 0);
+            }
             rxData((uint8_t*)pkt_data, length);
         }
         free(pkt_data); // no way to get here, but ...
     }
 }
 
-void PacketIO::Stop() {}
+void PacketIO::Start(InterfaceMAC* mac, RxBufferHandler rxBuffer)
+{
+    if (m_ReplayPath != nullptr)
+    {
+        Replay(mac, rxBuffer, nullptr);
+        return;
+    }
+
+    if (m_TapQueues > 0)
+    {
+        if (OpenTap())
+        {
+            ReceiveTap(mac, rxBuffer, nullptr);
+        }
+        return;
+    }
+
+    // Frames for other hosts on the segment never reach us
+    SetAddressFilter(mac->GetUnicastAddress());
+
+    if (Open())
+    {
+        bool ring = (m_RxMode == RX_RING && OpenRing());
+        if (!JoinFanout())
+        {
+            return;
+        }
+        if (ring)
+        {
+            ReceiveRing(mac, rxBuffer, nullptr);
+        }
+
+        while (1)
+        {
+            // Frames are no longer than m_FrameSize, so a buffer of the class that holds it
+            // takes any frame in a single recv
+            uint8_t discard[1];
+            DataBuffer* buffer = mac->GetRxBuffer(m_FrameSize);
+            uint8_t* data = (buffer != nullptr ? buffer->Packet : discard);
+            size_t size = (buffer != nullptr ? buffer->GetSize() : sizeof(discard));
+
+            ssize_t length = recv(m_RawSocket, data, size, MSG_TRUNC | MSG_DONTWAIT);
+            if (length < 0 && errno == EAGAIN)
+            {
+                // End of the receive batch, send what it queued before sleeping
+                FlushTx();
+                length = recv(m_RawSocket, data, size, MSG_TRUNC);
+            }
+            if (length <= 0 || buffer == nullptr || (size_t)length > size)
+            {
+                // Out of buffers the frame is read into discard and dropped rather than let
+                // the socket back up
+                if (length > 0)
+                {
+                    m_RxDropCount++;
+                }
+                if (buffer != nullptr)
+                {
+                    mac->FreeRxBuffer(buffer);
+                }
+                continue;
+            }
+            buffer->Length = length;
+            rxBuffer(buffer);
+        }
+    }
+}
+
+uint64_t PacketIO::GetRxDropCount() const
+{
+    return m_RxDropCount;
+}
+
+void PacketIO::Stop()
+{
+    FlushTx();
+    m_TxLock.Take(__FILE__, __LINE__);
+    m_Capture.Close();
+    m_TxLock.Give();
+}
 
 void PacketIO::TxData(void* packet, size_t length)
 {
@@ -435,6 +1331,33 @@ void PacketIO::TxData(void* packet, size_t length)
 
     struct sockaddr_ll dest;
 
+    if (m_Capture.IsOpen())
+    {
+        m_TxLock.Take(__FILE__, __LINE__);
+        m_Capture.Write(CaptureTime_ns(), (const uint8_t*)packet, length);
+        m_TxLock.Give();
+    }
+    if (m_ReplayPath != nullptr)
+    {
+        return;
+    }
+
+    if (m_TapQueues > 0)
+    {
+        VirtioNetHeader header;
+        struct iovec iov[2];
+        memset(&header, 0, sizeof(header));
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = packet;
+        iov[1].iov_len = length;
+        if (writev(m_TapFd[0], iov, 2) < 0)
+        {
+            printf("tx error %s\n", strerror(errno));
+        }
+        return;
+    }
+
     memset(&dest, 0, sizeof(dest));
     dest.sll_family = AF_PACKET;
     dest.sll_ifindex = m_IfIndex;
@@ -446,4 +1369,149 @@ void PacketIO::TxData(void* packet, size_t length)
     }
 }
 
+void PacketIO::TxData(DataBuffer* buffer)
+{
+    static const int MAX_SEGMENTS = 16;
+    struct sockaddr_ll dest;
+    struct iovec iov[MAX_SEGMENTS];
+    struct msghdr msg;
+    int count;
+
+    if (m_Capture.IsOpen())
+    {
+        m_TxLock.Take(__FILE__, __LINE__);
+        m_Capture.Write(CaptureTime_ns(), buffer);
+        m_TxLock.Give();
+    }
+    if (m_ReplayPath != nullptr)
+    {
+        return;
+    }
+
+    if (m_TapQueues > 0)
+    {
+        TxTap(buffer);
+        return;
+    }
+
+    if (m_TxThreshold > 1)
+    {
+        // The MAC frees its reference when this returns, the queue keeps its own
+        buffer->AddRef();
+        m_TxLock.Take(__FILE__, __LINE__);
+        m_TxQueue[m_TxCount++] = buffer;
+        bool first = (m_TxCount == 1);
+        if (m_TxCount >= m_TxThreshold)
+        {
+            SendQueued();
+        }
+        m_TxLock.Give();
+        if (first && m_TxTimers != nullptr)
+        {
+            m_TxTimers->Start(&m_TxTimer, 0);
+        }
+        return;
+    }
+
+    count = GatherSegments(buffer, iov, MAX_SEGMENTS);
+    if (count == 0)
+    {
+        return;
+    }
+
+    memset(&dest, 0, sizeof(dest));
+    dest.sll_family = AF_PACKET;
+    dest.sll_ifindex = m_IfIndex;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &dest;
+    msg.msg_namelen = sizeof(dest);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    int rc = sendmsg(m_RawSocket, &msg, 0);
+    if (rc < 0)
+    {
+        printf("tx error %s\n", strerror(errno));
+    }
+}
+
+void PacketIO::SetTxBatch(int threshold, osTimerWheel* timers)
+{
+    FlushTx();
+    m_TxThreshold = (threshold < 1 ? 1 : threshold > PACKET_TX_BATCH_MAX ? PACKET_TX_BATCH_MAX
+                                                                          : threshold);
+    m_TxTimers = timers;
+}
+
+void PacketIO::FlushTx()
+{
+    m_TxLock.Take(__FILE__, __LINE__);
+    SendQueued();
+    m_TxLock.Give();
+}
+
+void PacketIO::TxTimeout(void* param)
+{
+    PacketIO* io = (PacketIO*)param;
+    io->FlushTx();
+}
+
+// Called with m_TxLock held
+void PacketIO::SendQueued()
+{
+    static const int MAX_SEGMENTS = 16;
+    struct sockaddr_ll dest;
+    struct iovec iov[PACKET_TX_BATCH_MAX][MAX_SEGMENTS];
+    struct mmsghdr msgs[PACKET_TX_BATCH_MAX];
+    int count = 0;
+
+    if (m_TxCount == 0)
+    {
+        return;
+    }
+
+    memset(&dest, 0, sizeof(dest));
+    dest.sll_family = AF_PACKET;
+    dest.sll_ifindex = m_IfIndex;
+
+    memset(msgs, 0, sizeof(msgs[0]) * m_TxCount);
+    for (int i = 0; i < m_TxCount; i++)
+    {
+        int segments = GatherSegments(m_TxQueue[i], iov[count], MAX_SEGMENTS);
+        if (segments > 0)
+        {
+            msgs[count].msg_hdr.msg_name = &dest;
+            msgs[count].msg_hdr.msg_namelen = sizeof(dest);
+            msgs[count].msg_hdr.msg_iov = iov[count];
+            msgs[count].msg_hdr.msg_iovlen = segments;
+            count++;
+        }
+    }
+
+    int sent = 0;
+    while (sent < count)
+    {
+        int rc = sendmmsg(m_RawSocket, &msgs[sent], count - sent, 0);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printf("tx error %s, %d frames dropped\n", strerror(errno), count - sent);
+            break;
+        }
+        sent += rc;
+    }
+
+    // The socket has copied the frames
+    for (int i = 0; i < m_TxCount; i++)
+    {
+        m_TxQueue[i]->MAC->FreeTxBuffer(m_TxQueue[i]);
+        m_TxQueue[i] = nullptr;
+    }
+    m_TxCount = 0;
+}
+
 #endif
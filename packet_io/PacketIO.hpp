@@ -34,8 +34,31 @@
 #ifdef _WIN32
 #include <pcap.h>
 #endif
+#include <atomic>
 #include <inttypes.h>
+#include "PcapFile.hpp"
+#include "osMutex.hpp"
 #include "osThread.hpp"
+#include "osTimerWheel.hpp"
+
+class DataBuffer;
+class InterfaceMAC;
+
+#ifdef __linux__
+// Default PACKET_MMAP receive ring, 16 blocks of 256KB
+#define PACKET_RING_BLOCK_SIZE (1 << 18)
+#define PACKET_RING_BLOCK_COUNT (16)
+#define PACKET_RING_BLOCK_TIMEOUT_MS (2)
+
+// Most frames one sendmmsg sends in batched transmit
+#define PACKET_TX_BATCH_MAX (64)
+
+// Most queues of a multiqueue TAP device
+#define PACKET_TAP_QUEUE_MAX (8)
+
+// Most PACKET_FANOUT groups one process can join
+#define PACKET_FANOUT_GROUP_MAX (8)
+#endif
 
 class PacketIO
 {
@@ -44,14 +67,90 @@ public:
     PacketIO(const char* name);
 
     typedef void (*RxDataHandler)(uint8_t* data, size_t length);
+    typedef void (*RxBufferHandler)(DataBuffer* buffer);
 #ifdef _WIN32
     void Start(pcap_handler handler);
 #elif __linux__
     void Start(RxDataHandler);
+    /// @brief Receive each frame straight into a buffer borrowed from the MAC's receive pool
+    /// and pass it to rxBuffer, which takes over the buffer. Frames are dropped while the pool
+    /// is empty.
+    void Start(InterfaceMAC* mac, RxBufferHandler rxBuffer);
+    uint64_t GetRxDropCount() const;
     void Entry(void* param);
+
+    enum RxMode
+    {
+        RX_SOCKET, // One recv per frame
+        RX_RING    // TPACKET_V3 ring shared with the kernel, frames are handled a block at a time
+    };
+    /// @brief Select how Start receives frames, falls back to RX_SOCKET if the ring can't be
+    /// set up. Call before Start.
+    void SetRxMode(RxMode mode) { m_RxMode = mode; }
+    /// @param blockSize A multiple of the page size, large enough for the biggest frame
+    void SetRingSize(uint32_t blockSize, uint32_t blockCount);
+    /// @brief The kernel hands over a block when it is full or this long after its first frame
+    void SetBlockTimeout(uint32_t ms) { m_BlockTimeout_ms = ms; }
+    /// @return Frames the kernel dropped because the ring was full, included in GetRxDropCount
+    uint64_t GetRxKernelDropCount() const { return m_RxKernelDropCount; }
+
+    /// @brief Queue the frames given to TxData(DataBuffer*) and send them with one sendmmsg
+    /// when threshold frames are queued, on FlushTx, after each receive batch or at the next
+    /// tick of timers, whichever is first. A threshold of 1 sends every frame as it comes.
+    /// @param timers Optional, flushes frames sent outside of a burst the stack flushes
+    void SetTxBatch(int threshold, osTimerWheel* timers);
+    /// @brief Send every queued frame, register as the stack's transmit flush handler
+    void FlushTx();
+
+    /// @brief Exchange frames with the kernel's own stack through a TAP device instead of a
+    /// raw socket on a NIC. Every frame carries a virtio_net_hdr so checksums can be left to
+    /// the other side. TAP frames are written as they are sent, SetTxBatch does not apply.
+    /// Call before Start.
+    /// @param queues More than one opens an IFF_MULTI_QUEUE device, Start receives from every
+    /// queue and each sending thread is given a queue of its own
+    void SetTap(const char* name, int queues = 1);
+    /// @return The checksum offloads of the backend, for DefaultStack::SetChecksumOffload
+    uint32_t GetChecksumOffload() const;
+
+    /// @brief Replay the frames of a pcap or pcapng file instead of receiving from a device.
+    /// No socket is opened so no privileges are needed. Start returns when the file ends and
+    /// prints the frame rate and the CPU time spent per frame. Frames sent while replaying are
+    /// discarded unless SetCapture records them. Call before Start.
+    /// @param realtime Keep the gaps between frames as recorded, otherwise replay as fast as
+    /// the stack takes them
+    void SetReplay(const char* path, bool realtime);
+    /// @brief Record every frame sent from now on in a pcap file, with any backend. Stop
+    /// closes the file.
+    bool SetCapture(const char* path);
+
+    /// @brief Have the kernel drop every frame not addressed to address or broadcast before it
+    /// is copied to us, with a classic BPF program on the raw socket. Start(mac, ...) filters on
+    /// the MAC's address, call this again when the address changes.
+    /// @param address nullptr removes the filter
+    bool SetAddressFilter(const uint8_t* address);
+    /// @brief Attach the filter SetAddressFilter uses to any socket that takes SO_ATTACH_FILTER
+    static bool AttachAddressFilter(int fd, const uint8_t* address);
+
+    /// @brief Share the interface with the PacketIOs of the other shards of a StackShards,
+    /// each receiving on its own thread, through a PACKET_FANOUT group. IPv4 TCP frames go to
+    /// the shard StackShards::Hash picks for their addresses and ports, every other frame to
+    /// shard 0. Start joins the group in shard order, waiting for the shards below it, so the
+    /// kernel's index for each socket is its shard. Shard 0 joining starts the order over.
+    /// Start returns without receiving if the socket can't join with the program attached.
+    /// Call before Start.
+    /// @param group Fanout group id, the same for every shard
+    void SetFanout(uint16_t group, int shard, int shardCount);
+    /// @brief Steer the frames of a fanout group with the StackShards::Hash program
+    static bool AttachFanoutProgram(int fd);
+    /// @brief Check the kernel takes the fanout program, on a throwaway socket and group.
+    /// Without it frames can't be steered to their shards, run a single shard instead.
+    static bool FanoutProgramAvailable();
 #endif
     void Stop();
     void TxData(void* data, size_t length);
+    /// @brief Send a frame that may be chained across several DataBuffers, without first
+    /// copying it into one contiguous frame where the platform allows.
+    void TxData(DataBuffer* buffer);
     static void GetDevice(int interfaceNumber, char* buffer, size_t buffer_size);
     static int GetMACAddress(const char* adapter, uint8_t* mac);
     static void DisplayDevices();
@@ -65,5 +164,54 @@ private:
     osThread EthernetRxThread;
     int m_RawSocket;
     int m_IfIndex;
+    size_t m_FrameSize;
+    uint64_t m_RxDropCount;
+
+    RxMode m_RxMode;
+    uint32_t m_BlockSize;
+    uint32_t m_BlockCount;
+    uint32_t m_BlockTimeout_ms;
+    uint8_t* m_Ring;
+    uint64_t m_RxKernelDropCount;
+
+    // Frames queued for batched transmit, each holding a reference
+    osMutex m_TxLock;
+    DataBuffer* m_TxQueue[PACKET_TX_BATCH_MAX];
+    int m_TxCount;
+    int m_TxThreshold;
+    osTimerWheel* m_TxTimers;
+    osTimer m_TxTimer;
+
+    // TAP backend, used in place of the raw socket when m_TapQueues is not 0
+    char m_TapName[16];
+    int m_TapQueues;
+    int m_TapFd[PACKET_TAP_QUEUE_MAX];
+    std::atomic<int> m_TapNextQueue;
+
+    // Replay and capture, m_Capture is written with m_TxLock held
+    const char* m_ReplayPath;
+    bool m_ReplayRealtime;
+    PcapReader m_Replay;
+    PcapWriter m_Capture;
+
+    uint8_t m_FilterAddress[6];
+    bool m_Filtered;
+
+    // PACKET_FANOUT group, joined when m_FanoutCount is not 0
+    uint16_t m_FanoutGroup;
+    int m_FanoutShard;
+    int m_FanoutCount;
+
+    bool Open();
+    bool JoinFanout();
+    bool OpenTap();
+    void ReceiveTap(InterfaceMAC* mac, RxBufferHandler rxBuffer, RxDataHandler rxData);
+    void TxTap(DataBuffer* buffer);
+    void Replay(InterfaceMAC* mac, RxBufferHandler rxBuffer, RxDataHandler rxData);
+    bool OpenRing();
+    void SendQueued();
+    static void TxTimeout(void* param);
+    void ReceiveRing(InterfaceMAC* mac, RxBufferHandler rxBuffer, RxDataHandler rxData);
+    void ReadRingStatistics();
 #endif
 };
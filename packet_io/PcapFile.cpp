@@ -0,0 +1,502 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#include <cstring>
+
+#include "DataBuffer.hpp"
+#include "PcapFile.hpp"
+
+// Classic pcap magic numbers as read in the byte order of the file's writer
+static const uint32_t PCAP_MAGIC_US = 0xA1B2C3D4;
+static const uint32_t PCAP_MAGIC_NS = 0xA1B23C4D;
+static const uint32_t PCAP_MAGIC_US_SWAPPED = 0xD4C3B2A1;
+static const uint32_t PCAP_MAGIC_NS_SWAPPED = 0x4D3CB2A1;
+
+// pcapng block types
+static const uint32_t PCAPNG_SECTION_HEADER = 0x0A0D0D0A;
+static const uint32_t PCAPNG_INTERFACE_DESCRIPTION = 1;
+static const uint32_t PCAPNG_SIMPLE_PACKET = 3;
+static const uint32_t PCAPNG_ENHANCED_PACKET = 6;
+static const uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+static const uint16_t PCAPNG_OPTION_END = 0;
+static const uint16_t PCAPNG_OPTION_TSRESOL = 9;
+static const uint8_t PCAPNG_DEFAULT_TSRESOL = 6; // Microseconds
+
+// Larger captured lengths mean the file is corrupt
+static const uint32_t PCAP_FRAME_MAX = 256 * 1024;
+
+static const uint32_t PCAP_SNAPLEN = 65535;
+
+static uint32_t Swap32(uint32_t value)
+{
+    return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+}
+
+static uint32_t Native32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+//============================================================================
+// PcapReader
+//============================================================================
+
+PcapReader::PcapReader()
+    : File(nullptr)
+    , Ng(false)
+    , Swap(false)
+    , LinkType(0)
+    , TimeScale(1000)
+    , LastTime_ns(0)
+    , SkipCount(0)
+    , InterfaceCount(0)
+    , InterfaceLinkType()
+    , InterfaceResolution()
+{
+}
+
+PcapReader::~PcapReader()
+{
+    Close();
+}
+
+bool PcapReader::Open(const char* path)
+{
+    Close();
+    File = fopen(path, "rb");
+    if (File == nullptr)
+    {
+        printf("failed to open pcap file '%s'\n", path);
+        return false;
+    }
+    LastTime_ns = 0;
+    SkipCount = 0;
+    if (!ReadHeader())
+    {
+        printf("'%s' is not a pcap or pcapng file\n", path);
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void PcapReader::Close()
+{
+    if (File != nullptr)
+    {
+        fclose(File);
+        File = nullptr;
+    }
+}
+
+uint16_t PcapReader::Read16(const uint8_t* p) const
+{
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return (Swap ? (uint16_t)((value >> 8) | (value << 8)) : value);
+}
+
+uint32_t PcapReader::Read32(const uint8_t* p) const
+{
+    uint32_t value = Native32(p);
+    return (Swap ? Swap32(value) : value);
+}
+
+bool PcapReader::ReadHeader()
+{
+    uint8_t header[24];
+
+    if (fread(header, 1, 4, File) != 4)
+    {
+        return false;
+    }
+
+    uint32_t magic = Native32(header);
+    if (magic == PCAPNG_SECTION_HEADER)
+    {
+        Ng = true;
+        return (fread(&header[4], 1, 8, File) == 8 && ReadSectionHeader(header));
+    }
+
+    Ng = false;
+    switch (magic)
+    {
+    case PCAP_MAGIC_US:
+    case PCAP_MAGIC_US_SWAPPED:
+        TimeScale = 1000;
+        break;
+    case PCAP_MAGIC_NS:
+    case PCAP_MAGIC_NS_SWAPPED:
+        TimeScale = 1;
+        break;
+    default:
+        return false;
+    }
+    Swap = (magic == PCAP_MAGIC_US_SWAPPED || magic == PCAP_MAGIC_NS_SWAPPED);
+    if (fread(&header[4], 1, 20, File) != 20)
+    {
+        return false;
+    }
+    // The upper bits of the link type field carry FCS information
+    LinkType = Read32(&header[20]) & 0xFFFF;
+    return true;
+}
+
+// header holds the block type, total length and byte order magic, the rest of the block is
+// still to be read
+bool PcapReader::ReadSectionHeader(const uint8_t* header)
+{
+    uint32_t order = Native32(&header[8]);
+    if (order == PCAPNG_BYTE_ORDER_MAGIC)
+    {
+        Swap = false;
+    }
+    else if (order == Swap32(PCAPNG_BYTE_ORDER_MAGIC))
+    {
+        Swap = true;
+    }
+    else
+    {
+        return false;
+    }
+
+    // Interface ids start over in each section
+    InterfaceCount = 0;
+
+    uint32_t length = Read32(&header[4]);
+    return (length >= 28 && length % 4 == 0 && fseek(File, length - 12, SEEK_CUR) == 0);
+}
+
+bool PcapReader::ReadInterface(uint32_t bodyLength)
+{
+    uint8_t body[512];
+
+    if (bodyLength < 8)
+    {
+        return false;
+    }
+    uint32_t length = (bodyLength < sizeof(body) ? bodyLength : sizeof(body));
+    if (fread(body, 1, length, File) != length ||
+        fseek(File, bodyLength - length + 4, SEEK_CUR) != 0)
+    {
+        return false;
+    }
+
+    uint8_t resolution = PCAPNG_DEFAULT_TSRESOL;
+    uint32_t offset = 8;
+    while (offset + 4 <= length)
+    {
+        uint16_t code = Read16(&body[offset]);
+        uint16_t size = Read16(&body[offset + 2]);
+        if (code == PCAPNG_OPTION_END)
+        {
+            break;
+        }
+        if (code == PCAPNG_OPTION_TSRESOL && size == 1 && offset + 4 < length)
+        {
+            resolution = body[offset + 4];
+        }
+        offset += 4 + ((size + 3) & ~3);
+    }
+
+    if (InterfaceCount < PCAP_INTERFACE_MAX)
+    {
+        InterfaceLinkType[InterfaceCount] = Read16(&body[0]);
+        InterfaceResolution[InterfaceCount] = resolution;
+    }
+    InterfaceCount++;
+    return true;
+}
+
+uint64_t PcapReader::ToNanoseconds(uint64_t timestamp, uint8_t resolution)
+{
+    uint8_t exponent = resolution & 0x7F;
+
+    if ((resolution & 0x80) != 0)
+    {
+        // Units of 2^-exponent seconds
+        if (exponent >= 64)
+        {
+            return 0;
+        }
+        uint64_t fraction = timestamp & ((1ULL << exponent) - 1);
+        return (timestamp >> exponent) * 1000000000ULL +
+               (uint64_t)(fraction * 1e9 / (double)(1ULL << exponent));
+    }
+
+    // Units of 10^-exponent seconds
+    uint64_t scale = 1;
+    if (exponent <= 9)
+    {
+        for (int i = exponent; i < 9; i++)
+        {
+            scale *= 10;
+        }
+        return timestamp * scale;
+    }
+    for (int i = 9; i < exponent && i < 29; i++)
+    {
+        scale *= 10;
+    }
+    return timestamp / scale;
+}
+
+int PcapReader::Next(uint8_t* frame, uint32_t size, uint64_t* time_ns)
+{
+    if (File == nullptr)
+    {
+        return -1;
+    }
+    return (Ng ? NextNg(frame, size, time_ns) : NextClassic(frame, size, time_ns));
+}
+
+int PcapReader::NextClassic(uint8_t* frame, uint32_t size, uint64_t* time_ns)
+{
+    uint8_t header[16];
+
+    while (fread(header, 1, sizeof(header), File) == sizeof(header))
+    {
+        uint32_t captured = Read32(&header[8]);
+        if (captured > PCAP_FRAME_MAX)
+        {
+            return -1;
+        }
+        if (LinkType != PCAP_LINKTYPE_ETHERNET)
+        {
+            SkipCount++;
+            if (fseek(File, captured, SEEK_CUR) != 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        LastTime_ns = Read32(&header[0]) * 1000000000ULL + Read32(&header[4]) * TimeScale;
+        *time_ns = LastTime_ns;
+        return ReadFrame(frame, size, captured, 0);
+    }
+    return -1;
+}
+
+int PcapReader::NextNg(uint8_t* frame, uint32_t size, uint64_t* time_ns)
+{
+    uint8_t header[28];
+
+    while (fread(header, 1, 8, File) == 8)
+    {
+        uint32_t type = Read32(&header[0]);
+        if (type == PCAPNG_SECTION_HEADER)
+        {
+            if (fread(&header[8], 1, 4, File) != 4 || !ReadSectionHeader(header))
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        uint32_t length = Read32(&header[4]);
+        if (length < 12 || length % 4 != 0)
+        {
+            return -1;
+        }
+        // Everything after the type and length, up to but not including the trailing length
+        uint32_t body = length - 12;
+
+        if (type == PCAPNG_INTERFACE_DESCRIPTION)
+        {
+            if (!ReadInterface(body))
+            {
+                return -1;
+            }
+        }
+        else if (type == PCAPNG_ENHANCED_PACKET)
+        {
+            if (body < 20 || fread(&header[8], 1, 20, File) != 20)
+            {
+                return -1;
+            }
+            uint32_t interface = Read32(&header[8]);
+            uint32_t captured = Read32(&header[20]);
+            if (captured > body - 20 || captured > PCAP_FRAME_MAX)
+            {
+                return -1;
+            }
+            if (interface >= (uint32_t)InterfaceCount || interface >= PCAP_INTERFACE_MAX ||
+                InterfaceLinkType[interface] != PCAP_LINKTYPE_ETHERNET)
+            {
+                SkipCount++;
+                if (fseek(File, body - 20 + 4, SEEK_CUR) != 0)
+                {
+                    return -1;
+                }
+                continue;
+            }
+            uint64_t timestamp = ((uint64_t)Read32(&header[12]) << 32) | Read32(&header[16]);
+            LastTime_ns = ToNanoseconds(timestamp, InterfaceResolution[interface]);
+            *time_ns = LastTime_ns;
+            // Padding, options and the trailing length follow the frame
+            return ReadFrame(frame, size, captured, body - 20 - captured + 4);
+        }
+        else if (type == PCAPNG_SIMPLE_PACKET)
+        {
+            if (body < 4 || fread(&header[8], 1, 4, File) != 4)
+            {
+                return -1;
+            }
+            uint32_t original = Read32(&header[8]);
+            uint32_t captured = (original < body - 4 ? original : body - 4);
+            if (InterfaceCount == 0 || InterfaceLinkType[0] != PCAP_LINKTYPE_ETHERNET)
+            {
+                SkipCount++;
+                if (fseek(File, body - 4 + 4, SEEK_CUR) != 0)
+                {
+                    return -1;
+                }
+                continue;
+            }
+            *time_ns = LastTime_ns;
+            return ReadFrame(frame, size, captured, body - 4 - captured + 4);
+        }
+        else if (fseek(File, body + 4, SEEK_CUR) != 0)
+        {
+            // Statistics, name resolution and the like
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Copies what fits of a frame of captured bytes, then skips the rest of it and the remaining
+// bytes of its record
+int PcapReader::ReadFrame(uint8_t* frame, uint32_t size, uint32_t captured, uint32_t remaining)
+{
+    uint32_t copy = (captured < size ? captured : size);
+    if (fread(frame, 1, copy, File) != copy)
+    {
+        return -1;
+    }
+    if (captured - copy + remaining > 0 && fseek(File, captured - copy + remaining, SEEK_CUR) != 0)
+    {
+        return -1;
+    }
+    return captured;
+}
+
+//============================================================================
+// PcapWriter
+//============================================================================
+
+PcapWriter::PcapWriter()
+    : File(nullptr)
+    , FrameCount(0)
+{
+}
+
+PcapWriter::~PcapWriter()
+{
+    Close();
+}
+
+bool PcapWriter::Open(const char* path)
+{
+    uint32_t header[6];
+    uint16_t* version = (uint16_t*)&header[1];
+
+    Close();
+    File = fopen(path, "wb");
+    if (File == nullptr)
+    {
+        printf("failed to create pcap file '%s'\n", path);
+        return false;
+    }
+
+    // Written in host byte order, readers tell from the magic number
+    header[0] = PCAP_MAGIC_NS;
+    version[0] = 2;
+    version[1] = 4;
+    header[2] = 0; // thiszone
+    header[3] = 0; // sigfigs
+    header[4] = PCAP_SNAPLEN;
+    header[5] = PCAP_LINKTYPE_ETHERNET;
+    fwrite(header, sizeof(header), 1, File);
+    FrameCount = 0;
+    return true;
+}
+
+void PcapWriter::Close()
+{
+    if (File != nullptr)
+    {
+        fclose(File);
+        File = nullptr;
+    }
+}
+
+void PcapWriter::WriteRecordHeader(uint64_t time_ns, uint32_t length)
+{
+    uint32_t header[4];
+    header[0] = (uint32_t)(time_ns / 1000000000ULL);
+    header[1] = (uint32_t)(time_ns % 1000000000ULL);
+    header[2] = (length < PCAP_SNAPLEN ? length : PCAP_SNAPLEN);
+    header[3] = length;
+    fwrite(header, sizeof(header), 1, File);
+    FrameCount++;
+}
+
+void PcapWriter::Write(uint64_t time_ns, const uint8_t* data, uint32_t length)
+{
+    if (File == nullptr)
+    {
+        return;
+    }
+    WriteRecordHeader(time_ns, length);
+    fwrite(data, 1, (length < PCAP_SNAPLEN ? length : PCAP_SNAPLEN), File);
+}
+
+void PcapWriter::Write(uint64_t time_ns, DataBuffer* buffer)
+{
+    if (File == nullptr)
+    {
+        return;
+    }
+    uint32_t remaining = buffer->ChainLength();
+    WriteRecordHeader(time_ns, remaining);
+    remaining = (remaining < PCAP_SNAPLEN ? remaining : PCAP_SNAPLEN);
+    for (DataBuffer* segment = buffer; segment != nullptr && remaining > 0;
+         segment = segment->Next)
+    {
+        uint32_t length = (segment->Length < remaining ? segment->Length : remaining);
+        fwrite(segment->Packet, 1, length, File);
+        remaining -= length;
+    }
+}
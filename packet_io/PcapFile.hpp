@@ -0,0 +1,119 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+
+class DataBuffer;
+
+// Link type of the frames PcapReader delivers and PcapWriter records
+#define PCAP_LINKTYPE_ETHERNET (1)
+
+// Most interfaces a pcapng file can describe before their frames are skipped
+#define PCAP_INTERFACE_MAX (8)
+
+/// Reads the Ethernet frames of a classic pcap (microsecond or nanosecond, either byte order)
+/// or a pcapng file in order. Frames of other link types are skipped.
+class PcapReader
+{
+public:
+    PcapReader();
+    ~PcapReader();
+
+    bool Open(const char* path);
+    void Close();
+
+    /// @brief Copy the next frame into frame
+    /// @param time_ns Set to the capture time of the frame, in ns since the epoch. A pcapng
+    /// simple packet block has no time and repeats the time of the frame before it.
+    /// @return The captured length of the frame, larger than size if only size bytes were
+    /// copied, -1 at the end of the file or on a malformed file
+    int Next(uint8_t* frame, uint32_t size, uint64_t* time_ns);
+
+    /// @return Frames skipped because they were not Ethernet
+    uint64_t GetSkipCount() const { return SkipCount; }
+
+private:
+    FILE* File;
+    bool Ng;
+    bool Swap;
+    uint32_t LinkType;
+    uint64_t TimeScale; // Classic pcap, ns per unit of the fraction of a second
+    uint64_t LastTime_ns;
+    uint64_t SkipCount;
+
+    // pcapng interfaces of the current section
+    int InterfaceCount;
+    uint16_t InterfaceLinkType[PCAP_INTERFACE_MAX];
+    uint8_t InterfaceResolution[PCAP_INTERFACE_MAX];
+
+    uint16_t Read16(const uint8_t* p) const;
+    uint32_t Read32(const uint8_t* p) const;
+    bool ReadHeader();
+    int NextClassic(uint8_t* frame, uint32_t size, uint64_t* time_ns);
+    int NextNg(uint8_t* frame, uint32_t size, uint64_t* time_ns);
+    bool ReadSectionHeader(const uint8_t* header);
+    bool ReadInterface(uint32_t bodyLength);
+    int ReadFrame(uint8_t* frame, uint32_t size, uint32_t captured, uint32_t remaining);
+    static uint64_t ToNanoseconds(uint64_t timestamp, uint8_t resolution);
+
+    PcapReader(PcapReader&);
+};
+
+/// Records Ethernet frames in a classic pcap file with nanosecond timestamps.
+/// Not thread safe, callers sending from more than one thread hold their own lock.
+class PcapWriter
+{
+public:
+    PcapWriter();
+    ~PcapWriter();
+
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return File != nullptr; }
+
+    void Write(uint64_t time_ns, const uint8_t* data, uint32_t length);
+    /// @brief Record a frame chained across several DataBuffers as one frame
+    void Write(uint64_t time_ns, DataBuffer* buffer);
+
+    uint64_t GetFrameCount() const { return FrameCount; }
+
+private:
+    FILE* File;
+    uint64_t FrameCount;
+
+    void WriteRecordHeader(uint64_t time_ns, uint32_t length);
+
+    PcapWriter(PcapWriter&);
+};
@@ -36,10 +36,31 @@
 
 #define TCP_MAX_CONNECTIONS (5)
 #define TCP_RX_WINDOW_SIZE (256)
+#define POLLER_MAX_CONNECTIONS (TCP_MAX_CONNECTIONS)
 
-#define TX_BUFFER_COUNT (20)
-#define RX_BUFFER_COUNT (20)
+// DataBuffer size classes, a frame is given a buffer from the smallest class it fits in
+#define DATA_BUFFER_SMALL_SIZE (128)
+#define DATA_BUFFER_MTU_SIZE (2048)
+#define DATA_BUFFER_JUMBO_SIZE (9216)
 
-#define DATA_BUFFER_PAYLOAD_SIZE (512)
+#define TX_SMALL_BUFFER_COUNT (20)
+#define TX_MTU_BUFFER_COUNT (20)
+#define TX_JUMBO_BUFFER_COUNT (2)
+#define RX_SMALL_BUFFER_COUNT (20)
+#define RX_MTU_BUFFER_COUNT (20)
+#define RX_JUMBO_BUFFER_COUNT (2)
+
+#define TX_BUFFER_COUNT (TX_SMALL_BUFFER_COUNT + TX_MTU_BUFFER_COUNT + TX_JUMBO_BUFFER_COUNT)
+#define RX_BUFFER_COUNT (RX_SMALL_BUFFER_COUNT + RX_MTU_BUFFER_COUNT + RX_JUMBO_BUFFER_COUNT)
+
+// Largest TCP payload sent in one segment. This is the default MSS of RFC 879 since the
+// peer's MSS option is not parsed.
+#define TCP_MAX_SEGMENT_SIZE (536)
 
 const uint8_t ARPCacheSize = 5;
+
+// An ARP cache entry is flushed this long after it was last refreshed
+#define ARP_ENTRY_TIMEOUT_US (300000000)
+
+// Resolution of the stack's timer wheel
+#define TIMER_TICK_US (1000)
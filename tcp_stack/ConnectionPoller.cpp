@@ -0,0 +1,226 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#include <chrono>
+#include <stdio.h>
+
+#include "ConnectionPoller.hpp"
+#include "TCPConnection.hpp"
+
+ConnectionPoller::ConnectionPoller(const char* name)
+    : Name(name)
+    , Count(0)
+    , WakeRequested(false)
+    , Event(name)
+    , Lock(name)
+    , ReadyList()
+{
+}
+
+bool ConnectionPoller::Add(TCPConnection* connection, uint8_t interest, void* context)
+{
+    ConnectionPoller* expected = nullptr;
+    if (Count.fetch_add(1) >= POLLER_MAX_CONNECTIONS)
+    {
+        Count.fetch_sub(1);
+        printf("ConnectionPoller %s is full\n", Name);
+        return false;
+    }
+    Lock.Take(__FILE__, __LINE__);
+    if (!connection->Poller.compare_exchange_strong(expected, this))
+    {
+        Lock.Give();
+        Count.fetch_sub(1);
+        return false;
+    }
+    connection->PollInterest = interest;
+    connection->PollContext = context;
+
+    // Report it if it is already ready
+    QueueLocked(connection);
+    Lock.Give();
+    Event.Notify();
+    return true;
+}
+
+void ConnectionPoller::Modify(TCPConnection* connection, uint8_t interest)
+{
+    Lock.Take(__FILE__, __LINE__);
+    if (connection->Poller.load() == this)
+    {
+        connection->PollInterest = interest;
+        QueueLocked(connection);
+    }
+    Lock.Give();
+    Event.Notify();
+}
+
+void ConnectionPoller::Remove(TCPConnection* connection)
+{
+    ConnectionPoller* expected = this;
+    Lock.Take(__FILE__, __LINE__);
+    if (connection->Poller.compare_exchange_strong(expected, nullptr))
+    {
+        Count.fetch_sub(1);
+        if (connection->PollQueued)
+        {
+            // Taken off the ready list so the next poller it joins can queue it, and so the
+            // list never holds more than the registered connections
+            size_t queued = ReadyList.GetCount();
+            TCPConnection* other;
+            for (size_t i = 0; i < queued && ReadyList.Get(other); i++)
+            {
+                if (other != connection)
+                {
+                    ReadyList.Put(other);
+                }
+            }
+            connection->PollQueued = false;
+        }
+    }
+    Lock.Give();
+}
+
+void ConnectionPoller::Queue(TCPConnection* connection)
+{
+    Lock.Take(__FILE__, __LINE__);
+    QueueLocked(connection);
+    Lock.Give();
+    Event.Notify();
+}
+
+void ConnectionPoller::QueueLocked(TCPConnection* connection)
+{
+    // The stack may still signal through a poller the connection has just left
+    if (connection->Poller.load() != this || connection->PollQueued)
+    {
+        return;
+    }
+    if (ReadyList.Put(connection))
+    {
+        connection->PollQueued = true;
+    }
+    else
+    {
+        printf("ConnectionPoller %s ready list full\n", Name);
+    }
+}
+
+void ConnectionPoller::Wake()
+{
+    WakeRequested.store(true);
+    Event.Notify();
+}
+
+uint8_t ConnectionPoller::GetEvents(const TCPConnection* connection)
+{
+    uint8_t events = 0;
+
+    if (!connection->RxBufferEmpty)
+    {
+        events |= POLL_READ;
+    }
+    if (connection->NewConnection != nullptr)
+    {
+        events |= POLL_ACCEPT;
+    }
+    switch (connection->State)
+    {
+    case TCPConnection::ESTABLISHED:
+        if ((int32_t)(connection->MaxSequenceTx - connection->SequenceNumber) > 0)
+        {
+            events |= POLL_WRITE;
+        }
+        break;
+    case TCPConnection::CLOSE_WAIT:
+        if ((int32_t)(connection->MaxSequenceTx - connection->SequenceNumber) > 0)
+        {
+            events |= POLL_WRITE;
+        }
+        events |= POLL_CLOSE;
+        break;
+    case TCPConnection::CLOSED:
+    case TCPConnection::CLOSING:
+    case TCPConnection::LAST_ACK:
+    case TCPConnection::TIMED_WAIT: events |= POLL_CLOSE; break;
+    default: break;
+    }
+
+    return events;
+}
+
+int ConnectionPoller::Wait(Ready* ready, int max, int msTimeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msTimeout);
+    int count = 0;
+
+    while (true)
+    {
+        // Only look at what was queued before this pass, ready connections are queued again
+        // for the next Wait
+        Lock.Take(__FILE__, __LINE__);
+        size_t queued = ReadyList.GetCount();
+        TCPConnection* connection;
+        for (size_t i = 0; i < queued && count < max && ReadyList.Get(connection); i++)
+        {
+            connection->PollQueued = false;
+            uint8_t events = GetEvents(connection) & connection->PollInterest;
+            if (events != 0)
+            {
+                ready[count].Connection = connection;
+                ready[count].Context = connection->PollContext;
+                ready[count].Events = events;
+                count++;
+                QueueLocked(connection);
+            }
+        }
+        Lock.Give();
+
+        if (count > 0 || msTimeout == 0 || WakeRequested.exchange(false))
+        {
+            return count;
+        }
+
+        int remaining = -1;
+        if (msTimeout > 0)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0)
+            {
+                return 0;
+            }
+            remaining = (int)((left.count() + 999) / 1000);
+        }
+        Event.Wait(__FILE__, __LINE__, remaining);
+    }
+}
@@ -0,0 +1,109 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <atomic>
+#include <inttypes.h>
+
+#include "Config.hpp"
+#include "osEvent.hpp"
+#include "osMutex.hpp"
+#include "osRing.hpp"
+
+class TCPConnection;
+
+/// Lets one thread wait on many TCPConnections at once, like epoll. Connections are
+/// registered with the events they are interested in and Wait returns the ones that are ready.
+///
+/// Readiness is level triggered: a connection is reported by every Wait for as long as it
+/// stays ready. The stack queues a connection when something happens to it, so the cost of
+/// Wait depends on the number of ready connections and not on the number registered. Use
+/// Accept and the non-blocking Read(char*, int) on reported connections.
+class ConnectionPoller
+{
+public:
+    enum : uint8_t
+    {
+        POLL_READ = 0x01,   // Received data waiting to be read
+        POLL_WRITE = 0x02,  // The peer's window has room for more data
+        POLL_ACCEPT = 0x04, // A listening connection has a new connection
+        POLL_CLOSE = 0x08   // The peer has closed its side
+    };
+
+    struct Ready
+    {
+        TCPConnection* Connection;
+        void* Context;
+        uint8_t Events;
+    };
+
+    ConnectionPoller(const char* name);
+
+    /// @param context Returned with every Ready for the connection
+    /// @return false if the poller is full or the connection belongs to another poller
+    bool Add(TCPConnection*, uint8_t interest, void* context = nullptr);
+    void Modify(TCPConnection*, uint8_t interest);
+    void Remove(TCPConnection*);
+
+    /// @param msTimeout Milliseconds to wait for a ready connection, -1 waits forever and 0
+    /// only collects what is already ready
+    /// @return The number of entries filled in ready, 0 on timeout or Wake
+    int Wait(Ready* ready, int max, int msTimeout = -1);
+
+    /// @brief Make a blocked Wait return early
+    void Wake();
+
+    int GetCount() const { return Count.load(std::memory_order_relaxed); }
+
+    /// @return The events the connection is ready for, regardless of interest
+    static uint8_t GetEvents(const TCPConnection*);
+
+private:
+    friend class TCPConnection;
+
+    // Called by the stack when something changed on a registered connection
+    void Queue(TCPConnection*);
+    // Call with Lock held
+    void QueueLocked(TCPConnection*);
+
+    const char* Name;
+    std::atomic<int> Count;
+    std::atomic<bool> WakeRequested;
+    osEvent Event;
+    // Serialises the ready list with the registrations, so only registered connections are
+    // on it and each at most once, which keeps it within POLLER_MAX_CONNECTIONS
+    osMutex Lock;
+    osRing<TCPConnection*, osRingSize(POLLER_MAX_CONNECTIONS)> ReadyList;
+
+    ConnectionPoller(ConnectionPoller&);
+};
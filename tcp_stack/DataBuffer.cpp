@@ -31,15 +31,35 @@
 
 #include "DataBuffer.hpp"
 
-DataBuffer::DataBuffer() {}
+DataBuffer::DataBuffer()
+    : Pool(nullptr)
+    , Next(nullptr)
+    , Size(0)
+    , Data(nullptr)
+    , RefCount(0)
+{
+}
+
+void DataBuffer::SetStorage(uint8_t* data, uint16_t size)
+{
+    Data = data;
+    Size = size;
+}
 
 void DataBuffer::Initialize(InterfaceMAC* mac)
 {
     Packet = Data;
     Length = 0;
-    Remainder = DATA_BUFFER_PAYLOAD_SIZE;
-    Disposable = true;
+    Remainder = Size;
+    Checksum = 0;
+    RefCount.store(1, std::memory_order_relaxed);
+    ChecksumVerified = false;
+    ChecksumNeeded = false;
+    Classified = false;
+    ChecksumStart = 0;
+    ChecksumOffset = 0;
     MAC = mac;
+    Next = nullptr;
 }
 
 void DataBuffer::Preallocate(size_t size)
@@ -53,3 +73,42 @@ void DataBuffer::ResetPreallocation(size_t size)
     Packet -= size;
     Remainder += size;
 }
+
+void DataBuffer::Attach(const uint8_t* data, uint16_t length)
+{
+    Packet = (uint8_t*)data;
+    Length = length;
+    Remainder = 0;
+}
+
+void DataBuffer::Append(DataBuffer* segment)
+{
+    DataBuffer* last = this;
+    while (last->Next != nullptr)
+    {
+        last = last->Next;
+    }
+    last->Next = segment;
+}
+
+size_t DataBuffer::ChainLength() const
+{
+    size_t length = 0;
+    for (const DataBuffer* segment = this; segment != nullptr; segment = segment->Next)
+    {
+        length += segment->Length;
+    }
+    return length;
+}
+
+void DataBuffer::RequestChecksum(uint8_t* start, uint16_t offset)
+{
+    ChecksumNeeded = true;
+    ChecksumStart = start - Data;
+    ChecksumOffset = offset;
+}
+
+size_t DataBuffer::GetChecksumStart() const
+{
+    return (Data + ChecksumStart) - Packet;
+}
@@ -31,10 +31,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <inttypes.h>
 #include "Config.hpp"
 #include "InterfaceMAC.hpp"
 
+class DataBufferPool;
+
 class DataBuffer
 {
 public:
@@ -45,15 +48,53 @@ public:
     uint32_t Time_us;
     uint16_t Length;
     uint16_t Remainder;
-    bool Disposable;
+    uint32_t Checksum; // Sum of the payload bytes copied in with FCS::ChecksumCopy
+    bool ChecksumVerified; // rx, the link already validated the checksums of this frame
+    bool ChecksumNeeded;   // tx, the link must complete a checksum, see RequestChecksum
+    bool Classified;       // rx, the link already passed the frame through MAC Classify
     InterfaceMAC* MAC;
+    DataBufferPool* Pool; // The pool the buffer returns to, nullptr if it is not pooled
+    DataBuffer* Next;     // The next segment of a chained frame, nullptr in the last segment
+
+    void SetStorage(uint8_t* data, uint16_t size);
+    uint16_t GetSize() const { return Size; }
 
     void Initialize(InterfaceMAC*);
+
+    /// @brief Take another reference, for example to hold the buffer for retransmit while it
+    /// is also being sent. Initialize starts the count at one.
+    void AddRef() { RefCount.fetch_add(1, std::memory_order_relaxed); }
+    /// @return The number of references left, the buffer goes back to its pool at zero
+    int Release() { return RefCount.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+    /// @return The number of references held, more than the caller's means someone else, such
+    /// as a link batching transmits, may still read the frame
+    int GetRefCount() const { return RefCount.load(std::memory_order_acquire); }
     void Preallocate(size_t size);
     void ResetPreallocation(size_t size);
 
+    /// @brief Point this segment at memory it does not own instead of its storage. The memory
+    /// must stay valid until the buffer is freed, for TCP that is after it is acknowledged.
+    void Attach(const uint8_t* data, uint16_t length);
+    /// @brief Add a segment, or a chain of them, to the end of this chain
+    void Append(DataBuffer*);
+    /// @return Length of this segment plus all of the segments chained after it
+    size_t ChainLength() const;
+
+    /// @brief Leave a TCP/UDP checksum for the link to compute. The checksum field must hold
+    /// the folded, uncomplemented pseudo header sum.
+    /// @param start The first byte covered by the checksum, normally the L4 header
+    /// @param offset The offset of the checksum field from start
+    void RequestChecksum(uint8_t* start, uint16_t offset);
+    /// @return Offset of the first byte covered by the requested checksum from Packet
+    size_t GetChecksumStart() const;
+    uint16_t GetChecksumOffset() const { return ChecksumOffset; }
+
 private:
-    uint8_t Data[DATA_BUFFER_PAYLOAD_SIZE];
+    uint16_t ChecksumStart; // Relative to Data so it survives headers being prepended
+    uint16_t ChecksumOffset;
+    uint16_t Size;
+    uint8_t* Data;
+    std::atomic<int> RefCount;
 
     DataBuffer(DataBuffer&);
 };
@@ -0,0 +1,68 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+#include "DataBufferPool.hpp"
+
+DataBufferPool::DataBufferPool(const char* name,
+                               uint16_t bufferSize,
+                               int count,
+                               DataBuffer* buffers,
+                               uint8_t* storage,
+                               std::atomic<uint32_t>* links)
+    : Name(name)
+    , BufferSize(bufferSize)
+    , Capacity(count)
+    , Buffers(buffers)
+    , Storage(storage)
+    , Pool(name, buffers, sizeof(DataBuffer), count, links)
+{
+}
+
+void DataBufferPool::Initialize()
+{
+    for (int i = 0; i < Capacity; i++)
+    {
+        DataBuffer* buffer = &Buffers[i];
+        buffer->SetStorage(&Storage[i * BufferSize], BufferSize);
+        buffer->Pool = this;
+    }
+    Pool.Fill();
+}
+
+DataBuffer* DataBufferPool::Get()
+{
+    return (DataBuffer*)Pool.Get();
+}
+
+void DataBufferPool::Put(DataBuffer* buffer)
+{
+    Pool.Put(buffer);
+}
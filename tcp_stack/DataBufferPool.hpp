@@ -0,0 +1,104 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+#pragma once
+
+#include <inttypes.h>
+
+#include "DataBuffer.hpp"
+#include "osPool.hpp"
+
+/// A fixed number of DataBuffers that all share one storage size. The MAC keeps one pool per
+/// size class and hands out buffers from the smallest class that fits the frame. Get and Put
+/// don't take a lock, see osPool.
+class DataBufferPool
+{
+public:
+    const char* GetName() const { return Name; }
+    uint16_t GetBufferSize() const { return BufferSize; }
+    int GetCapacity() const { return Capacity; }
+    /// @return Buffers on the shared freelist, not those cached by threads, see osPool
+    int GetCount() const { return Pool.GetCount(); }
+    osPool::Statistics GetStatistics() const { return Pool.GetStatistics(); }
+
+    DataBuffer* Get();
+    void Put(DataBuffer*);
+
+protected:
+    DataBufferPool(const char* name,
+                   uint16_t bufferSize,
+                   int count,
+                   DataBuffer* buffers,
+                   uint8_t* storage,
+                   std::atomic<uint32_t>* links);
+
+    // The storage is owned by the derived class and is not constructed until after the
+    // base so the buffers are attached from the derived constructor.
+    void Initialize();
+
+private:
+    const char* Name;
+    uint16_t BufferSize;
+    int Capacity;
+    DataBuffer* Buffers;
+    uint8_t* Storage;
+    osPool Pool;
+
+    DataBufferPool(DataBufferPool&);
+};
+
+template <uint16_t SIZE, int COUNT>
+class StaticDataBufferPool : public DataBufferPool
+{
+public:
+    StaticDataBufferPool(const char* name)
+        : DataBufferPool(name, SIZE, COUNT, Buffers, &Storage[0][0], Links)
+    {
+        Initialize();
+    }
+
+private:
+    DataBuffer Buffers[COUNT];
+    uint8_t Storage[COUNT][SIZE];
+    std::atomic<uint32_t> Links[COUNT];
+};
+
+/// A single DataBuffer with its own storage for protocols that keep a buffer back from the
+/// MAC pools, like the ARP request.
+template <uint16_t SIZE>
+class StaticDataBuffer : public DataBuffer
+{
+public:
+    StaticDataBuffer() { SetStorage(Storage, SIZE); }
+
+private:
+    uint8_t Storage[SIZE];
+};
@@ -30,14 +30,16 @@
 //----------------------------------------------------------------------------
 
 #include "DefaultStack.hpp"
+#include "osTime.hpp"
 
 DefaultStack::DefaultStack()
-    : MAC(ARP, IP)
+    : Timers("stack timers", TIMER_TICK_US)
+    , MAC(ARP, IP)
     , IP(MAC, ARP, ICMP, TCP, UDP)
-    , ARP(MAC, IP)
-    , DHCP(MAC, IP, UDP)
+    , ARP(MAC, IP, Timers)
+    , DHCP(MAC, IP, UDP, Timers)
     , ICMP(IP)
-    , TCP(IP)
+    , TCP(IP, Timers)
     , UDP(IP, DHCP)
 {
 }
@@ -47,11 +49,31 @@ void DefaultStack::RegisterDataTransmitHandler(InterfaceMAC::DataTransmitHandler
     MAC.RegisterDataTransmitHandler(handler);
 }
 
+void DefaultStack::RegisterBufferTransmitHandler(InterfaceMAC::BufferTransmitHandler handler)
+{
+    MAC.RegisterBufferTransmitHandler(handler);
+}
+
+void DefaultStack::RegisterTransmitFlushHandler(InterfaceMAC::TransmitFlushHandler handler)
+{
+    MAC.RegisterTransmitFlushHandler(handler);
+}
+
+void DefaultStack::RegisterAddressChangeHandler(InterfaceMAC::AddressChangeHandler handler)
+{
+    MAC.RegisterAddressChangeHandler(handler);
+}
+
 void DefaultStack::SetMACAddress(uint8_t* addr)
 {
     MAC.SetUnicastAddress(addr);
 }
 
+void DefaultStack::SetChecksumOffload(uint32_t offload)
+{
+    MAC.SetChecksumOffload(offload);
+}
+
 void DefaultStack::StartDHCP()
 {
     DHCP.test();
@@ -59,10 +81,25 @@ void DefaultStack::StartDHCP()
 
 void DefaultStack::Tick()
 {
-    TCP.Tick();
+    osTime::Batch batch;
+    Timers.Advance(osTime::Now_us());
+    // Send whatever the timers queued, retransmits and delayed ACKs
+    MAC.FlushTx();
+}
+
+void DefaultStack::ProcessRx(uint8_t* data, size_t length, bool checksumVerified)
+{
+    osTime::Batch batch;
+    MAC.ProcessRx(data, length, checksumVerified);
+}
+
+DataBuffer* DefaultStack::GetRxBuffer(size_t size)
+{
+    return MAC.GetRxBuffer(size);
 }
 
-void DefaultStack::ProcessRx(uint8_t* data, size_t length)
+void DefaultStack::ProcessRx(DataBuffer* buffer)
 {
-    MAC.ProcessRx(data, length);
+    osTime::Batch batch;
+    MAC.ProcessRx(buffer);
 }
@@ -39,18 +39,31 @@
 #include "ProtocolMACEthernet.hpp"
 #include "ProtocolTCP.hpp"
 #include "ProtocolUDP.hpp"
+#include "osTimerWheel.hpp"
 
 class DefaultStack
 {
 public:
     DefaultStack();
     void RegisterDataTransmitHandler(InterfaceMAC::DataTransmitHandler);
+    void RegisterBufferTransmitHandler(InterfaceMAC::BufferTransmitHandler);
+    void RegisterTransmitFlushHandler(InterfaceMAC::TransmitFlushHandler);
+    void RegisterAddressChangeHandler(InterfaceMAC::AddressChangeHandler);
     void SetMACAddress(uint8_t* addr);
+    void SetChecksumOffload(uint32_t offload);
     void StartDHCP();
+    /// @brief Run the protocol timers that are due, usually after Timers.WaitForNext
     void Tick();
 
-    void ProcessRx(uint8_t* data, size_t length);
+    void ProcessRx(uint8_t* data, size_t length, bool checksumVerified = false);
 
+    /// Zero copy receive, the link receives a frame straight into a buffer from GetRxBuffer
+    /// and hands it to ProcessRx
+    DataBuffer* GetRxBuffer(size_t size);
+    void ProcessRx(DataBuffer* buffer);
+
+    // Declared first so it outlives the protocols whose timers run on it
+    osTimerWheel Timers;
     ProtocolMACEthernet MAC;
     ProtocolIPv4 IP;
     ProtocolARP ARP;
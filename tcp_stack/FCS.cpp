@@ -31,33 +31,482 @@
 
 #include "FCS.hpp"
 #include <stdio.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FCS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Every engine computes the exact sum of the big-endian 16 bit words in the buffer. Since
+// the sum of the words is 256 * (sum of the bytes at even offsets) + (sum of the bytes at
+// odd offsets) the wide engines only have to add up bytes, which is what the SIMD sum of
+// absolute differences instructions do best. The caller truncates the result to 32 bits,
+// which gives the same answer as the original word at a time loop.
+
+typedef uint64_t (*SumFunction)(const uint8_t* buffer, size_t length);
+typedef uint64_t (*CopySumFunction)(uint8_t* target, const uint8_t* source, size_t length);
+
+static uint64_t SumScalar(const uint8_t* buffer, size_t length)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < length / 2; i++)
+    {
+        sum += (uint16_t)((buffer[i * 2] << 8) | buffer[i * 2 + 1]);
+    }
+
+    return sum;
+}
+
+static uint64_t SumWord64(const uint8_t* buffer, size_t length)
+{
+    const uint64_t mask = 0x00FF00FF00FF00FFull;
+    uint64_t high = 0; // bytes at even offsets, the most significant byte of each word
+    uint64_t low = 0;  // bytes at odd offsets
+
+    while (length >= 8)
+    {
+        // Each 16 bit lane can take 257 additions of 0xFF before it overflows
+        size_t blocks = length / 8;
+        if (blocks > 256)
+        {
+            blocks = 256;
+        }
+        uint64_t laneEven = 0;
+        uint64_t laneOdd = 0;
+        for (size_t i = 0; i < blocks; i++)
+        {
+            uint64_t word;
+            memcpy(&word, buffer, sizeof(word));
+            laneEven += word & mask;
+            laneOdd += (word >> 8) & mask;
+            buffer += 8;
+        }
+        length -= blocks * 8;
+
+        uint64_t even = (laneEven & 0xFFFF) + ((laneEven >> 16) & 0xFFFF) +
+                        ((laneEven >> 32) & 0xFFFF) + (laneEven >> 48);
+        uint64_t odd = (laneOdd & 0xFFFF) + ((laneOdd >> 16) & 0xFFFF) +
+                       ((laneOdd >> 32) & 0xFFFF) + (laneOdd >> 48);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        high += odd;
+        low += even;
+#else
+        high += even;
+        low += odd;
+#endif
+    }
+
+    return (high << 8) + low + SumScalar(buffer, length);
+}
+
+// The copy variants below copy length bytes from source to target and return the sum of
+// the copied words, so the data only makes one trip through the cache.
+
+static uint64_t CopySumScalar(uint8_t* target, const uint8_t* source, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        target[i] = source[i];
+    }
+    return SumScalar(target, length);
+}
+
+static uint64_t CopySumWord64(uint8_t* target, const uint8_t* source, size_t length)
+{
+    const uint64_t mask = 0x00FF00FF00FF00FFull;
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    while (length >= 8)
+    {
+        size_t blocks = length / 8;
+        if (blocks > 256)
+        {
+            blocks = 256;
+        }
+        uint64_t laneEven = 0;
+        uint64_t laneOdd = 0;
+        for (size_t i = 0; i < blocks; i++)
+        {
+            uint64_t word;
+            memcpy(&word, source, sizeof(word));
+            memcpy(target, &word, sizeof(word));
+            laneEven += word & mask;
+            laneOdd += (word >> 8) & mask;
+            source += 8;
+            target += 8;
+        }
+        length -= blocks * 8;
+
+        uint64_t even = (laneEven & 0xFFFF) + ((laneEven >> 16) & 0xFFFF) +
+                        ((laneEven >> 32) & 0xFFFF) + (laneEven >> 48);
+        uint64_t odd = (laneOdd & 0xFFFF) + ((laneOdd >> 16) & 0xFFFF) +
+                       ((laneOdd >> 32) & 0xFFFF) + (laneOdd >> 48);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        high += odd;
+        low += even;
+#else
+        high += even;
+        low += odd;
+#endif
+    }
+
+    return (high << 8) + low + CopySumScalar(target, source, length);
+}
+
+#ifdef FCS_X86_SIMD
+__attribute__((target("sse2"))) static uint64_t SumSSE2(const uint8_t* buffer, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i evenMask = _mm_set1_epi16(0x00FF);
+    __m128i all = zero;
+    __m128i even = zero;
+
+    // psadbw against zero adds eight bytes into a 64 bit lane, so the accumulators can not
+    // overflow for any buffer that fits in memory
+    while (length >= 32)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i*)buffer);
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(buffer + 16));
+        all = _mm_add_epi64(all, _mm_sad_epu8(v0, zero));
+        even = _mm_add_epi64(even, _mm_sad_epu8(_mm_and_si128(v0, evenMask), zero));
+        all = _mm_add_epi64(all, _mm_sad_epu8(v1, zero));
+        even = _mm_add_epi64(even, _mm_sad_epu8(_mm_and_si128(v1, evenMask), zero));
+        buffer += 32;
+        length -= 32;
+    }
+    if (length >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)buffer);
+        all = _mm_add_epi64(all, _mm_sad_epu8(v, zero));
+        even = _mm_add_epi64(even, _mm_sad_epu8(_mm_and_si128(v, evenMask), zero));
+        buffer += 16;
+        length -= 16;
+    }
+
+    uint64_t allLanes[2];
+    uint64_t evenLanes[2];
+    _mm_storeu_si128((__m128i*)allLanes, all);
+    _mm_storeu_si128((__m128i*)evenLanes, even);
+    uint64_t high = evenLanes[0] + evenLanes[1];
+    uint64_t low = allLanes[0] + allLanes[1] - high;
+
+    return (high << 8) + low + SumScalar(buffer, length);
+}
+
+__attribute__((target("avx2"))) static uint64_t SumAVX2(const uint8_t* buffer, size_t length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i evenMask = _mm256_set1_epi16(0x00FF);
+    __m256i all = zero;
+    __m256i even = zero;
+
+    while (length >= 64)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)buffer);
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(buffer + 32));
+        all = _mm256_add_epi64(all, _mm256_sad_epu8(v0, zero));
+        even = _mm256_add_epi64(even, _mm256_sad_epu8(_mm256_and_si256(v0, evenMask), zero));
+        all = _mm256_add_epi64(all, _mm256_sad_epu8(v1, zero));
+        even = _mm256_add_epi64(even, _mm256_sad_epu8(_mm256_and_si256(v1, evenMask), zero));
+        buffer += 64;
+        length -= 64;
+    }
+    if (length >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)buffer);
+        all = _mm256_add_epi64(all, _mm256_sad_epu8(v, zero));
+        even = _mm256_add_epi64(even, _mm256_sad_epu8(_mm256_and_si256(v, evenMask), zero));
+        buffer += 32;
+        length -= 32;
+    }
+
+    uint64_t allLanes[4];
+    uint64_t evenLanes[4];
+    _mm256_storeu_si256((__m256i*)allLanes, all);
+    _mm256_storeu_si256((__m256i*)evenLanes, even);
+    uint64_t high = evenLanes[0] + evenLanes[1] + evenLanes[2] + evenLanes[3];
+    uint64_t low = allLanes[0] + allLanes[1] + allLanes[2] + allLanes[3] - high;
+
+    // The remaining tail is less than 32 bytes
+    return (high << 8) + low + SumWord64(buffer, length);
+}
+
+__attribute__((target("sse2"))) static uint64_t
+    CopySumSSE2(uint8_t* target, const uint8_t* source, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i evenMask = _mm_set1_epi16(0x00FF);
+    __m128i all = zero;
+    __m128i even = zero;
+
+    while (length >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)source);
+        _mm_storeu_si128((__m128i*)target, v);
+        all = _mm_add_epi64(all, _mm_sad_epu8(v, zero));
+        even = _mm_add_epi64(even, _mm_sad_epu8(_mm_and_si128(v, evenMask), zero));
+        source += 16;
+        target += 16;
+        length -= 16;
+    }
+
+    uint64_t allLanes[2];
+    uint64_t evenLanes[2];
+    _mm_storeu_si128((__m128i*)allLanes, all);
+    _mm_storeu_si128((__m128i*)evenLanes, even);
+    uint64_t high = evenLanes[0] + evenLanes[1];
+    uint64_t low = allLanes[0] + allLanes[1] - high;
+
+    return (high << 8) + low + CopySumScalar(target, source, length);
+}
+
+__attribute__((target("avx2"))) static uint64_t
+    CopySumAVX2(uint8_t* target, const uint8_t* source, size_t length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i evenMask = _mm256_set1_epi16(0x00FF);
+    __m256i all = zero;
+    __m256i even = zero;
+
+    while (length >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)source);
+        _mm256_storeu_si256((__m256i*)target, v);
+        all = _mm256_add_epi64(all, _mm256_sad_epu8(v, zero));
+        even = _mm256_add_epi64(even, _mm256_sad_epu8(_mm256_and_si256(v, evenMask), zero));
+        source += 32;
+        target += 32;
+        length -= 32;
+    }
+
+    uint64_t allLanes[4];
+    uint64_t evenLanes[4];
+    _mm256_storeu_si256((__m256i*)allLanes, all);
+    _mm256_storeu_si256((__m256i*)evenLanes, even);
+    uint64_t high = evenLanes[0] + evenLanes[1] + evenLanes[2] + evenLanes[3];
+    uint64_t low = allLanes[0] + allLanes[1] + allLanes[2] + allLanes[3] - high;
+
+    return (high << 8) + low + CopySumWord64(target, source, length);
+}
+#endif
+
+static bool IsSupported(FCS::Engine engine)
+{
+    bool rc = false;
+    switch (engine)
+    {
+    case FCS::Engine::Scalar:
+    case FCS::Engine::Word64: rc = true; break;
+#ifdef FCS_X86_SIMD
+    case FCS::Engine::SSE2:
+        __builtin_cpu_init();
+        rc = __builtin_cpu_supports("sse2");
+        break;
+    case FCS::Engine::AVX2:
+        __builtin_cpu_init();
+        rc = __builtin_cpu_supports("avx2");
+        break;
+#else
+    case FCS::Engine::SSE2:
+    case FCS::Engine::AVX2: rc = false; break;
+#endif
+    }
+    return rc;
+}
+
+static SumFunction GetSumFunction(FCS::Engine engine)
+{
+    SumFunction rc = SumScalar;
+    switch (engine)
+    {
+    case FCS::Engine::Scalar: rc = SumScalar; break;
+    case FCS::Engine::Word64: rc = SumWord64; break;
+#ifdef FCS_X86_SIMD
+    case FCS::Engine::SSE2: rc = SumSSE2; break;
+    case FCS::Engine::AVX2: rc = SumAVX2; break;
+#else
+    case FCS::Engine::SSE2:
+    case FCS::Engine::AVX2: break;
+#endif
+    }
+    return rc;
+}
+
+static CopySumFunction GetCopySumFunction(FCS::Engine engine)
+{
+    CopySumFunction rc = CopySumScalar;
+    switch (engine)
+    {
+    case FCS::Engine::Scalar: rc = CopySumScalar; break;
+    case FCS::Engine::Word64: rc = CopySumWord64; break;
+#ifdef FCS_X86_SIMD
+    case FCS::Engine::SSE2: rc = CopySumSSE2; break;
+    case FCS::Engine::AVX2: rc = CopySumAVX2; break;
+#else
+    case FCS::Engine::SSE2:
+    case FCS::Engine::AVX2: break;
+#endif
+    }
+    return rc;
+}
+
+static FCS::Engine SelectEngine()
+{
+    FCS::Engine rc = FCS::Engine::Word64;
+    if (IsSupported(FCS::Engine::AVX2))
+    {
+        rc = FCS::Engine::AVX2;
+    }
+    else if (IsSupported(FCS::Engine::SSE2))
+    {
+        rc = FCS::Engine::SSE2;
+    }
+    return rc;
+}
+
+static uint64_t SumDispatch(const uint8_t* buffer, size_t length);
+static uint64_t CopySumDispatch(uint8_t* target, const uint8_t* source, size_t length);
+
+// Constant initialized so that checksums computed during static construction still work
+static FCS::Engine CurrentEngine = FCS::Engine::Scalar;
+static SumFunction CurrentSum = SumDispatch;
+static CopySumFunction CurrentCopySum = CopySumDispatch;
+
+static uint64_t SumDispatch(const uint8_t* buffer, size_t length)
+{
+    FCS::SetEngine(SelectEngine());
+    return CurrentSum(buffer, length);
+}
+
+static uint64_t CopySumDispatch(uint8_t* target, const uint8_t* source, size_t length)
+{
+    FCS::SetEngine(SelectEngine());
+    return CurrentCopySum(target, source, length);
+}
 
 uint32_t FCS::ChecksumAdd(const uint8_t* buffer, int length, uint32_t checksum)
 {
-    uint16_t value;
-    int32_t i;
+    if (length > 1)
+    {
+        checksum += (uint32_t)CurrentSum(buffer, (size_t)(length & ~1));
+    }
 
-    // Don't need to add in the checksum field so only 9x16 bit words in header
-    for (i = 0; i < length / 2; i++)
+    return checksum;
+}
+
+uint32_t FCS::ChecksumCopy(
+    uint8_t* target, const uint8_t* source, int length, int offset, uint32_t checksum)
+{
+    if (length > 0 && (offset & 1) != 0)
+    {
+        // The first byte completes a word that was started by the previous copy
+        target[0] = source[0];
+        checksum += source[0];
+        target++;
+        source++;
+        length--;
+    }
+    if (length > 1)
     {
-        value = (buffer[i * 2] << 8) | buffer[i * 2 + 1];
-        checksum += (uint32_t)value;
+        checksum += (uint32_t)CurrentCopySum(target, source, (size_t)(length & ~1));
+    }
+    if ((length & 1) != 0)
+    {
+        // The last byte starts a word, the low half is zero until something is appended
+        target[length - 1] = source[length - 1];
+        checksum += (uint32_t)source[length - 1] << 8;
+    }
+
+    return checksum;
+}
+
+uint32_t FCS::ChecksumAddAt(const uint8_t* buffer, int length, int offset, uint32_t checksum)
+{
+    if (length > 0 && (offset & 1) != 0)
+    {
+        checksum += buffer[0];
+        buffer++;
+        length--;
+    }
+    checksum = ChecksumAdd(buffer, length, checksum);
+    if ((length & 1) != 0)
+    {
+        checksum += (uint32_t)buffer[length - 1] << 8;
     }
 
     return checksum;
 }
 
+// Fold the carries back into the low 16 bits, the end-around carry of ones' complement addition
+static uint16_t Fold(uint32_t sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
 uint16_t FCS::ChecksumComplete(uint32_t checksum)
 {
-    uint16_t sum;
-    sum = (checksum & 0xFFFF);
-    sum += (checksum >> 16);
-    sum = ~sum;
+    return ~Fold(checksum);
+}
 
-    return sum;
+uint16_t FCS::ChecksumUpdate16(uint16_t checksum, uint16_t oldValue, uint16_t newValue)
+{
+    // RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m')
+    uint32_t sum = (uint16_t)~checksum;
+    sum += (uint16_t)~oldValue;
+    sum += newValue;
+    return ~Fold(sum);
+}
+
+uint16_t FCS::ChecksumUpdate32(uint16_t checksum, uint32_t oldValue, uint32_t newValue)
+{
+    uint32_t sum = (uint16_t)~checksum;
+    sum += (uint16_t)~(oldValue >> 16);
+    sum += (uint16_t)~oldValue;
+    sum += newValue >> 16;
+    sum += newValue & 0xFFFF;
+    return ~Fold(sum);
 }
 
 uint16_t FCS::Checksum(const uint8_t* buffer, int length)
 {
     return ChecksumComplete(ChecksumAdd(buffer, length, 0));
 }
+
+FCS::Engine FCS::GetEngine()
+{
+    if (CurrentSum == SumDispatch)
+    {
+        SetEngine(SelectEngine());
+    }
+    return CurrentEngine;
+}
+
+bool FCS::SetEngine(Engine engine)
+{
+    bool rc = IsSupported(engine);
+    if (rc)
+    {
+        CurrentEngine = engine;
+        CurrentSum = GetSumFunction(engine);
+        CurrentCopySum = GetCopySumFunction(engine);
+    }
+    return rc;
+}
+
+const char* FCS::GetEngineName(Engine engine)
+{
+    const char* rc = "unknown";
+    switch (engine)
+    {
+    case Engine::Scalar: rc = "scalar"; break;
+    case Engine::Word64: rc = "word64"; break;
+    case Engine::SSE2: rc = "sse2"; break;
+    case Engine::AVX2: rc = "avx2"; break;
+    }
+    return rc;
+}
@@ -36,7 +36,48 @@
 class FCS
 {
 public:
+    /// @brief The implementations available for summing a buffer. The fastest one supported
+    /// by the running CPU is selected automatically, the others exist for testing.
+    enum class Engine
+    {
+        Scalar,
+        Word64,
+        SSE2,
+        AVX2
+    };
+
     static uint16_t Checksum(const uint8_t* buffer, int length);
+
+    /// @brief Adds the big-endian 16 bit words in buffer to checksum. A trailing odd byte is
+    /// ignored. The result is the plain 32 bit sum, identical for every Engine.
     static uint32_t ChecksumAdd(const uint8_t* buffer, int length, uint32_t checksum);
     static uint16_t ChecksumComplete(uint32_t checksum);
+
+    /// @brief Copy length bytes from source to target and add them to checksum in one pass.
+    /// @param offset The position of target[0] within the checksummed data. Only its parity
+    /// matters, it allows a stream of copies to build up the sum of one buffer. Unlike
+    /// ChecksumAdd a trailing odd byte is included, as if padded with zero.
+    static uint32_t ChecksumCopy(
+        uint8_t* target, const uint8_t* source, int length, int offset, uint32_t checksum);
+
+    /// @brief ChecksumCopy without the copy, for summing data that is referenced rather than
+    /// copied, such as the segments of a chained DataBuffer.
+    static uint32_t ChecksumAddAt(const uint8_t* buffer, int length, int offset, uint32_t checksum);
+
+    /// @brief Incrementally update a stored checksum after a 16 bit field changed from
+    /// oldValue to newValue, as described in RFC 1624. Avoids summing the whole packet again.
+    /// @return The checksum to store in place of checksum
+    static uint16_t ChecksumUpdate16(uint16_t checksum, uint16_t oldValue, uint16_t newValue);
+
+    /// @brief Same as ChecksumUpdate16 for a 32 bit field, such as a sequence number or an
+    /// IPv4 address, that starts on a 16 bit boundary.
+    static uint16_t ChecksumUpdate32(uint16_t checksum, uint32_t oldValue, uint32_t newValue);
+
+    static Engine GetEngine();
+
+    /// @brief Select the engine used by ChecksumAdd.
+    /// @return false if the engine is not supported by this CPU or build, in which case the
+    /// current engine is left unchanged.
+    static bool SetEngine(Engine);
+    static const char* GetEngineName(Engine);
 };
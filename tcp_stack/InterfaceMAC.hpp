@@ -41,15 +41,53 @@ class InterfaceMAC
 public:
     virtual ~InterfaceMAC() {}
     typedef void (*DataTransmitHandler)(void* data, size_t length);
+    typedef void (*BufferTransmitHandler)(DataBuffer* buffer);
+    typedef void (*TransmitFlushHandler)();
+    typedef void (*AddressChangeHandler)(const uint8_t* address);
+
+    // Checksum offload capabilities of the link
+    // The link validated the IPv4, TCP and UDP checksums of every received frame
+    static const uint32_t OFFLOAD_RX_CHECKSUM = 0x01;
+    // IPv4 leaves its header checksum at 0, only for a link that fills it in or, like
+    // VirtualLink, delivers the frame as verified
+    static const uint32_t OFFLOAD_TX_IPV4_CHECKSUM = 0x02;
+    // The link completes the TCP/UDP checksum described by DataBuffer::RequestChecksum
+    static const uint32_t OFFLOAD_TX_L4_CHECKSUM = 0x04;
 
     virtual void RegisterDataTransmitHandler(DataTransmitHandler) = 0;
+    /// A buffer handler sees the DataBuffer, including its checksum metadata, instead of
+    /// just the frame bytes. It is used in place of the DataTransmitHandler when registered.
+    /// The frame may be a chain of segments linked through DataBuffer::Next.
+    virtual void RegisterBufferTransmitHandler(BufferTransmitHandler) = 0;
+    /// A link that queues frames to send them in batches registers a flush handler. The stack
+    /// calls FlushTx at the end of each burst it sends, a link with no handler sends each
+    /// frame as it is handed over.
+    virtual void RegisterTransmitFlushHandler(TransmitFlushHandler) = 0;
+    virtual void FlushTx() = 0;
+    /// A link that filters received frames by address registers to hear when the unicast
+    /// address changes
+    virtual void RegisterAddressChangeHandler(AddressChangeHandler) = 0;
+    virtual uint32_t GetChecksumOffload() const = 0;
     virtual size_t AddressSize() const = 0;
     virtual size_t HeaderSize() const = 0;
     virtual const uint8_t* GetUnicastAddress() const = 0;
     virtual const uint8_t* GetBroadcastAddress() const = 0;
-    virtual DataBuffer* GetTxBuffer() = 0;
+    /// @param size Bytes needed after the MAC header, the buffer comes from the smallest
+    /// size class that holds them
+    /// @param wait false to return nullptr when none are free, rather than wait for one
+    virtual DataBuffer* GetTxBuffer(size_t size, bool wait = true) = 0;
+    /// @return A receive buffer of at least size bytes for the link to receive a frame into,
+    /// nullptr when none are free. Packet is at the start of the frame.
+    virtual DataBuffer* GetRxBuffer(size_t size) = 0;
+    /// @brief Check a received frame in place, before the link spends a receive buffer on it
+    /// @return false if the stack would drop the frame, which is counted. Set Classified on
+    /// the buffer a passed frame is copied into so the stack does not check it again.
+    virtual bool Classify(const uint8_t* frame, int length) = 0;
+    /// Drop one reference, the buffer returns to its pool when the last one is dropped
     virtual void FreeTxBuffer(DataBuffer*) = 0;
     virtual void FreeRxBuffer(DataBuffer*) = 0;
+    /// Transmit takes over the caller's reference to the buffer. Retransmit leaves it with the
+    /// caller. A transmit handler that keeps a buffer after it returns must AddRef it.
     virtual void Transmit(DataBuffer*, const uint8_t* targetMAC, uint16_t type) = 0;
     virtual void Retransmit(DataBuffer* buffer) = 0;
 };
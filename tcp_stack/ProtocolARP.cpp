@@ -52,12 +52,23 @@
 
 ARPCacheEntry::ARPCacheEntry()
     : Age(0)
+    , Expiry("arp entry", Expire, this)
 {
 }
 
-ProtocolARP::ProtocolARP(InterfaceMAC& mac, ProtocolIPv4& ip)
-    : MAC(mac)
+void ARPCacheEntry::Expire(void* param)
+{
+    ARPCacheEntry* entry = (ARPCacheEntry*)param;
+    entry->Age = 0;
+}
+
+ProtocolARP::ProtocolARP(InterfaceMAC& mac, ProtocolIPv4& ip, osTimerWheel& timers)
+    : CacheLock("ARP cache")
+    , AddedHandler(nullptr)
+    , AddedParam(nullptr)
+    , MAC(mac)
     , IP(ip)
+    , Timers(timers)
 {
 }
 
@@ -108,11 +119,13 @@ void ProtocolARP::Add(const uint8_t* protocolAddress, const uint8_t* hardwareAdd
     uint32_t i;
     int oldest;
 
+    CacheLock.Take(__FILE__, __LINE__);
     index = LocateProtocolAddress(protocolAddress);
     if (index >= 0)
     {
         // Found entry in table, reset it's age
         Cache[index].Age = 1;
+        Timers.Start(&Cache[index].Expiry, ARP_ENTRY_TIMEOUT_US);
     }
     else
     {
@@ -141,6 +154,7 @@ void ProtocolARP::Add(const uint8_t* protocolAddress, const uint8_t* hardwareAdd
 
         // At this point i is the entry we want to use
         Cache[i].Age = 1;
+        Timers.Start(&Cache[i].Expiry, ARP_ENTRY_TIMEOUT_US);
         for (size_t j = 0; j < IP.AddressSize(); j++)
         {
             Cache[i].IPv4Address[j] = protocolAddress[j];
@@ -151,19 +165,26 @@ void ProtocolARP::Add(const uint8_t* protocolAddress, const uint8_t* hardwareAdd
         }
     }
 
-    // Age the list
+    // Age the list, this only orders entries for replacement, Expiry flushes them
     for (i = 0; i < ARPCacheSize; i++)
     {
-        if (Cache[i].Age != 0)
+        if (Cache[i].Age != 0 && Cache[i].Age < 0xFE)
         {
             Cache[i].Age++;
-            if (Cache[i].Age == 0xFF)
-            {
-                // Flush this entry
-                Cache[i].Age = 0;
-            }
         }
     }
+    CacheLock.Give();
+
+    if (AddedHandler)
+    {
+        AddedHandler(AddedParam, protocolAddress, hardwareAddress);
+    }
+}
+
+void ProtocolARP::RegisterAddHandler(AddHandler handler, void* param)
+{
+    AddedParam = param;
+    AddedHandler = handler;
 }
 
 std::ostream& operator<<(std::ostream& out, const ProtocolARP& obj)
@@ -197,7 +218,7 @@ std::ostream& operator<<(std::ostream& out, const ProtocolARP& obj)
 void ProtocolARP::SendReply(const ARPInfo& info)
 {
     int offset = 0;
-    DataBuffer* txBuffer = MAC.GetTxBuffer();
+    DataBuffer* txBuffer = MAC.GetTxBuffer(28);
     if (txBuffer == nullptr)
     {
         printf("ARP failed to get tx buffer\n");
@@ -220,38 +241,37 @@ void ProtocolARP::SendReply(const ARPInfo& info)
 
 void ProtocolARP::SendRequest(const uint8_t* targetIP)
 {
-    ARPRequest.Initialize(&MAC);
-
-    // This is normally done by the mac layer
-    // but this buffer is reserved by arp and not allocated from the mac
-    ARPRequest.Packet += MAC.HeaderSize();
-    ARPRequest.Remainder -= MAC.HeaderSize();
-
-    ARPRequest.Disposable = false;
+    // A buffer of its own for each request, a batching link may still hold the last one
+    DataBuffer* request = MAC.GetTxBuffer(28);
+    if (request == nullptr)
+    {
+        printf("ARP failed to get tx buffer\n");
+        return;
+    }
 
     size_t offset = 0;
-    offset = Pack16(ARPRequest.Packet, offset, 0x0001); // Hardware Type
-    offset = Pack16(ARPRequest.Packet, offset, 0x0800); // Protocol Type
-    offset = Pack8(ARPRequest.Packet, offset, 6);       // Hardware Size
-    offset = Pack8(ARPRequest.Packet, offset, 4);       // Protocol Size
-    offset = Pack16(ARPRequest.Packet, offset, 0x0001); // Op
+    offset = Pack16(request->Packet, offset, 0x0001); // Hardware Type
+    offset = Pack16(request->Packet, offset, 0x0800); // Protocol Type
+    offset = Pack8(request->Packet, offset, 6);       // Hardware Size
+    offset = Pack8(request->Packet, offset, 4);       // Protocol Size
+    offset = Pack16(request->Packet, offset, 0x0001); // Op
 
     // Sender's Hardware Address
-    offset = PackBytes(ARPRequest.Packet, offset, MAC.GetUnicastAddress(), 6);
+    offset = PackBytes(request->Packet, offset, MAC.GetUnicastAddress(), 6);
 
     // Sender's Protocol Address
-    offset = PackBytes(ARPRequest.Packet, offset, IP.GetUnicastAddress(), 4);
+    offset = PackBytes(request->Packet, offset, IP.GetUnicastAddress(), 4);
 
     // Target's Hardware Address
-    offset = PackFill(ARPRequest.Packet, offset, 0, 6);
+    offset = PackFill(request->Packet, offset, 0, 6);
 
     // Target's Protocol Address
-    ARPRequest.Length = PackBytes(ARPRequest.Packet, offset, targetIP, 4);
+    request->Length = PackBytes(request->Packet, offset, targetIP, 4);
 
-    MAC.Transmit(&ARPRequest, MAC.GetBroadcastAddress(), 0x0806);
+    MAC.Transmit(request, MAC.GetBroadcastAddress(), 0x0806);
 }
 
-const uint8_t* ProtocolARP::Protocol2Hardware(const uint8_t* protocolAddress)
+const uint8_t* ProtocolARP::Protocol2Hardware(const uint8_t* protocolAddress, bool request)
 {
     int index;
     const uint8_t* rc = nullptr;
@@ -266,13 +286,15 @@ const uint8_t* ProtocolARP::Protocol2Hardware(const uint8_t* protocolAddress)
         {
             protocolAddress = IP.GetGatewayAddress();
         }
+        CacheLock.Take(__FILE__, __LINE__);
         index = LocateProtocolAddress(protocolAddress);
+        CacheLock.Give();
 
         if (index != -1)
         {
             rc = Cache[index].MACAddress;
         }
-        else
+        else if (request)
         {
             SendRequest(protocolAddress);
         }
@@ -35,9 +35,11 @@
 #include <iostream>
 
 #include "DataBuffer.hpp"
+#include "DataBufferPool.hpp"
 #include "InterfaceMAC.hpp"
 #include "ProtocolIPv4.hpp"
 #include "osMutex.hpp"
+#include "osTimerWheel.hpp"
 
 class ARPCacheEntry
 {
@@ -46,6 +48,10 @@ public:
     uint8_t Age;
     uint8_t IPv4Address[4];
     uint8_t MACAddress[6];
+
+    // Flushes the entry ARP_ENTRY_TIMEOUT_US after it was last refreshed
+    osTimer Expiry;
+    static void Expire(void* param);
 };
 
 // HardwareType - 2 bytes
@@ -60,14 +66,22 @@ public:
 class ProtocolARP
 {
 public:
-    ProtocolARP(InterfaceMAC& mac, ProtocolIPv4& ip);
+    /// Told of each address Add caches, with the param given to RegisterAddHandler
+    typedef void (*AddHandler)(void* param,
+                               const uint8_t* protocolAddress,
+                               const uint8_t* hardwareAddress);
+
+    ProtocolARP(InterfaceMAC& mac, ProtocolIPv4& ip, osTimerWheel& timers);
     void Initialize();
 
     void ProcessRx(const DataBuffer*);
 
+    /// @brief Cache an address, safe to call from outside the thread receiving for this stack
     void Add(const uint8_t* protocolAddress, const uint8_t* hardwareAddress);
+    void RegisterAddHandler(AddHandler, void* param);
 
-    const uint8_t* Protocol2Hardware(const uint8_t* protocolAddress);
+    /// @param request Broadcast a request for an address that is not cached
+    const uint8_t* Protocol2Hardware(const uint8_t* protocolAddress, bool request = true);
     bool IsLocal(const uint8_t* protocolAddress);
     bool IsBroadcast(const uint8_t* protocolAddress);
 
@@ -91,12 +105,15 @@ private:
     void SendRequest(const uint8_t* targetIP);
     int LocateProtocolAddress(const uint8_t* protocolAddress);
 
-    DataBuffer ARPRequest;
-
     ARPCacheEntry Cache[ARPCacheSize];
+    osMutex CacheLock;
+
+    AddHandler AddedHandler;
+    void* AddedParam;
 
     InterfaceMAC& MAC;
     ProtocolIPv4& IP;
+    osTimerWheel& Timers;
 
     ProtocolARP();
     ProtocolARP(ProtocolARP&);
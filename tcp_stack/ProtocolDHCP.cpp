@@ -50,14 +50,28 @@ void ProtocolDHCP::test()
     printf("discover sent\n");
 }
 
-ProtocolDHCP::ProtocolDHCP(InterfaceMAC& mac, ProtocolIPv4& ip, ProtocolUDP& udp)
+ProtocolDHCP::ProtocolDHCP(InterfaceMAC& mac,
+                           ProtocolIPv4& ip,
+                           ProtocolUDP& udp,
+                           osTimerWheel& timers)
     : PendingXID(-1)
+    , RenewTimer("dhcp renew", RenewTimeout, this)
+    , ServerAddress{0, 0, 0, 0}
+    , LeaseAddress{0, 0, 0, 0}
     , MAC(mac)
     , IP(ip)
     , UDP(udp)
+    , Timers(timers)
 {
 }
 
+void ProtocolDHCP::RenewTimeout(void* param)
+{
+    ProtocolDHCP* dhcp = (ProtocolDHCP*)param;
+    printf("DHCP renewing lease\n");
+    dhcp->SendRequest(3, dhcp->ServerAddress, dhcp->LeaseAddress);
+}
+
 void ProtocolDHCP::ProcessRx(DataBuffer* buffer)
 {
     uint8_t op = Unpack8(buffer->Packet, 0);
@@ -116,7 +130,7 @@ void ProtocolDHCP::ProcessRx(DataBuffer* buffer)
     // Parse Options
     size_t offset = 240;
     uint8_t optionData[255];
-    ProtocolIPv4::AddressInfo ipv4Data;
+    ProtocolIPv4::AddressInfo ipv4Data = {};
     uint8_t dhcpType = 0xFF;
     while (offset < buffer->Remainder)
     {
@@ -190,6 +204,22 @@ void ProtocolDHCP::ProcessRx(DataBuffer* buffer)
             IP.SetAddressInfo(ipv4Data);
             const uint8_t* addr = IP.GetUnicastAddress();
             printf("DHCP got address %d.%d.%d.%d\n", addr[0], addr[1], addr[2], addr[3]);
+
+            // T1 defaults to half the lease when the server does not send it
+            uint32_t renew_s = ipv4Data.RenewTime;
+            if (renew_s == 0)
+            {
+                renew_s = ipv4Data.IpAddressLeaseTime / 2;
+            }
+            if (renew_s != 0)
+            {
+                for (int i = 0; i < 4; i++)
+                {
+                    ServerAddress[i] = siaddr[i];
+                    LeaseAddress[i] = yiaddr[i];
+                }
+                Timers.Start(&RenewTimer, (uint64_t)renew_s * 1000000);
+            }
             break;
         }
         case 6: // nak
@@ -224,7 +254,7 @@ void ProtocolDHCP::ProcessRx(DataBuffer* buffer)
 
 void ProtocolDHCP::Discover()
 {
-    DataBuffer* buffer = UDP.GetTxBuffer(&MAC);
+    DataBuffer* buffer = UDP.GetTxBuffer(&MAC, MESSAGE_SIZE);
     size_t i;
 
     if (buffer)
@@ -309,7 +339,7 @@ void ProtocolDHCP::SendRequest(uint8_t messageType,
                                const uint8_t* serverAddress,
                                const uint8_t* requestAddress)
 {
-    DataBuffer* buffer = UDP.GetTxBuffer(&MAC);
+    DataBuffer* buffer = UDP.GetTxBuffer(&MAC, MESSAGE_SIZE);
     int i;
 
     if (buffer)
@@ -34,6 +34,7 @@
 #include <inttypes.h>
 
 #include "DataBuffer.hpp"
+#include "osTimerWheel.hpp"
 
 class InterfaceMAC;
 class ProtocolIPv4;
@@ -45,7 +46,7 @@ class ProtocolUDP;
 class ProtocolDHCP
 {
 public:
-    ProtocolDHCP(InterfaceMAC& mac, ProtocolIPv4& ip, ProtocolUDP& udp);
+    ProtocolDHCP(InterfaceMAC& mac, ProtocolIPv4& ip, ProtocolUDP& udp, osTimerWheel& timers);
     void ProcessRx(DataBuffer* buffer);
     void Discover();
     void SendRequest(uint8_t messageType,
@@ -54,10 +55,20 @@ public:
     void test();
 
 private:
+    // Fixed BOOTP fields plus the options sent
+    static const size_t MESSAGE_SIZE = 300;
+
     DataBuffer Buffer;
     int PendingXID;
 
+    // Renews the lease from the server that granted it at the renewal time (T1)
+    osTimer RenewTimer;
+    uint8_t ServerAddress[4];
+    uint8_t LeaseAddress[4];
+    static void RenewTimeout(void* param);
+
     InterfaceMAC& MAC;
     ProtocolIPv4& IP;
     ProtocolUDP& UDP;
+    osTimerWheel& Timers;
 };
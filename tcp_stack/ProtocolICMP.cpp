@@ -58,7 +58,7 @@ void ProtocolICMP::ProcessRx(DataBuffer* buffer, const uint8_t* remoteIP, const
     switch (type)
     {
     case 8: // echo request
-        txBuffer = IP.GetTxBuffer(buffer->MAC);
+        txBuffer = IP.GetTxBuffer(buffer->MAC, buffer->Length);
         if (txBuffer && buffer->Length <= txBuffer->Remainder)
         {
             for (i = 0; i < buffer->Length; i++)
@@ -56,8 +56,10 @@
 ProtocolIPv4::ProtocolIPv4(
     InterfaceMAC& mac, ProtocolARP& arp, ProtocolICMP& icmp, ProtocolTCP& tcp, ProtocolUDP& udp)
     : PacketID(0)
-    , UnresolvedQueue("IP", TX_BUFFER_COUNT, TxBuffer)
+    , UnresolvedQueue()
     , Address()
+    , AddressHandler(nullptr)
+    , AddressParam(nullptr)
     , MAC(mac)
     , ARP(arp)
     , ICMP(icmp)
@@ -124,11 +126,11 @@ void ProtocolIPv4::ProcessRx(DataBuffer* buffer)
     }
 }
 
-DataBuffer* ProtocolIPv4::GetTxBuffer(InterfaceMAC* mac)
+DataBuffer* ProtocolIPv4::GetTxBuffer(InterfaceMAC* mac, size_t size, bool wait)
 {
     DataBuffer* buffer;
 
-    buffer = mac->GetTxBuffer();
+    buffer = mac->GetTxBuffer(size + header_size(), wait);
     if (buffer != nullptr)
     {
         buffer->Packet += header_size();
@@ -153,7 +155,7 @@ void ProtocolIPv4::Transmit(DataBuffer* buffer,
 
     packet[0] = 0x45; // Version and HeaderSize
     packet[1] = 0;    // ToS
-    Pack16(packet, 2, buffer->Length);
+    Pack16(packet, 2, buffer->ChainLength());
 
     PacketID++;
     Pack16(packet, 4, PacketID);
@@ -166,23 +168,49 @@ void ProtocolIPv4::Transmit(DataBuffer* buffer,
     PackBytes(packet, 12, sourceIP, 4);
     PackBytes(packet, 16, targetIP, 4);
 
-    checksum = FCS::Checksum(packet, 20);
-    Pack16(packet, 10, checksum);
+    if ((MAC.GetChecksumOffload() & InterfaceMAC::OFFLOAD_TX_IPV4_CHECKSUM) == 0)
+    {
+        checksum = FCS::Checksum(packet, 20);
+        Pack16(packet, 10, checksum);
+    }
 
-    targetMAC = ARP.Protocol2Hardware(targetIP);
+    targetMAC = ARP.Protocol2Hardware(targetIP, false);
     if (targetMAC != nullptr)
     {
         MAC.Transmit(buffer, targetMAC, 0x0800);
     }
     else
     {
-        // Could not find MAC address, ARP for it
-        UnresolvedQueue.Put(buffer);
+        // Could not find MAC address, ARP for it. Queued first so a reply that is processed
+        // before the request call returns still finds the datagram.
+        if (!UnresolvedQueue.Put(buffer))
+        {
+            printf("Too many datagrams waiting on ARP\n");
+            MAC.FreeTxBuffer(buffer);
+            return;
+        }
+        if (ARP.Protocol2Hardware(targetIP) != nullptr)
+        {
+            // Resolved since the first look
+            Retry();
+        }
     }
 }
 
 void ProtocolIPv4::Retransmit(DataBuffer* buffer)
 {
+    // Give the retransmitted datagram a new Identification, patching the header checksum
+    // rather than recomputing it
+    uint8_t* packet = buffer->Packet + MAC.HeaderSize();
+    uint16_t id = Unpack16(packet, 4);
+
+    PacketID++;
+    Pack16(packet, 4, PacketID);
+    if ((MAC.GetChecksumOffload() & InterfaceMAC::OFFLOAD_TX_IPV4_CHECKSUM) == 0)
+    {
+        Pack16(packet, 10, FCS::ChecksumUpdate16(Unpack16(packet, 10), id, PacketID));
+    }
+
     MAC.Retransmit(buffer);
 }
 
@@ -192,11 +220,11 @@ void ProtocolIPv4::Retry()
     DataBuffer* buffer;
     const uint8_t* targetMAC;
 
+    // Several threads may retry at once, each takes what it can get of the datagrams queued
+    // when it started
     count = UnresolvedQueue.GetCount();
-    for (int i = 0; i < count; i++)
+    for (int i = 0; i < count && UnresolvedQueue.Get(buffer); i++)
     {
-        buffer = (DataBuffer*)UnresolvedQueue.Get();
-
         targetMAC = ARP.Protocol2Hardware(&buffer->Packet[16]);
         if (targetMAC != nullptr)
         {
@@ -205,7 +233,10 @@ void ProtocolIPv4::Retry()
         else
         {
             printf("Still could not find MAC for IP\n");
-            UnresolvedQueue.Put(buffer);
+            if (!UnresolvedQueue.Put(buffer))
+            {
+                MAC.FreeTxBuffer(buffer);
+            }
         }
     }
 }
@@ -231,6 +262,7 @@ std::ostream& operator<<(std::ostream& out, const ProtocolIPv4& obj)
     out << "   Address Lease Time: " << obj.Address.IpAddressLeaseTime << " seconds\n";
     out << "   RenewTime:          " << obj.Address.RenewTime << " seconds\n";
     out << "   RebindTime:         " << obj.Address.RebindTime << " seconds\n";
+    out << "   Waiting on ARP:     " << obj.GetUnresolvedCount() << " datagrams\n";
     return out;
 }
 
@@ -259,7 +291,22 @@ const uint8_t* ProtocolIPv4::GetSubnetMask()
     return Address.SubnetMask;
 }
 
+const ProtocolIPv4::AddressInfo& ProtocolIPv4::GetAddressInfo() const
+{
+    return Address;
+}
+
 void ProtocolIPv4::SetAddressInfo(const AddressInfo& info)
 {
     Address = info;
+    if (AddressHandler)
+    {
+        AddressHandler(AddressParam, Address);
+    }
+}
+
+void ProtocolIPv4::RegisterAddressInfoHandler(AddressInfoHandler handler, void* param)
+{
+    AddressParam = param;
+    AddressHandler = handler;
 }
@@ -36,7 +36,7 @@
 
 #include "DataBuffer.hpp"
 #include "InterfaceMAC.hpp"
-#include "osQueue.hpp"
+#include "osRing.hpp"
 
 class ProtocolARP;
 class ProtocolICMP;
@@ -63,6 +63,10 @@ public:
         uint8_t BroadcastAddress[ADDRESS_SIZE];
     };
 
+    /// Told of each SetAddressInfo, DHCP's included, with the param given to
+    /// RegisterAddressInfoHandler
+    typedef void (*AddressInfoHandler)(void* param, const AddressInfo& info);
+
     ProtocolIPv4(InterfaceMAC&, ProtocolARP&, ProtocolICMP&, ProtocolTCP&, ProtocolUDP&);
     void Initialize();
 
@@ -72,15 +76,21 @@ public:
     void Retransmit(DataBuffer*);
 
     void Retry();
+    /// @return Datagrams waiting on ARP
+    size_t GetUnresolvedCount() const { return UnresolvedQueue.GetCount(); }
 
     size_t AddressSize();
     const uint8_t* GetUnicastAddress();
     const uint8_t* GetBroadcastAddress();
     const uint8_t* GetGatewayAddress();
     const uint8_t* GetSubnetMask();
+    const AddressInfo& GetAddressInfo() const;
     void SetAddressInfo(const AddressInfo& info);
+    void RegisterAddressInfoHandler(AddressInfoHandler, void* param);
+    /// @return true if addr is this host's address or a broadcast it listens to
+    bool IsLocal(const uint8_t* addr);
 
-    DataBuffer* GetTxBuffer(InterfaceMAC*);
+    DataBuffer* GetTxBuffer(InterfaceMAC*, size_t size, bool wait = true);
     void FreeTxBuffer(DataBuffer*);
     void FreeRxBuffer(DataBuffer*);
 
@@ -89,13 +99,13 @@ public:
     friend std::ostream& operator<<(std::ostream&, const ProtocolIPv4&);
 
 private:
-    bool IsLocal(const uint8_t* addr);
-
     uint16_t PacketID;
-    void* TxBuffer[TX_BUFFER_COUNT];
-    osQueue UnresolvedQueue;
+    // Datagrams waiting on ARP
+    osRing<DataBuffer*, osRingSize(TX_BUFFER_COUNT)> UnresolvedQueue;
 
     AddressInfo Address;
+    AddressInfoHandler AddressHandler;
+    void* AddressParam;
 
     InterfaceMAC& MAC;
     ProtocolARP& ARP;
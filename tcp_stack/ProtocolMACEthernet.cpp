@@ -29,9 +29,11 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //----------------------------------------------------------------------------
 
+#include <cstring>
 #include <iostream>
 #include <stdio.h>
 
+#include "FCS.hpp"
 #include "ProtocolARP.hpp"
 #include "ProtocolIPv4.hpp"
 #include "ProtocolMACEthernet.hpp"
@@ -42,35 +44,58 @@
 // FrameType - 2 bytes
 
 ProtocolMACEthernet::ProtocolMACEthernet(ProtocolARP& arp, ProtocolIPv4& ipv4)
-    : TxBufferQueue("Tx", TX_BUFFER_COUNT, TxBufferBuffer)
-    , RxBufferQueue("Rx", RX_BUFFER_COUNT, RxBufferBuffer)
+    : TxSmallPool("TxSmall")
+    , TxMTUPool("TxMTU")
+    , TxJumboPool("TxJumbo")
+    , RxSmallPool("RxSmall")
+    , RxMTUPool("RxMTU")
+    , RxJumboPool("RxJumbo")
+    , TxPools{&TxSmallPool, &TxMTUPool, &TxJumboPool}
+    , RxPools{&RxSmallPool, &RxMTUPool, &RxJumboPool}
     , QueueEmptyEvent("MACEthernet")
     , TxHandler(nullptr)
+    , BufferTxHandler(nullptr)
+    , TxFlushHandler(nullptr)
+    , AddressHandler(nullptr)
+    , ChecksumOffload(0)
+    , DropCount{}
     , ARP(arp)
     , IPv4(ipv4)
 {
-    int i;
-
     BroadcastAddress[0] = 0xFF;
     BroadcastAddress[1] = 0xFF;
     BroadcastAddress[2] = 0xFF;
     BroadcastAddress[3] = 0xFF;
     BroadcastAddress[4] = 0xFF;
     BroadcastAddress[5] = 0xFF;
+}
 
-    for (i = 0; i < TX_BUFFER_COUNT; i++)
-    {
-        TxBufferQueue.Put(&TxBuffer[i]);
-    }
-    for (i = 0; i < RX_BUFFER_COUNT; i++)
+void ProtocolMACEthernet::RegisterDataTransmitHandler(DataTransmitHandler handler)
+{
+    TxHandler = handler;
+}
+
+void ProtocolMACEthernet::RegisterBufferTransmitHandler(BufferTransmitHandler handler)
+{
+    BufferTxHandler = handler;
+}
+
+void ProtocolMACEthernet::RegisterTransmitFlushHandler(TransmitFlushHandler handler)
+{
+    TxFlushHandler = handler;
+}
+
+void ProtocolMACEthernet::FlushTx()
+{
+    if (TxFlushHandler)
     {
-        RxBufferQueue.Put(&RxBuffer[i]);
+        TxFlushHandler();
     }
 }
 
-void ProtocolMACEthernet::RegisterDataTransmitHandler(DataTransmitHandler handler)
+void ProtocolMACEthernet::RegisterAddressChangeHandler(AddressChangeHandler handler)
 {
-    TxHandler = handler;
+    AddressHandler = handler;
 }
 
 bool ProtocolMACEthernet::IsLocalAddress(const uint8_t* addr)
@@ -78,83 +103,196 @@ bool ProtocolMACEthernet::IsLocalAddress(const uint8_t* addr)
     return AddressCompare(UnicastAddress, addr, 6) || AddressCompare(BroadcastAddress, addr, 6);
 }
 
-void ProtocolMACEthernet::ProcessRx(uint8_t* buffer, int actualLength)
+bool ProtocolMACEthernet::Classify(const uint8_t* frame, int length)
 {
-    uint16_t type;
-    DataBuffer* packet = (DataBuffer*)RxBufferQueue.Get();
-    int i;
-    int length =
-        (DATA_BUFFER_PAYLOAD_SIZE < actualLength ? DATA_BUFFER_PAYLOAD_SIZE : actualLength);
+    DropReason reason = DROP_REASON_COUNT;
 
+    if (length < (int)header_size())
+    {
+        reason = DROP_RUNT;
+    }
+    else if (!IsLocalAddress(frame))
+    {
+        reason = DROP_NOT_LOCAL_MAC;
+    }
+    else
+    {
+        const uint8_t* ip = &frame[header_size()];
+        switch (Unpack16(frame, 12))
+        {
+        case 0x0800: // IP
+            if (length < (int)(header_size() + ProtocolIPv4::header_size()) ||
+                (ip[0] >> 4) != 4 || (ip[0] & 0x0F) * 4 < (int)ProtocolIPv4::header_size())
+            {
+                reason = DROP_RUNT;
+            }
+            else if (!IPv4.IsLocal(&ip[16]))
+            {
+                reason = DROP_NOT_LOCAL_IP;
+            }
+            else if (ip[9] != 0x01 && ip[9] != 0x06 && ip[9] != 0x11)
+            {
+                // ICMP, TCP and UDP are handled
+                reason = DROP_IP_PROTOCOL;
+            }
+            break;
+        case 0x0806: // ARP
+            break;
+        default:
+            reason = DROP_ETHERTYPE;
+            break;
+        }
+    }
+
+    if (reason != DROP_REASON_COUNT)
+    {
+        DropCount[reason]++;
+    }
+    return reason == DROP_REASON_COUNT;
+}
+
+uint64_t ProtocolMACEthernet::GetDropCount(DropReason reason) const
+{
+    return reason < DROP_REASON_COUNT ? DropCount[reason] : 0;
+}
+
+const char* ProtocolMACEthernet::GetDropReasonName(DropReason reason)
+{
+    const char* rc = "unknown";
+    switch (reason)
+    {
+    case DROP_RUNT: rc = "runt"; break;
+    case DROP_NOT_LOCAL_MAC: rc = "not local MAC"; break;
+    case DROP_ETHERTYPE: rc = "ethertype"; break;
+    case DROP_NOT_LOCAL_IP: rc = "not local IP"; break;
+    case DROP_IP_PROTOCOL: rc = "IP protocol"; break;
+    case DROP_OVERSIZE: rc = "oversize"; break;
+    case DROP_NO_BUFFER: rc = "no buffer"; break;
+    case DROP_REASON_COUNT: break;
+    }
+    return rc;
+}
+
+void ProtocolMACEthernet::ProcessRx(uint8_t* buffer, int length, bool checksumVerified)
+{
+    DataBuffer* packet;
+
+    // Frames nobody wants never cost a buffer or a copy
+    if (!Classify(buffer, length))
+    {
+        return;
+    }
+
+    if (length > RxPools[POOL_COUNT - 1]->GetBufferSize())
+    {
+        DropCount[DROP_OVERSIZE]++;
+        return;
+    }
+
+    packet = GetRxBuffer(length);
     if (packet == nullptr)
     {
+        DropCount[DROP_NO_BUFFER]++;
         printf("ProtocolMACEthernet::ProcessRx Out of receive buffers\n");
         return;
     }
 
-    if (length > DATA_BUFFER_PAYLOAD_SIZE)
+    memcpy(packet->Packet, buffer, length);
+    packet->Length = length;
+    packet->ChecksumVerified = checksumVerified;
+
+    Dispatch(packet);
+}
+
+void ProtocolMACEthernet::ProcessRx(DataBuffer* packet)
+{
+    if (packet->Classified || Classify(packet->Packet, packet->Length))
     {
-        // printf("ProtocolMACEthernet::ProcessRx Rx data overrun %d, %d\n",
-        //        length,
-        //        DATA_BUFFER_PAYLOAD_SIZE);
-        RxBufferQueue.Put(packet);
-        return;
+        Dispatch(packet);
+    }
+    else
+    {
+        FreeRxBuffer(packet);
     }
+}
 
-    packet->Initialize(this);
+void ProtocolMACEthernet::Dispatch(DataBuffer* packet)
+{
+    uint16_t type;
 
-    for (i = 0; i < length; i++)
+    if ((ChecksumOffload & OFFLOAD_RX_CHECKSUM) != 0)
     {
-        packet->Packet[i] = buffer[i];
+        packet->ChecksumVerified = true;
     }
-    packet->Length = length;
 
     type = Unpack16(packet->Packet, 12);
 
-    // Check if the MAC Address is destined for me
-    if (IsLocalAddress(packet->Packet))
+    packet->Packet += header_size();
+    packet->Length -= header_size();
+
+    switch (type)
     {
-        // DumpData( buffer, length, printf );
-        if (actualLength > length)
-        {
-            // printf("ProtocolMACEthernet::ProcessRx Rx data overrun %d, %d\n",
-            //        length,
-            //        DATA_BUFFER_PAYLOAD_SIZE);
-            // printf("Unicast type 0x%04X\n", type);
-            RxBufferQueue.Put(packet);
-            return;
-        }
-        // Unicast
-        packet->Packet += header_size();
-        packet->Length -= header_size();
+    case 0x0800: // IP
+        IPv4.ProcessRx(packet);
+        break;
+    case 0x0806: // ARP
+        ARP.ProcessRx(packet);
+        break;
+    }
+
+    FreeRxBuffer(packet);
+}
 
-        switch (type)
+DataBuffer* ProtocolMACEthernet::GetBuffer(DataBufferPool** pools, size_t size)
+{
+    DataBuffer* buffer = nullptr;
+
+    // Take from the smallest class that fits, falling back to the larger classes when empty
+    for (int i = 0; i < POOL_COUNT && buffer == nullptr; i++)
+    {
+        if (pools[i]->GetBufferSize() >= size)
         {
-        case 0x0800: // IP
-            IPv4.ProcessRx(packet);
-            break;
-        case 0x0806: // ARP
-            ARP.ProcessRx(packet);
-            break;
-        default:
-            // printf( "Unsupported Unicast type 0x%04X\n", type );
-            break;
+            buffer = pools[i]->Get();
         }
     }
 
-    if (packet->Disposable)
+    return buffer;
+}
+
+DataBuffer* ProtocolMACEthernet::GetRxBuffer(size_t size)
+{
+    DataBuffer* buffer = nullptr;
+
+    if (size <= RxPools[POOL_COUNT - 1]->GetBufferSize())
     {
-        RxBufferQueue.Put(packet);
+        buffer = GetBuffer(RxPools, size);
+        if (buffer != nullptr)
+        {
+            buffer->Initialize(this);
+        }
     }
+
+    return buffer;
 }
 
-DataBuffer* ProtocolMACEthernet::GetTxBuffer()
+DataBuffer* ProtocolMACEthernet::GetTxBuffer(size_t size, bool wait)
 {
     DataBuffer* buffer;
 
-    while ((buffer = (DataBuffer*)TxBufferQueue.Get()) == nullptr)
+    size += header_size();
+    if (size > TxPools[POOL_COUNT - 1]->GetBufferSize())
     {
-        QueueEmptyEvent.Wait(__FILE__, __LINE__);
+        printf("ProtocolMACEthernet::GetTxBuffer no buffer holds %zu bytes\n", size);
+        return nullptr;
+    }
+
+    buffer = GetBuffer(TxPools, size);
+    if (buffer == nullptr && wait)
+    {
+        // Buffers queued by a batching link come back once they are sent
+        FlushTx();
+        QueueEmptyEvent.Wait(
+            __FILE__, __LINE__, [&]() { return (buffer = GetBuffer(TxPools, size)) != nullptr; });
     }
     if (buffer != nullptr)
     {
@@ -168,13 +306,28 @@ DataBuffer* ProtocolMACEthernet::GetTxBuffer()
 
 void ProtocolMACEthernet::FreeTxBuffer(DataBuffer* buffer)
 {
-    TxBufferQueue.Put(buffer);
+    FreeChain(buffer);
     QueueEmptyEvent.Notify();
 }
 
 void ProtocolMACEthernet::FreeRxBuffer(DataBuffer* buffer)
 {
-    RxBufferQueue.Put(buffer);
+    FreeChain(buffer);
+}
+
+void ProtocolMACEthernet::FreeChain(DataBuffer* buffer)
+{
+    // A reference to a segment holds the rest of the chain after it
+    while (buffer != nullptr && buffer->Release() == 0)
+    {
+        DataBuffer* next = buffer->Next;
+        buffer->Next = nullptr;
+        if (buffer->Pool != nullptr)
+        {
+            buffer->Pool->Put(buffer);
+        }
+        buffer = next;
+    }
 }
 
 void ProtocolMACEthernet::Transmit(DataBuffer* buffer, const uint8_t* targetMAC, uint16_t type)
@@ -187,34 +340,83 @@ void ProtocolMACEthernet::Transmit(DataBuffer* buffer, const uint8_t* targetMAC,
     offset = PackBytes(buffer->Packet, offset, UnicastAddress, 6);
     offset = Pack16(buffer->Packet, offset, type);
 
-    offset += buffer->Length;
-    while (buffer->Length < 60)
+    // A chained frame is padded when it is gathered, if the link needs that
+    while (buffer->Next == nullptr && buffer->Length < 60)
     {
         buffer->Packet[buffer->Length++] = 0;
     }
 
-    if (TxHandler)
+    SendFrame(buffer);
+    FreeTxBuffer(buffer);
+}
+
+void ProtocolMACEthernet::Retransmit(DataBuffer* buffer)
+{
+    SendFrame(buffer);
+}
+
+void ProtocolMACEthernet::SendFrame(DataBuffer* buffer)
+{
+    if (BufferTxHandler)
     {
-        TxHandler(buffer->Packet, buffer->Length);
+        BufferTxHandler(buffer);
     }
-
-    if (buffer->Disposable)
+    else if (TxHandler)
     {
-        TxBufferQueue.Put(buffer);
+        DataBuffer* frame = buffer;
+        if (buffer->Next != nullptr)
+        {
+            // The raw handler takes one contiguous frame
+            frame = Gather(buffer);
+            if (frame == nullptr)
+            {
+                printf("ProtocolMACEthernet::SendFrame Out of tx buffers\n");
+                return;
+            }
+        }
+        if (frame->ChecksumNeeded)
+        {
+            // The raw handler has no way to pass the request on so do it in software. The
+            // checksum field holds the pseudo header sum so the whole range is summed.
+            uint8_t* start = frame->Packet + frame->GetChecksumStart();
+            int length = (frame->Packet + frame->Length) - start;
+            uint32_t sum = FCS::ChecksumAddAt(start, length, 0, 0);
+            Pack16(start, frame->GetChecksumOffset(), FCS::ChecksumComplete(sum));
+            frame->ChecksumNeeded = false;
+        }
+        TxHandler(frame->Packet, frame->Length);
+        if (frame != buffer)
+        {
+            FreeTxBuffer(frame);
+        }
     }
 }
 
-void ProtocolMACEthernet::Retransmit(DataBuffer* buffer)
+DataBuffer* ProtocolMACEthernet::Gather(DataBuffer* buffer)
 {
-    if (TxHandler)
-    {
-        TxHandler(buffer->Packet, buffer->Length);
-    }
+    size_t length = buffer->ChainLength();
+    DataBuffer* frame = GetBuffer(TxPools, (length < 60 ? 60 : length));
 
-    if (buffer->Disposable)
+    if (frame != nullptr)
     {
-        TxBufferQueue.Put(buffer);
+        frame->Initialize(this);
+        for (DataBuffer* segment = buffer; segment != nullptr; segment = segment->Next)
+        {
+            memcpy(&frame->Packet[frame->Length], segment->Packet, segment->Length);
+            frame->Length += segment->Length;
+        }
+        while (frame->Length < 60)
+        {
+            frame->Packet[frame->Length++] = 0;
+        }
+        if (buffer->ChecksumNeeded)
+        {
+            frame->RequestChecksum(frame->Packet + buffer->GetChecksumStart(),
+                                   buffer->GetChecksumOffset());
+        }
     }
+
+    return frame;
 }
 
 size_t ProtocolMACEthernet::AddressSize() const
@@ -237,11 +439,37 @@ const uint8_t* ProtocolMACEthernet::GetBroadcastAddress() const
     return BroadcastAddress;
 }
 
+uint32_t ProtocolMACEthernet::GetChecksumOffload() const
+{
+    return ChecksumOffload;
+}
+
+void ProtocolMACEthernet::SetChecksumOffload(uint32_t offload)
+{
+    ChecksumOffload = offload;
+}
+
 std::ostream& operator<<(std::ostream& out, const ProtocolMACEthernet& obj)
 {
     out << "MAC Configuration\n";
     out << "   Ethernet Unicast MAC Address: " << macaddrtoa(obj.GetUnicastAddress()) << "\n";
     out << "   Ethernet Broadcast MAC Address: " << macaddrtoa(obj.GetBroadcastAddress()) << "\n";
+    for (int i = 0; i < 2 * ProtocolMACEthernet::POOL_COUNT; i++)
+    {
+        DataBufferPool* pool = (i < ProtocolMACEthernet::POOL_COUNT
+                                    ? obj.TxPools[i]
+                                    : obj.RxPools[i - ProtocolMACEthernet::POOL_COUNT]);
+        out << "   " << pool->GetName() << " " << pool->GetBufferSize() << " byte buffers, ";
+        out << pool->GetCount() << " of " << pool->GetCapacity() << " free, ";
+        out << "not counting thread caches\n";
+    }
+    out << "   Receive drops\n";
+    for (int i = 0; i < ProtocolMACEthernet::DROP_REASON_COUNT; i++)
+    {
+        ProtocolMACEthernet::DropReason reason = (ProtocolMACEthernet::DropReason)i;
+        out << "      " << ProtocolMACEthernet::GetDropReasonName(reason) << ": ";
+        out << obj.GetDropCount(reason) << "\n";
+    }
     return out;
 }
 
@@ -251,4 +479,8 @@ void ProtocolMACEthernet::SetUnicastAddress(uint8_t* addr)
     {
         UnicastAddress[i] = addr[i];
     }
+    if (AddressHandler)
+    {
+        AddressHandler(UnicastAddress);
+    }
 }
@@ -34,9 +34,9 @@
 #include <inttypes.h>
 
 #include "DataBuffer.hpp"
+#include "DataBufferPool.hpp"
 #include "InterfaceMAC.hpp"
 #include "osEvent.hpp"
-#include "osQueue.hpp"
 
 class ProtocolARP;
 class ProtocolIPv4;
@@ -44,15 +44,45 @@ class ProtocolIPv4;
 class ProtocolMACEthernet : public InterfaceMAC
 {
 public:
+    /// Why a received frame was dropped before it reached a protocol
+    enum DropReason
+    {
+        DROP_RUNT,          // Shorter than the headers it carries
+        DROP_NOT_LOCAL_MAC, // Addressed to another station
+        DROP_ETHERTYPE,     // Neither IPv4 nor ARP
+        DROP_NOT_LOCAL_IP,  // IPv4 addressed to another host
+        DROP_IP_PROTOCOL,   // IPv4 protocol with no handler
+        DROP_OVERSIZE,      // Larger than the largest receive buffer
+        DROP_NO_BUFFER,     // Receive pools empty
+        DROP_REASON_COUNT
+    };
+
     ProtocolMACEthernet(ProtocolARP&, ProtocolIPv4&);
     void RegisterDataTransmitHandler(DataTransmitHandler);
-
-    void ProcessRx(uint8_t* buffer, int length);
+    void RegisterBufferTransmitHandler(BufferTransmitHandler);
+    void RegisterTransmitFlushHandler(TransmitFlushHandler);
+    void FlushTx();
+    void RegisterAddressChangeHandler(AddressChangeHandler);
+
+    /// @param checksumVerified The link validated the checksums of this frame
+    void ProcessRx(uint8_t* buffer, int length, bool checksumVerified = false);
+    /// @brief Process a frame received directly into a buffer from GetRxBuffer, Length holds
+    /// the frame length. Takes over the reference to the buffer.
+    void ProcessRx(DataBuffer* buffer);
+
+    /// @brief Check the headers of a received frame in place, counting it against its drop
+    /// reason when no protocol would take it. ProcessRx classifies every frame before it
+    /// takes a receive buffer, unless the link already did and marked it Classified.
+    /// @return true if the frame is for this stack
+    bool Classify(const uint8_t* frame, int length);
+    uint64_t GetDropCount(DropReason) const;
+    static const char* GetDropReasonName(DropReason);
 
     void Transmit(DataBuffer*, const uint8_t* targetMAC, uint16_t type);
     void Retransmit(DataBuffer* buffer);
 
-    DataBuffer* GetTxBuffer();
+    DataBuffer* GetTxBuffer(size_t size, bool wait = true);
+    DataBuffer* GetRxBuffer(size_t size);
     void FreeTxBuffer(DataBuffer*);
     void FreeRxBuffer(DataBuffer*);
 
@@ -62,32 +92,50 @@ public:
     const uint8_t* GetUnicastAddress() const;
     const uint8_t* GetBroadcastAddress() const;
 
+    uint32_t GetChecksumOffload() const;
+    void SetChecksumOffload(uint32_t offload);
+
     void SetUnicastAddress(uint8_t* addr);
     static size_t header_size() { return 14; }
+    // Buffer size classes, each has a transmit and a receive pool
+    static const int POOL_COUNT = 3;
 
     friend std::ostream& operator<<(std::ostream&, const ProtocolMACEthernet&);
 
 private:
     static const int ADDRESS_SIZE = 6;
-    osQueue TxBufferQueue;
-    osQueue RxBufferQueue;
+
+    StaticDataBufferPool<DATA_BUFFER_SMALL_SIZE, TX_SMALL_BUFFER_COUNT> TxSmallPool;
+    StaticDataBufferPool<DATA_BUFFER_MTU_SIZE, TX_MTU_BUFFER_COUNT> TxMTUPool;
+    StaticDataBufferPool<DATA_BUFFER_JUMBO_SIZE, TX_JUMBO_BUFFER_COUNT> TxJumboPool;
+    StaticDataBufferPool<DATA_BUFFER_SMALL_SIZE, RX_SMALL_BUFFER_COUNT> RxSmallPool;
+    StaticDataBufferPool<DATA_BUFFER_MTU_SIZE, RX_MTU_BUFFER_COUNT> RxMTUPool;
+    StaticDataBufferPool<DATA_BUFFER_JUMBO_SIZE, RX_JUMBO_BUFFER_COUNT> RxJumboPool;
+
+    // Ordered smallest to largest
+    DataBufferPool* TxPools[POOL_COUNT];
+    DataBufferPool* RxPools[POOL_COUNT];
 
     osEvent QueueEmptyEvent;
 
     uint8_t UnicastAddress[ADDRESS_SIZE];
     uint8_t BroadcastAddress[ADDRESS_SIZE];
 
-    DataBuffer TxBuffer[TX_BUFFER_COUNT];
-    DataBuffer RxBuffer[RX_BUFFER_COUNT];
-
-    void* TxBufferBuffer[TX_BUFFER_COUNT];
-    void* RxBufferBuffer[RX_BUFFER_COUNT];
-
     DataTransmitHandler TxHandler;
+    BufferTransmitHandler BufferTxHandler;
+    TransmitFlushHandler TxFlushHandler;
+    AddressChangeHandler AddressHandler;
+    uint32_t ChecksumOffload;
+    uint64_t DropCount[DROP_REASON_COUNT];
     ProtocolARP& ARP;
     ProtocolIPv4& IPv4;
 
     bool IsLocalAddress(const uint8_t* addr);
+    void Dispatch(DataBuffer*);
+    static DataBuffer* GetBuffer(DataBufferPool** pools, size_t size);
+    void SendFrame(DataBuffer*);
+    DataBuffer* Gather(DataBuffer*);
+    void FreeChain(DataBuffer*);
 
     ProtocolMACEthernet(ProtocolMACEthernet&);
     ProtocolMACEthernet();
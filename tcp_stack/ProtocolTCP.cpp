@@ -42,8 +42,10 @@
 #include "osMutex.hpp"
 #include "osTime.hpp"
 
-ProtocolTCP::ProtocolTCP(ProtocolIPv4& ip)
-    : IP(ip)
+ProtocolTCP::ProtocolTCP(ProtocolIPv4& ip, osTimerWheel& timers)
+    : ConnectionLock("ConnectionLock")
+    , IP(ip)
+    , Timers(timers)
 {
     for (int i = 0; i < TCP_MAX_CONNECTIONS; i++)
     {
@@ -71,7 +73,14 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
     uint32_t SequenceNumber;
     uint32_t AcknowledgementNumber;
 
-    checksum = ComputeChecksum(packet, length, sourceIP, targetIP);
+    if (rxBuffer->ChecksumVerified)
+    {
+        checksum = 0;
+    }
+    else
+    {
+        checksum = ComputeChecksum(packet, length, sourceIP, targetIP);
+    }
 
     if (checksum == 0)
     {
@@ -105,13 +114,15 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
                 if (SYN)
                 {
                     // Need a closed connection to work with
-                    TCPConnection* tmp = NewClient(rxBuffer->MAC, sourceIP, remotePort, localPort);
+                    TCPConnection* tmp = NewClient(rxBuffer->MAC,
+                                                   sourceIP,
+                                                   remotePort,
+                                                   localPort,
+                                                   TCPConnection::SYN_RECEIVED);
                     if (tmp != nullptr)
                     {
-                        tmp->Allocate(rxBuffer->MAC);
                         tmp->Parent = connection;
                         connection = tmp;
-                        connection->State = TCPConnection::SYN_RECEIVED;
                         connection->AcknowledgementNumber = SequenceNumber;
                         connection->LastAck = connection->AcknowledgementNumber;
                         connection->AcknowledgementNumber++; // SYN flag consumes a sequence number
@@ -125,20 +136,28 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
                 }
                 break;
             case TCPConnection::SYN_SENT:
-                if (SYN)
+                if (ACK && AcknowledgementNumber != connection->SequenceNumber)
+                {
+                    // Not an answer to our SYN, leave the connection untouched
+                    Reset(rxBuffer->MAC, localPort, remotePort, sourceIP);
+                    connection = nullptr;
+                }
+                else if (SYN)
                 {
                     connection->AcknowledgementNumber = SequenceNumber;
                     connection->LastAck = connection->AcknowledgementNumber;
+                    connection->AcknowledgementNumber++; // SYN flag consumes a sequence number
                     if (ACK)
                     {
+                        connection->MaxSequenceTx = AcknowledgementNumber + remoteWindowSize;
                         connection->State = TCPConnection::ESTABLISHED;
+                        connection->StartKeepalive();
                         connection->SendFlags(FLAG_ACK);
                     }
                     else
                     {
                         // Simultaneous open
                         connection->State = TCPConnection::SYN_RECEIVED;
-                        connection->AcknowledgementNumber++; // SYN flag consumes a sequence number
                         connection->SendFlags(FLAG_SYN | FLAG_ACK);
                     }
                 }
@@ -147,12 +166,13 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
                 if (ACK)
                 {
                     connection->State = TCPConnection::ESTABLISHED;
+                    connection->StartKeepalive();
 
                     if (connection->Parent->NewConnection == nullptr)
                     {
                         connection->MaxSequenceTx = AcknowledgementNumber + remoteWindowSize;
                         connection->Parent->NewConnection = connection;
-                        connection->Parent->Event.Notify();
+                        connection->Parent->Signal();
                     }
                 }
                 break;
@@ -169,8 +189,7 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
                 {
                     if (ACK)
                     {
-                        connection->State = TCPConnection::TIMED_WAIT;
-                        // Start TimedWait timer
+                        connection->EnterTimedWait();
                     }
                     else
                     {
@@ -187,10 +206,8 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
             case TCPConnection::FIN_WAIT_2:
                 if (FIN)
                 {
-                    connection->State = TCPConnection::TIMED_WAIT;
-                    // Start TimedWait timer
+                    connection->EnterTimedWait();
                     connection->AcknowledgementNumber++; // FIN consumes sequence number
-                    connection->Time_us = (int32_t)osTime::GetTime();
                     connection->SendFlags(FLAG_ACK);
                 }
                 break;
@@ -214,30 +231,54 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
             {
                 data = rxBuffer->Packet;
                 dataLength = rxBuffer->Length;
+                time_us = (uint32_t)osTime::Now_us();
 
                 connection->MaxSequenceTx = AcknowledgementNumber + remoteWindowSize;
-                connection->Event.Notify();
+                connection->LastRx_us = time_us;
+                connection->KeepaliveProbes = 0;
 
                 // Handle any ACKed data
                 if (ACK)
                 {
+                    int acked = 0;
                     connection->HoldingQueueLock.Take(__FILE__, __LINE__);
                     count = connection->HoldingQueue.GetCount();
-                    time_us = (uint32_t)osTime::GetTime();
                     for (int i = 0; i < count; i++)
                     {
-                        buffer = (DataBuffer*)connection->HoldingQueue.Get();
+                        connection->HoldingQueue.Get(buffer);
                         if ((int32_t)(AcknowledgementNumber - buffer->AcknowledgementNumber) >= 0)
                         {
                             connection->CalculateRTT((int32_t)(time_us - buffer->Time_us));
                             IP.FreeTxBuffer(buffer);
+                            acked++;
                         }
                         else
                         {
                             connection->HoldingQueue.Put(buffer);
                         }
                     }
+                    count = connection->HoldingQueue.GetCount();
+                    // Published only once the acknowledged segments are freed, and inside the
+                    // lock so no retransmit of them is still sending. WaitReferenced callers
+                    // may reuse the data as soon as they see it.
+                    uint32_t acknowledged =
+                        connection->AcknowledgedSequence.load(std::memory_order_relaxed);
+                    if ((int32_t)(AcknowledgementNumber - acknowledged) > 0)
+                    {
+                        connection->AcknowledgedSequence.store(AcknowledgementNumber,
+                                                               std::memory_order_release);
+                    }
                     connection->HoldingQueueLock.Give();
+
+                    // The retransmit timer covers the oldest unacknowledged segment
+                    if (count == 0)
+                    {
+                        Timers.Stop(&connection->RetransmitTimer);
+                    }
+                    else if (acked > 0)
+                    {
+                        Timers.Start(&connection->RetransmitTimer, TCP_RETRANSMIT_TIMEOUT_US);
+                    }
                 }
 
                 if (FIN)
@@ -258,10 +299,7 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
                 if (dataLength > 0)
                 {
                     // Copy it to the application
-                    rxBuffer->Disposable = false;
                     connection->StoreRxData(rxBuffer);
-                    IP.FreeRxBuffer(rxBuffer);
-                    connection->Event.Notify();
                 }
 
                 if (flags != 0)
@@ -269,6 +307,12 @@ void ProtocolTCP::ProcessRx(DataBuffer* rxBuffer, const uint8_t* sourceIP, const
                     connection->SendFlags(flags);
                 }
             }
+
+            // Data, window or state changed
+            if (connection)
+            {
+                connection->Signal();
+            }
         }
     }
     else
@@ -286,7 +330,7 @@ void ProtocolTCP::Reset(InterfaceMAC* mac,
     uint16_t checksum;
     uint16_t length;
 
-    DataBuffer* buffer = IP.GetTxBuffer(mac);
+    DataBuffer* buffer = IP.GetTxBuffer(mac, header_size());
 
     if (buffer == nullptr)
     {
@@ -351,6 +395,40 @@ uint16_t ProtocolTCP::ComputeChecksum(uint8_t* packet,
     return FCS::ChecksumComplete(checksum);
 }
 
+uint16_t ProtocolTCP::ComputeChecksum(const uint8_t* header,
+                                      uint16_t length,
+                                      uint32_t payloadChecksum,
+                                      const uint8_t* sourceIP,
+                                      const uint8_t* targetIP)
+{
+    uint32_t checksum;
+
+    // Only the header and pseudo header are summed here, the payload was summed as it was
+    // copied into the buffer
+    checksum = FCS::ChecksumAdd(sourceIP, 4, payloadChecksum);
+    checksum = FCS::ChecksumAdd(targetIP, 4, checksum);
+    checksum += 0x06; // protocol
+    checksum += length;
+    checksum = FCS::ChecksumAdd(header, header_size(), checksum);
+
+    return FCS::ChecksumComplete(checksum);
+}
+
+uint16_t ProtocolTCP::PseudoHeaderSum(uint16_t length,
+                                      const uint8_t* sourceIP,
+                                      const uint8_t* targetIP)
+{
+    uint32_t checksum;
+
+    checksum = FCS::ChecksumAdd(sourceIP, 4, 0);
+    checksum = FCS::ChecksumAdd(targetIP, 4, checksum);
+    checksum += 0x06; // protocol
+    checksum += length;
+
+    // Folded but not complemented, the link adds in the rest of the segment
+    return ~FCS::ChecksumComplete(checksum);
+}
+
 TCPConnection* ProtocolTCP::LocateConnection(uint16_t remotePort,
                                              const uint8_t* remoteAddress,
                                              uint16_t localPort)
@@ -416,37 +494,51 @@ uint16_t ProtocolTCP::NewPort()
 TCPConnection* ProtocolTCP::NewClient(InterfaceMAC* mac,
                                       const uint8_t* remoteAddress,
                                       uint16_t remotePort,
-                                      uint16_t localPort)
+                                      uint16_t localPort,
+                                      TCPConnection::States state)
 {
+    TCPConnection* rc = nullptr;
     size_t i;
     size_t j;
 
+    ConnectionLock.Take(__FILE__, __LINE__);
     for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
     {
         TCPConnection& connection = ConnectionList[i];
         if (connection.State == TCPConnection::CLOSED)
         {
             connection.Allocate(mac);
-            connection.LocalPort = localPort;
             connection.SequenceNumber = 1;
             connection.MaxSequenceTx = connection.SequenceNumber + 1024;
+            connection.AcknowledgedSequence.store(connection.SequenceNumber);
+            connection.AcknowledgementNumber = 0;
+            connection.LastAck = 0;
+
+            // LocateConnection matches on the ports and address alone, so the state must be
+            // in place before they are
+            connection.State = state;
+            connection.LocalPort = localPort;
             for (j = 0; j < IP.AddressSize(); j++)
             {
                 connection.RemoteAddress[j] = remoteAddress[j];
             }
             connection.RemotePort = remotePort;
 
-            return &connection;
+            rc = &connection;
+            break;
         }
     }
+    ConnectionLock.Give();
 
-    return nullptr;
+    return rc;
 }
 
 TCPConnection* ProtocolTCP::NewServer(InterfaceMAC* mac, uint16_t port)
 {
+    TCPConnection* rc = nullptr;
     int i;
 
+    ConnectionLock.Take(__FILE__, __LINE__);
     for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
     {
         TCPConnection& connection = ConnectionList[i];
@@ -455,25 +547,65 @@ TCPConnection* ProtocolTCP::NewServer(InterfaceMAC* mac, uint16_t port)
             connection.Allocate(mac);
             connection.State = TCPConnection::LISTEN;
             connection.LocalPort = port;
-            return &connection;
+            rc = &connection;
+            break;
         }
     }
+    ConnectionLock.Give();
 
-    return nullptr;
+    return rc;
 }
 
-void ProtocolTCP::Tick()
+TCPConnection* ProtocolTCP::Connect(InterfaceMAC* mac,
+                                    const uint8_t* remoteAddress,
+                                    uint16_t remotePort,
+                                    int msTimeout,
+                                    uint16_t localPort)
 {
-    int i;
+    if (localPort == 0)
+    {
+        localPort = NewPort();
+    }
+    TCPConnection* connection =
+        NewClient(mac, remoteAddress, remotePort, localPort, TCPConnection::SYN_SENT);
+    if (connection == nullptr)
+    {
+        printf("Failed to get connection for connect\n");
+        return nullptr;
+    }
 
-    for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+    connection->SendFlags(FLAG_SYN);
+    connection->SequenceNumber++; // Our SYN costs a sequence number
+    mac->FlushTx();
+
+    // Lost SYNs are sent again by the retransmit timer
+    connection->Event.Wait(
+        __FILE__,
+        __LINE__,
+        [connection]() { return connection->State != TCPConnection::SYN_SENT; },
+        msTimeout);
+    if (connection->State != TCPConnection::ESTABLISHED)
     {
-        if (ConnectionList[i].State == TCPConnection::ESTABLISHED ||
-            ConnectionList[i].State == TCPConnection::TIMED_WAIT)
+        printf("Connect to port %d failed in state %s\n",
+               remotePort,
+               connection->GetStateString());
+        connection->StopTimers();
+
+        // Drop the unanswered SYN held for retransmit. The timer is stopped first so it can't
+        // resend it, and the slot is only handed back once the queue is empty.
+        DataBuffer* buffer;
+        connection->HoldingQueueLock.Take(__FILE__, __LINE__);
+        int count = connection->HoldingQueue.GetCount();
+        for (int i = 0; i < count; i++)
         {
-            ConnectionList[i].Tick();
+            connection->HoldingQueue.Get(buffer);
+            IP.FreeTxBuffer(buffer);
         }
+        connection->State = TCPConnection::CLOSED;
+        connection->HoldingQueueLock.Give();
+        return nullptr;
     }
+    return connection;
 }
 
 std::ostream& operator<<(std::ostream& out, const ProtocolTCP& obj)
@@ -36,6 +36,7 @@
 #include "ProtocolTCP.hpp"
 #include "TCPConnection.hpp"
 #include "osMutex.hpp"
+#include "osTimerWheel.hpp"
 
 // SourcePort - 16 bits
 // TargetPort - 16 bits
@@ -55,6 +56,11 @@
 
 #define TCP_RETRANSMIT_TIMEOUT_US 100000
 #define TCP_TIMED_WAIT_TIMEOUT_US 1000000
+#define TCP_DELAYED_ACK_US 40000
+#define TCP_PERSIST_TIMEOUT_US 1000000
+#define TCP_KEEPALIVE_IDLE_US 60000000
+#define TCP_KEEPALIVE_INTERVAL_US 10000000
+#define TCP_KEEPALIVE_PROBES 5
 
 #define FLAG_URG (0x20)
 #define FLAG_ACK (0x10)
@@ -77,14 +83,24 @@ class ProtocolTCP
 public:
     friend class TCPConnection;
 
-    ProtocolTCP(ProtocolIPv4&);
-    void Tick();
+    ProtocolTCP(ProtocolIPv4&, osTimerWheel&);
 
     TCPConnection* NewClient(InterfaceMAC*,
                              const uint8_t* remoteAddress,
                              uint16_t remotePort,
-                             uint16_t localPort);
+                             uint16_t localPort,
+                             TCPConnection::States state);
     TCPConnection* NewServer(InterfaceMAC*, uint16_t port);
+    /// @brief Open a connection to a remote server from a new local port, blocking until the
+    /// handshake completes. The stack must be receiving and running its timers meanwhile.
+    /// @param msTimeout Milliseconds to wait for the SYN-ACK, -1 waits forever
+    /// @param localPort 0 takes a port from NewPort
+    /// @return The ESTABLISHED connection, nullptr if the connection failed or timed out
+    TCPConnection* Connect(InterfaceMAC*,
+                           const uint8_t* remoteAddress,
+                           uint16_t remotePort,
+                           int msTimeout = -1,
+                           uint16_t localPort = 0);
     uint16_t NewPort();
     static size_t header_size() { return 20; }
     size_t rx_window_size() const { return 512; }
@@ -99,14 +115,24 @@ private:
                                     uint16_t length,
                                     const uint8_t* sourceIP,
                                     const uint8_t* targetIP);
+    static uint16_t ComputeChecksum(const uint8_t* header,
+                                    uint16_t length,
+                                    uint32_t payloadChecksum,
+                                    const uint8_t* sourceIP,
+                                    const uint8_t* targetIP);
+    static uint16_t PseudoHeaderSum(uint16_t length,
+                                    const uint8_t* sourceIP,
+                                    const uint8_t* targetIP);
     void
         Reset(InterfaceMAC*, uint16_t localPort, uint16_t remotePort, const uint8_t* remoteAddress);
 
     TCPConnection ConnectionList[TCP_MAX_CONNECTIONS];
     void* ConnectionHoldingBuffer[TX_BUFFER_COUNT];
     uint16_t NextPort;
+    osMutex ConnectionLock;
 
     ProtocolIPv4& IP;
+    osTimerWheel& Timers;
 
     ProtocolTCP();
     ProtocolTCP(ProtocolTCP&);
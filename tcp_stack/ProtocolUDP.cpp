@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 #include "FCS.hpp"
+#include "InterfaceMAC.hpp"
 #include "ProtocolDHCP.hpp"
 #include "ProtocolIPv4.hpp"
 #include "ProtocolUDP.hpp"
@@ -44,11 +45,11 @@ ProtocolUDP::ProtocolUDP(ProtocolIPv4& ip, ProtocolDHCP& dhcp)
 {
 }
 
-DataBuffer* ProtocolUDP::GetTxBuffer(InterfaceMAC* mac)
+DataBuffer* ProtocolUDP::GetTxBuffer(InterfaceMAC* mac, size_t size)
 {
     DataBuffer* buffer;
 
-    buffer = IP.GetTxBuffer(mac);
+    buffer = IP.GetTxBuffer(mac, size + header_size());
     if (buffer != nullptr)
     {
         buffer->Packet += header_size();
@@ -90,17 +91,28 @@ void ProtocolUDP::Transmit(DataBuffer* buffer,
     Pack16(buffer->Packet, 2, targetPort);
     Pack16(buffer->Packet, 4, buffer->Length);
 
+    Pack16(buffer->Packet, 6, 0); // checksum placeholder
+
     // Calculate checksum
     uint8_t pheader_tmp[4];
     pheader_tmp[0] = 0;
     pheader_tmp[1] = 0x11;
     Pack16(pheader_tmp, 2, buffer->Length);
     uint32_t acc = 0;
-    FCS::ChecksumAdd(sourceIP, 4, acc);
+    acc = FCS::ChecksumAdd(sourceIP, 4, acc);
     acc = FCS::ChecksumAdd(targetIP, 4, acc);
     acc = FCS::ChecksumAdd(pheader_tmp, 4, acc);
-    acc = FCS::ChecksumAdd(buffer->Packet, buffer->Length, acc);
-    Pack16(buffer->Packet, 6, FCS::ChecksumComplete(acc));
+    if (buffer->MAC->GetChecksumOffload() & InterfaceMAC::OFFLOAD_TX_L4_CHECKSUM)
+    {
+        // Leave the pseudo header sum for the link to finish
+        Pack16(buffer->Packet, 6, ~FCS::ChecksumComplete(acc));
+        buffer->RequestChecksum(buffer->Packet, 6);
+    }
+    else
+    {
+        acc = FCS::ChecksumAdd(buffer->Packet, buffer->Length, acc);
+        Pack16(buffer->Packet, 6, FCS::ChecksumComplete(acc));
+    }
 
     IP.Transmit(buffer, 0x11, targetIP, sourceIP);
 }
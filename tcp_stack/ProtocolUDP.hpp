@@ -48,7 +48,7 @@ public:
                   const uint8_t* sourceIP,
                   uint16_t sourcePort);
 
-    DataBuffer* GetTxBuffer(InterfaceMAC*);
+    DataBuffer* GetTxBuffer(InterfaceMAC*, size_t size);
     static size_t header_size() { return 8; }
 
 private:
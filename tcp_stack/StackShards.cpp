@@ -0,0 +1,158 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+
+#include "StackShards.hpp"
+#include "Utility.hpp"
+
+// Ports tried for each shard a connection could land on before Connect gives up
+#define SHARD_PORT_TRIES (16)
+
+StackShards::StackShards()
+    : Shards()
+    , Count(0)
+    , NextShard(0)
+{
+}
+
+bool StackShards::Attach(DefaultStack** stacks, int count)
+{
+    if (count < 1 || count > STACK_SHARD_MAX)
+    {
+        printf("StackShards::Attach %d shards, 1 to %d are supported\n", count, STACK_SHARD_MAX);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Shards[i] = stacks[i];
+    }
+    Count = count;
+
+    DefaultStack& control = *Shards[0];
+    for (int i = 1; i < Count; i++)
+    {
+        Shards[i]->SetMACAddress((uint8_t*)control.MAC.GetUnicastAddress());
+        Shards[i]->SetChecksumOffload(control.MAC.GetChecksumOffload());
+        Shards[i]->IP.SetAddressInfo(control.IP.GetAddressInfo());
+    }
+    control.ARP.RegisterAddHandler(AddressAdded, this);
+    control.IP.RegisterAddressInfoHandler(AddressInfoChanged, this);
+    return true;
+}
+
+int StackShards::Find(const InterfaceMAC* mac) const
+{
+    for (int i = 0; i < Count; i++)
+    {
+        if (&Shards[i]->MAC == mac)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint32_t StackShards::Hash(const uint8_t* addressA,
+                           uint16_t portA,
+                           const uint8_t* addressB,
+                           uint16_t portB)
+{
+    uint32_t hash = Unpack32(addressA, 0) ^ Unpack32(addressB, 0) ^ portA ^ portB;
+    return hash ^ (hash >> 16);
+}
+
+int StackShards::ShardOf(const uint8_t* remoteAddress,
+                         uint16_t remotePort,
+                         uint16_t localPort) const
+{
+    const uint8_t* localAddress = Shards[0]->IP.GetUnicastAddress();
+    return Count == 0 ? 0 : Hash(localAddress, localPort, remoteAddress, remotePort) % Count;
+}
+
+void StackShards::SetMACAddress(uint8_t* addr)
+{
+    for (int i = 0; i < Count; i++)
+    {
+        Shards[i]->SetMACAddress(addr);
+    }
+}
+
+void StackShards::SetChecksumOffload(uint32_t offload)
+{
+    for (int i = 0; i < Count; i++)
+    {
+        Shards[i]->SetChecksumOffload(offload);
+    }
+}
+
+TCPConnection*
+    StackShards::Connect(const uint8_t* remoteAddress, uint16_t remotePort, int msTimeout)
+{
+    int shard = NextShard++ % Count;
+    DefaultStack& stack = *Shards[shard];
+
+    for (int i = 0; i < SHARD_PORT_TRIES * Count; i++)
+    {
+        uint16_t port = stack.TCP.NewPort();
+        if (ShardOf(remoteAddress, remotePort, port) == shard)
+        {
+            return stack.TCP.Connect(&stack.MAC, remoteAddress, remotePort, msTimeout, port);
+        }
+    }
+    printf("StackShards::Connect no local port hashes to shard %d\n", shard);
+    return nullptr;
+}
+
+void StackShards::AddressAdded(void* param,
+                               const uint8_t* protocolAddress,
+                               const uint8_t* hardwareAddress)
+{
+    StackShards* shards = (StackShards*)param;
+    for (int i = 1; i < shards->Count; i++)
+    {
+        DefaultStack& stack = *shards->Shards[i];
+        stack.ARP.Add(protocolAddress, hardwareAddress);
+        // Send what the shard queued waiting on the reply shard 0 received
+        stack.IP.Retry();
+    }
+}
+
+void StackShards::AddressInfoChanged(void* param, const ProtocolIPv4::AddressInfo& info)
+{
+    StackShards* shards = (StackShards*)param;
+    for (int i = 1; i < shards->Count; i++)
+    {
+        shards->Shards[i]->IP.SetAddressInfo(info);
+    }
+}
@@ -0,0 +1,94 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <atomic>
+#include <inttypes.h>
+#include "DefaultStack.hpp"
+#include "osPool.hpp"
+
+// Most shards in a StackShards
+#define STACK_SHARD_MAX (8)
+
+// Buffers are only cached per thread in pools that are listed, with room left for other stacks
+static_assert(MAX_POOL >= 2 * STACK_SHARD_MAX * 2 * ProtocolMACEthernet::POOL_COUNT,
+              "MAX_POOL must hold the buffer pools of a full set of stack shards");
+
+/// Several DefaultStacks behind one MAC and IP address, each receiving on a thread of its own,
+/// for example from a PacketIO in a PACKET_FANOUT group. A TCP connection belongs to the shard
+/// that Hash picks for its addresses and ports, the link must steer its frames with the same
+/// hash.
+///
+/// Shard 0 also handles ARP, ICMP, UDP and DHCP for all of them. The addresses its ARP caches
+/// and the address information it is given are copied to the other shards, which only ever
+/// see TCP.
+class StackShards
+{
+public:
+    StackShards();
+
+    /// @brief Configure shards 1 and up from shard 0 and keep them following it
+    /// @param stacks Shard i is stacks[i]
+    bool Attach(DefaultStack** stacks, int count);
+    int GetCount() const { return Count; }
+    DefaultStack& GetShard(int shard) { return *Shards[shard]; }
+    /// @return The shard whose MAC this is, -1 if none
+    int Find(const InterfaceMAC* mac) const;
+
+    /// @brief The same for both directions of a connection: the XOR of both addresses and both
+    /// ports, read big endian, folded with its own top half
+    static uint32_t Hash(const uint8_t* addressA,
+                         uint16_t portA,
+                         const uint8_t* addressB,
+                         uint16_t portB);
+    int ShardOf(const uint8_t* remoteAddress, uint16_t remotePort, uint16_t localPort) const;
+
+    void SetMACAddress(uint8_t* addr);
+    void SetChecksumOffload(uint32_t offload);
+
+    /// @brief Open a connection from the shards in turn, from a local port that hashes to the
+    /// shard, see ProtocolTCP::Connect
+    TCPConnection* Connect(const uint8_t* remoteAddress, uint16_t remotePort, int msTimeout = -1);
+
+private:
+    static void AddressAdded(void* param,
+                             const uint8_t* protocolAddress,
+                             const uint8_t* hardwareAddress);
+    static void AddressInfoChanged(void* param, const ProtocolIPv4::AddressInfo& info);
+
+    DefaultStack* Shards[STACK_SHARD_MAX];
+    int Count;
+    std::atomic<int> NextShard;
+
+    StackShards(StackShards&);
+};
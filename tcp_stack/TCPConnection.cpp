@@ -31,6 +31,8 @@
 
 #include <cstring>
 
+#include "ConnectionPoller.hpp"
+#include "FCS.hpp"
 #include "ProtocolIPv4.hpp"
 #include "ProtocolTCP.hpp"
 #include "TCPConnection.hpp"
@@ -43,15 +45,29 @@ TCPConnection::TCPConnection()
     , TxOffset(0)
     , CurrentWindow(TCP_RX_WINDOW_SIZE)
     , TxBuffer(nullptr)
+    , AcknowledgedSequence(0)
+    , ReferencedSequence(0)
     , RxBufferEmpty(true)
     , NewConnection(nullptr)
     , Parent(nullptr)
     , Event("tcp connection")
-    , HoldingQueue("TCPHolding", TX_BUFFER_COUNT, ConnectionHoldingBuffer)
+    , Poller(nullptr)
+    , PollQueued(false)
+    , PollInterest(0)
+    , PollContext(nullptr)
+    , HoldingQueue()
     , HoldingQueueLock("HoldingQueueLock")
     , MAC(nullptr)
     , IP(nullptr)
     , TCP(nullptr)
+    , Timers(nullptr)
+    , RetransmitTimer("tcp retransmit", RetransmitTimeout, this)
+    , AckTimer("tcp delayed ack", AckTimeout, this)
+    , TimeWaitTimer("tcp time wait", TimeWaitTimeout, this)
+    , PersistTimer("tcp persist", PersistTimeout, this)
+    , KeepaliveTimer("tcp keepalive", KeepaliveTimeout, this)
+    , LastRx_us(0)
+    , KeepaliveProbes(0)
 {
 }
 
@@ -59,6 +75,7 @@ void TCPConnection::Initialize(ProtocolIPv4& ip, ProtocolTCP& tcp)
 {
     IP = &ip;
     TCP = &tcp;
+    Timers = &tcp.Timers;
 }
 
 void TCPConnection::Allocate(InterfaceMAC* mac)
@@ -68,18 +85,39 @@ void TCPConnection::Allocate(InterfaceMAC* mac)
     TxOffset = 0;
     CurrentWindow = TCP_RX_WINDOW_SIZE;
     TxBuffer = nullptr;
+    AcknowledgedSequence.store(0);
+    ReferencedSequence = 0;
     RxBufferEmpty = true;
     NewConnection = nullptr;
     Parent = nullptr;
+    KeepaliveProbes = 0;
+    StopTimers();
+
+    // A reused connection is not the one the poller was told about
+    ConnectionPoller* poller = Poller.load();
+    if (poller != nullptr)
+    {
+        poller->Remove(this);
+    }
 
     MAC = mac;
 }
 
+void TCPConnection::Signal()
+{
+    Event.Notify();
+    ConnectionPoller* poller = Poller.load(std::memory_order_acquire);
+    if (poller != nullptr)
+    {
+        poller->Queue(this);
+    }
+}
+
 TCPConnection::~TCPConnection() {}
 
 void TCPConnection::SendFlags(uint8_t flags)
 {
-    DataBuffer* buffer = GetTxBuffer();
+    DataBuffer* buffer = GetTxBuffer(0);
 
     if (buffer)
     {
@@ -93,11 +131,15 @@ void TCPConnection::BuildPacket(DataBuffer* buffer, uint8_t flags)
     uint16_t checksum;
     uint16_t length;
 
-    flags |= FLAG_ACK;
+    // Everything but the opening SYN acknowledges the peer
+    if (State != SYN_SENT || (flags & FLAG_SYN) == 0)
+    {
+        flags |= FLAG_ACK;
+    }
 
     buffer->Packet -= ProtocolTCP::header_size();
     packet = buffer->Packet;
-    length = buffer->Length;
+    length = buffer->ChainLength();
     if (packet != nullptr)
     {
         Pack16(packet, 0, LocalPort);
@@ -118,14 +160,33 @@ void TCPConnection::BuildPacket(DataBuffer* buffer, uint8_t flags)
         SequenceNumber += length;
         buffer->AcknowledgementNumber = SequenceNumber;
 
-        while ((int32_t)(MaxSequenceTx - SequenceNumber) < 0)
+        if (length > 0 && (int32_t)(MaxSequenceTx - SequenceNumber) < 0)
         {
             printf("tx window full\n");
-            Event.Wait(__FILE__, __LINE__);
+            // Probe the peer in case the window update that would wake us is lost
+            Timers->Start(&PersistTimer, TCP_PERSIST_TIMEOUT_US);
+            // The peer can't open the window for segments it hasn't been sent
+            MAC->FlushTx();
+            Event.Wait(__FILE__, __LINE__, [this]() {
+                return (int32_t)(MaxSequenceTx - SequenceNumber) >= 0;
+            });
+            Timers->Stop(&PersistTimer);
         }
 
-        checksum = ProtocolTCP::ComputeChecksum(
-            packet, length + ProtocolTCP::header_size(), IP->GetUnicastAddress(), RemoteAddress);
+        if (MAC->GetChecksumOffload() & InterfaceMAC::OFFLOAD_TX_L4_CHECKSUM)
+        {
+            checksum = ProtocolTCP::PseudoHeaderSum(
+                length + ProtocolTCP::header_size(), IP->GetUnicastAddress(), RemoteAddress);
+            buffer->RequestChecksum(packet, 16);
+        }
+        else
+        {
+            checksum = ProtocolTCP::ComputeChecksum(packet,
+                                                    length + ProtocolTCP::header_size(),
+                                                    buffer->Checksum,
+                                                    IP->GetUnicastAddress(),
+                                                    RemoteAddress);
+        }
 
         Pack16(packet, 16, checksum); // checksum
 
@@ -133,26 +194,36 @@ void TCPConnection::BuildPacket(DataBuffer* buffer, uint8_t flags)
 
         if (length > 0 || (flags & (FLAG_SYN | FLAG_FIN)))
         {
-            buffer->Disposable = false;
-            buffer->Time_us = (uint32_t)osTime::GetTime();
+            // Held for retransmit until acknowledged, Transmit drops the other reference
+            buffer->AddRef();
+            buffer->Time_us = (uint32_t)osTime::Now_us();
             HoldingQueueLock.Take(__FILE__, __LINE__);
             HoldingQueue.Put(buffer);
             HoldingQueueLock.Give();
+            if (!RetransmitTimer.IsPending())
+            {
+                Timers->Start(&RetransmitTimer, TCP_RETRANSMIT_TIMEOUT_US);
+            }
         }
 
         IP->Transmit(buffer, 0x06, RemoteAddress, IP->GetUnicastAddress());
     }
 }
 
-DataBuffer* TCPConnection::GetTxBuffer()
+DataBuffer* TCPConnection::GetTxBuffer(size_t size, bool wait)
 {
     DataBuffer* rc;
 
-    rc = IP->GetTxBuffer(MAC);
+    rc = IP->GetTxBuffer(MAC, size + ProtocolTCP::header_size(), wait);
     if (rc)
     {
         rc->Packet += ProtocolTCP::header_size();
         rc->Remainder -= ProtocolTCP::header_size();
+        if (rc->Remainder > size)
+        {
+            // The size class may be larger than asked for, keep segments to size
+            rc->Remainder = size;
+        }
     }
 
     return rc;
@@ -160,13 +231,11 @@ DataBuffer* TCPConnection::GetTxBuffer()
 
 void TCPConnection::Write(const uint8_t* data, uint16_t length)
 {
-    uint16_t i;
-
     while (length > 0)
     {
         if (!TxBuffer)
         {
-            TxBuffer = GetTxBuffer();
+            TxBuffer = GetTxBuffer(TCP_MAX_SEGMENT_SIZE);
             TxOffset = 0;
         }
 
@@ -174,25 +243,26 @@ void TCPConnection::Write(const uint8_t* data, uint16_t length)
         {
             if (TxBuffer->Remainder > length)
             {
-                for (i = 0; i < length; i++)
-                {
-                    TxBuffer->Packet[TxOffset++] = data[i];
-                }
+                TxBuffer->Checksum = FCS::ChecksumCopy(
+                    &TxBuffer->Packet[TxOffset], data, length, TxOffset, TxBuffer->Checksum);
+                TxOffset += length;
                 TxBuffer->Length += length;
                 TxBuffer->Remainder -= length;
                 break;
             }
             else if (TxBuffer->Remainder <= length)
             {
-                for (i = 0; i < TxBuffer->Remainder; i++)
-                {
-                    TxBuffer->Packet[TxOffset++] = data[i];
-                }
+                TxBuffer->Checksum = FCS::ChecksumCopy(&TxBuffer->Packet[TxOffset],
+                                                       data,
+                                                       TxBuffer->Remainder,
+                                                       TxOffset,
+                                                       TxBuffer->Checksum);
+                TxOffset += TxBuffer->Remainder;
                 TxBuffer->Length += TxBuffer->Remainder;
                 length -= TxBuffer->Remainder;
                 data += TxBuffer->Remainder;
                 TxBuffer->Remainder = 0;
-                Flush();
+                SendTxBuffer();
             }
         }
         else
@@ -200,9 +270,80 @@ void TCPConnection::Write(const uint8_t* data, uint16_t length)
             printf("Out of tx buffers\n");
         }
     }
+
+    // The full segments go as one burst, the partial one waits for more data or Flush
+    MAC->FlushTx();
 }
 
-void TCPConnection::Flush()
+void TCPConnection::WriteReference(const uint8_t* data, uint16_t length)
+{
+    // Anything already copied by Write goes first to keep the stream in order
+    SendTxBuffer();
+
+    while (length > 0)
+    {
+        uint16_t size = (length < TCP_MAX_SEGMENT_SIZE ? length : TCP_MAX_SEGMENT_SIZE);
+        DataBuffer* header = GetTxBuffer(0);
+        DataBuffer* payload = MAC->GetTxBuffer(0);
+
+        if (header == nullptr || payload == nullptr)
+        {
+            printf("Out of tx buffers\n");
+            if (header != nullptr)
+            {
+                MAC->FreeTxBuffer(header);
+            }
+            if (payload != nullptr)
+            {
+                MAC->FreeTxBuffer(payload);
+            }
+            break;
+        }
+
+        payload->Attach(data, size);
+        header->Append(payload);
+        header->Checksum = FCS::ChecksumAddAt(data, size, 0, 0);
+        BuildPacket(header, FLAG_PSH);
+
+        data += size;
+        length -= size;
+    }
+    ReferencedSequence = SequenceNumber;
+
+    MAC->FlushTx();
+}
+
+bool TCPConnection::WaitReferenced(int msTimeout)
+{
+    bool rc = Event.Wait(
+        __FILE__,
+        __LINE__,
+        [this]() {
+            // Acknowledgements are only taken in the states ProcessRx handles data in
+            return IsReferenceAcknowledged() ||
+                   (State != ESTABLISHED && State != FIN_WAIT_1 && State != FIN_WAIT_2 &&
+                    State != CLOSE_WAIT);
+        },
+        msTimeout);
+
+    rc = rc && IsReferenceAcknowledged();
+    if (rc)
+    {
+        // A retransmit of acknowledged data may still be queued for a batched send
+        MAC->FlushTx();
+    }
+    return rc;
+}
+
+bool TCPConnection::IsReferenceAcknowledged() const
+{
+    // Pairs with the release in ProtocolTCP::ProcessRx, the acknowledged segments are freed
+    // by the time the new value is seen
+    uint32_t acknowledged = AcknowledgedSequence.load(std::memory_order_acquire);
+    return (int32_t)(acknowledged - ReferencedSequence) >= 0;
+}
+
+void TCPConnection::SendTxBuffer()
 {
     if (TxBuffer != nullptr)
     {
@@ -211,6 +352,12 @@ void TCPConnection::Flush()
     }
 }
 
+void TCPConnection::Flush()
+{
+    SendTxBuffer();
+    MAC->FlushTx();
+}
+
 void TCPConnection::Close()
 {
     switch (State)
@@ -236,22 +383,27 @@ void TCPConnection::Close()
     case TIMED_WAIT: break;
     case TTCP_PERSIST: break;
     }
+    MAC->FlushTx();
 }
 
 TCPConnection* TCPConnection::Listen()
 {
     TCPConnection* connection;
 
-    while (NewConnection == nullptr)
-    {
-        Event.Wait(__FILE__, __LINE__);
-    }
+    Event.Wait(__FILE__, __LINE__, [this]() { return NewConnection != nullptr; });
     connection = NewConnection;
     NewConnection = nullptr;
 
     return connection;
 }
 
+TCPConnection* TCPConnection::Accept()
+{
+    TCPConnection* connection = NewConnection;
+    NewConnection = nullptr;
+    return connection;
+}
+
 int TCPConnection::Read()
 {
     int rc = -1;
@@ -261,6 +413,7 @@ int TCPConnection::Read()
         if (LastAck != AcknowledgementNumber)
         {
             SendFlags(FLAG_ACK);
+            MAC->FlushTx();
         }
         Event.Wait(__FILE__, __LINE__);
     }
@@ -278,18 +431,25 @@ int TCPConnection::Read()
         RxBufferEmpty = true;
     }
 
-    // if( CurrentWindow == TCP_RX_WINDOW_SIZE && LastAck != AcknowledgementNumber )
-    //{
-    //   // The Rx buffer is empty, might as well ack
-    //   Send( FLAG_ACK );
-    //}
+    if (!AckTimer.IsPending())
+    {
+        Timers->Start(&AckTimer, TCP_DELAYED_ACK_US);
+    }
 
     return rc;
 }
 
 int TCPConnection::Read(char* buffer, int size)
 {
-    int bytes_to_read = std::min(size, TCP_RX_WINDOW_SIZE - RxOutOffset);
+    if (RxBufferEmpty)
+    {
+        return 0;
+    }
+
+    // Up to the end of the received data or the end of the window, whichever comes first
+    int available =
+        (RxInOffset > RxOutOffset ? RxInOffset : TCP_RX_WINDOW_SIZE) - RxOutOffset;
+    int bytes_to_read = std::min(size, available);
 
     memcpy(buffer, &RxBuffer[RxOutOffset], bytes_to_read);
 
@@ -306,6 +466,11 @@ int TCPConnection::Read(char* buffer, int size)
         RxBufferEmpty = true;
     }
 
+    if (!AckTimer.IsPending())
+    {
+        Timers->Start(&AckTimer, TCP_DELAYED_ACK_US);
+    }
+
     return bytes_to_read;
 }
 
@@ -346,54 +511,192 @@ int TCPConnection::ReadLine(char* buffer, int size)
     return bytesProcessed;
 }
 
-void TCPConnection::Tick()
+void TCPConnection::StopTimers()
 {
-    int count;
-    int i;
-    DataBuffer* buffer;
-    uint32_t currentTime_us;
-    uint32_t timeoutTime_us;
+    Timers->Stop(&RetransmitTimer);
+    Timers->Stop(&AckTimer);
+    Timers->Stop(&TimeWaitTimer);
+    Timers->Stop(&PersistTimer);
+    Timers->Stop(&KeepaliveTimer);
+}
+
+void TCPConnection::EnterTimedWait()
+{
+    State = TIMED_WAIT;
+    Timers->Stop(&KeepaliveTimer);
+    Timers->Start(&TimeWaitTimer, TCP_TIMED_WAIT_TIMEOUT_US);
+}
+
+void TCPConnection::StartKeepalive()
+{
+    LastRx_us = (uint32_t)osTime::Now_us();
+    KeepaliveProbes = 0;
+    Timers->Start(&KeepaliveTimer, TCP_KEEPALIVE_IDLE_US);
+}
 
-    HoldingQueueLock.Take(__FILE__, __LINE__);
-    count = HoldingQueue.GetCount();
-    currentTime_us = (int32_t)osTime::GetTime();
+void TCPConnection::SendProbe()
+{
+    uint8_t* packet;
+    uint16_t checksum;
 
-    // Check for retransmit timeout
-    timeoutTime_us = currentTime_us - TCP_RETRANSMIT_TIMEOUT_US;
-    for (i = 0; i < count; i++)
+    // Runs on the timer thread, which must not wait for a buffer, a later probe will do
+    DataBuffer* buffer = GetTxBuffer(0, false);
+    if (buffer == nullptr)
     {
-        buffer = (DataBuffer*)HoldingQueue.Get();
-        if ((int32_t)(buffer->Time_us - timeoutTime_us) <= 0)
+        return;
+    }
+
+    // A segment one below the acknowledged sequence is answered by the peer with its current
+    // window. SequenceNumber belongs to the sending thread and may be ahead of what was sent.
+    buffer->Packet -= ProtocolTCP::header_size();
+    packet = buffer->Packet;
+    Pack16(packet, 0, LocalPort);
+    Pack16(packet, 2, RemotePort);
+    Pack32(packet, 4, AcknowledgedSequence.load(std::memory_order_relaxed) - 1);
+    Pack32(packet, 8, AcknowledgementNumber);
+    packet[12] = 0x50; // Header length and reserved
+    packet[13] = FLAG_ACK;
+    Pack16(packet, 14, CurrentWindow);
+    Pack16(packet, 16, 0); // checksum placeholder
+    Pack16(packet, 18, 0); // urgent pointer
+
+    checksum = ProtocolTCP::ComputeChecksum(
+        packet, ProtocolTCP::header_size(), IP->GetUnicastAddress(), RemoteAddress);
+    Pack16(packet, 16, checksum);
+
+    buffer->Length += ProtocolTCP::header_size();
+
+    IP->Transmit(buffer, 0x06, RemoteAddress, IP->GetUnicastAddress());
+}
+
+void TCPConnection::RetransmitTimeout(void* param)
+{
+    TCPConnection* connection = (TCPConnection*)param;
+    DataBuffer* buffer;
+    uint32_t currentTime_us = (uint32_t)osTime::Now_us();
+    uint32_t timeoutTime_us = currentTime_us - TCP_RETRANSMIT_TIMEOUT_US;
+    bool pending;
+
+    connection->HoldingQueueLock.Take(__FILE__, __LINE__);
+    int count = connection->HoldingQueue.GetCount();
+    for (int i = 0; i < count; i++)
+    {
+        connection->HoldingQueue.Get(buffer);
+        if ((int32_t)(buffer->Time_us - timeoutTime_us) <= 0 && connection->RefreshHeader(buffer))
         {
             printf("TCP retransmit timeout %u, %u, delta %d\n",
                    buffer->Time_us,
                    timeoutTime_us,
                    (int32_t)(buffer->Time_us - timeoutTime_us));
             buffer->Time_us = currentTime_us;
-            IP->Retransmit(buffer);
+            connection->IP->Retransmit(buffer);
         }
 
-        HoldingQueue.Put(buffer);
+        connection->HoldingQueue.Put(buffer);
     }
-    HoldingQueueLock.Give();
+    pending = connection->HoldingQueue.GetCount() > 0;
+    connection->HoldingQueueLock.Give();
 
-    // Check for TIMED_WAIT timeouts
-    for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+    if (pending)
     {
-        if (TCP->ConnectionList[i].State == TIMED_WAIT)
-        {
-            if (currentTime_us - TCP->ConnectionList[i].Time_us >= TCP_TIMED_WAIT_TIMEOUT_US)
-            {
-                TCP->ConnectionList[i].State = CLOSED;
-            }
-        }
+        connection->Timers->Start(&connection->RetransmitTimer, TCP_RETRANSMIT_TIMEOUT_US);
+    }
+}
+
+void TCPConnection::AckTimeout(void* param)
+{
+    TCPConnection* connection = (TCPConnection*)param;
+    if ((connection->State == ESTABLISHED || connection->State == CLOSE_WAIT) &&
+        connection->LastAck != connection->AcknowledgementNumber)
+    {
+        connection->SendFlags(FLAG_ACK);
+    }
+}
+
+void TCPConnection::TimeWaitTimeout(void* param)
+{
+    TCPConnection* connection = (TCPConnection*)param;
+    if (connection->State == TIMED_WAIT)
+    {
+        connection->State = CLOSED;
+        connection->Signal();
+    }
+}
+
+void TCPConnection::PersistTimeout(void* param)
+{
+    TCPConnection* connection = (TCPConnection*)param;
+    connection->SendProbe();
+    connection->Timers->Start(&connection->PersistTimer, TCP_PERSIST_TIMEOUT_US);
+}
+
+void TCPConnection::KeepaliveTimeout(void* param)
+{
+    TCPConnection* connection = (TCPConnection*)param;
+    if (connection->State != ESTABLISHED && connection->State != CLOSE_WAIT)
+    {
+        return;
     }
 
-    // Check for delayed ACK
-    if (LastAck != AcknowledgementNumber)
+    // Received segments only record their time, the idle period is checked here
+    uint32_t idle_us = (uint32_t)osTime::Now_us() - connection->LastRx_us;
+    if (connection->KeepaliveProbes == 0 && idle_us < TCP_KEEPALIVE_IDLE_US)
+    {
+        connection->Timers->Start(&connection->KeepaliveTimer, TCP_KEEPALIVE_IDLE_US - idle_us);
+    }
+    else if (connection->KeepaliveProbes < TCP_KEEPALIVE_PROBES)
     {
-        SendFlags(FLAG_ACK);
+        connection->KeepaliveProbes++;
+        connection->SendProbe();
+        connection->Timers->Start(&connection->KeepaliveTimer, TCP_KEEPALIVE_INTERVAL_US);
+    }
+    else
+    {
+        printf("TCP keepalive timeout\n");
+        connection->State = CLOSED;
+        connection->Signal();
+    }
+}
+
+bool TCPConnection::RefreshHeader(DataBuffer* buffer)
+{
+    if (buffer->GetRefCount() > 1)
+    {
+        // Only the holding queue's reference is ours. Any other is a send still queued on the
+        // link, which would see the header change under it, and sending again gains nothing.
+        return false;
+    }
+
+    // Held buffers have already been through the MAC layer so Packet is the start of the frame
+    uint8_t* packet = buffer->Packet + MAC->HeaderSize() + ProtocolIPv4::header_size();
+    uint16_t checksum = Unpack16(packet, 16);
+    uint32_t ack = Unpack32(packet, 8);
+    uint16_t window = Unpack16(packet, 14);
+
+    if ((int32_t)(AcknowledgementNumber - LastAck) > 0)
+    {
+        LastAck = AcknowledgementNumber;
+    }
+    if (buffer->ChecksumNeeded)
+    {
+        // The field holds the pseudo header sum and the link sums the header again, so only
+        // the fields need to change
+        Pack32(packet, 8, AcknowledgementNumber);
+        Pack16(packet, 14, CurrentWindow);
+        return true;
+    }
+    if (ack != AcknowledgementNumber)
+    {
+        checksum = FCS::ChecksumUpdate32(checksum, ack, AcknowledgementNumber);
+        Pack32(packet, 8, AcknowledgementNumber);
+    }
+    if (window != CurrentWindow)
+    {
+        checksum = FCS::ChecksumUpdate16(checksum, window, CurrentWindow);
+        Pack16(packet, 14, CurrentWindow);
     }
+    Pack16(packet, 16, checksum);
+    return true;
 }
 
 void TCPConnection::CalculateRTT(int32_t M)
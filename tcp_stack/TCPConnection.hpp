@@ -31,13 +31,16 @@
 
 #pragma once
 
+#include <atomic>
 #include <inttypes.h>
 #include "Config.hpp"
 #include "ProtocolIPv4.hpp"
 #include "osEvent.hpp"
 #include "osMutex.hpp"
-#include "osQueue.hpp"
+#include "osRing.hpp"
+#include "osTimerWheel.hpp"
 
+class ConnectionPoller;
 class DataBuffer;
 
 class TCPConnection
@@ -60,6 +63,7 @@ public:
     } TCP_STATES;
 
     friend class ProtocolTCP;
+    friend class ConnectionPoller;
 
     States State;
     uint16_t LocalPort;
@@ -77,11 +81,23 @@ public:
     void SendFlags(uint8_t flags);
     void Close();
     TCPConnection* Listen();
+    /// @return The next new connection on a listening connection, nullptr if there is none
+    TCPConnection* Accept();
 
     int Read();
+    /// @brief Copy out received data without blocking
+    /// @return The number of bytes copied, 0 if there is no data
     int Read(char* buffer, int size);
     int ReadLine(char* buffer, int size);
     void Write(const uint8_t* data, uint16_t length);
+    /// @brief Send data without copying it, each segment references data directly. The data
+    /// must not change until the peer has acknowledged all of it, see WaitReferenced.
+    void WriteReference(const uint8_t* data, uint16_t length);
+    /// @brief Wait for the peer to acknowledge everything passed to WriteReference, after
+    /// which the data may be changed or freed
+    /// @param msTimeout Milliseconds to wait, 0 only checks and -1 waits forever
+    /// @return true if all of it was acknowledged, false on timeout or if the connection closed
+    bool WaitReferenced(int msTimeout = -1);
     void Flush();
     const char* GetStateString() const;
 
@@ -94,12 +110,22 @@ private:
     uint16_t CurrentWindow;
 
     DataBuffer* TxBuffer;
+    // The highest acknowledgement received from the peer, stored by the receive thread once
+    // the segments it acknowledges are freed
+    std::atomic<uint32_t> AcknowledgedSequence;
+    uint32_t ReferencedSequence; // The end of the last segment sent by WriteReference
     uint8_t RxBuffer[TCP_RX_WINDOW_SIZE];
     bool RxBufferEmpty;
     void StoreRxData(DataBuffer* buffer);
 
-    DataBuffer* GetTxBuffer();
+    DataBuffer* GetTxBuffer(size_t size, bool wait = true);
+    // Send the segment Write has been filling, without flushing the link
+    void SendTxBuffer();
     void BuildPacket(DataBuffer*, uint8_t flags);
+    // Patch a held segment's ack and window for retransmit
+    // @return false if the last send of the segment still holds it, it is left untouched
+    bool RefreshHeader(DataBuffer*);
+    bool IsReferenceAcknowledged() const;
     void CalculateRTT(int32_t msRTT);
     void Allocate(InterfaceMAC* mac);
 
@@ -108,15 +134,42 @@ private:
     TCPConnection* Parent;
 
     osEvent Event;
-    osQueue HoldingQueue;
+    // Wake anything blocked on this connection and queue it on its poller
+    void Signal();
+
+    std::atomic<ConnectionPoller*> Poller;
+    bool PollQueued; // On the poller's ready list, under the poller's Lock
+    uint8_t PollInterest;
+    void* PollContext;
+
+    // Sent segments waiting to be acknowledged, serialised by HoldingQueueLock
+    osRing<DataBuffer*, osRingSize(TX_BUFFER_COUNT), osRingType::SPSC> HoldingQueue;
     osMutex HoldingQueueLock;
-    void* ConnectionHoldingBuffer[TX_BUFFER_COUNT];
 
     InterfaceMAC* MAC;
     ProtocolIPv4* IP;
     ProtocolTCP* TCP;
 
-    void Tick();
+    // Per connection timers, all run from the stack's timer wheel
+    osTimerWheel* Timers;
+    osTimer RetransmitTimer;
+    osTimer AckTimer;
+    osTimer TimeWaitTimer;
+    osTimer PersistTimer;
+    osTimer KeepaliveTimer;
+    uint32_t LastRx_us;
+    int KeepaliveProbes;
+
+    void EnterTimedWait();
+    void StartKeepalive();
+    void SendProbe();
+    void StopTimers();
+
+    static void RetransmitTimeout(void* param);
+    static void AckTimeout(void* param);
+    static void TimeWaitTimeout(void* param);
+    static void PersistTimeout(void* param);
+    static void KeepaliveTimeout(void* param);
 
     TCPConnection();
     void Initialize(ProtocolIPv4&, ProtocolTCP&);
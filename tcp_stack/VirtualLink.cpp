@@ -0,0 +1,422 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#include <cstring>
+#include <stdio.h>
+
+#include "DataBuffer.hpp"
+#include "Utility.hpp"
+#include "VirtualLink.hpp"
+#include "osTime.hpp"
+
+static const size_t MAX_VIRTUAL_LINK_COUNT = 8;
+static VirtualLink* VirtualLinkList[MAX_VIRTUAL_LINK_COUNT];
+static osMutex VirtualLinkListLock("virtual link list lock");
+
+// Longest the link's thread sleeps, a timer started meanwhile waits at most this long
+static const int VIRTUAL_LINK_IDLE_MS = 1;
+
+VirtualLink::VirtualLink(const char* name)
+    : Name(name)
+    , Lock(name)
+    , Changed(name)
+    , Thread()
+    , Running(false)
+    , Way()
+{
+    Impairment none = {};
+    none.QueueLimit = VIRTUAL_LINK_QUEUE_MAX;
+    for (int i = 0; i < 2; i++)
+    {
+        Way[i].Config = none;
+        Way[i].Random = 1;
+        Way[i].FreeCount = VIRTUAL_LINK_QUEUE_MAX;
+        for (int slot = 0; slot < VIRTUAL_LINK_QUEUE_MAX; slot++)
+        {
+            Way[i].Free[slot] = slot;
+        }
+    }
+}
+
+VirtualLink::~VirtualLink()
+{
+    Stop();
+    VirtualLinkListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_VIRTUAL_LINK_COUNT; i++)
+    {
+        if (VirtualLinkList[i] == this)
+        {
+            VirtualLinkList[i] = nullptr;
+        }
+    }
+    VirtualLinkListLock.Give();
+}
+
+bool VirtualLink::Attach(DefaultStack& a, DefaultStack& b)
+{
+    bool rc = false;
+
+    Way[0].From = &a;
+    Way[0].To = &b;
+    Way[1].From = &b;
+    Way[1].To = &a;
+
+    // The transmit handler has no context, it finds the link from the sending MAC
+    VirtualLinkListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_VIRTUAL_LINK_COUNT && !rc; i++)
+    {
+        if (VirtualLinkList[i] == nullptr || VirtualLinkList[i] == this)
+        {
+            VirtualLinkList[i] = this;
+            rc = true;
+        }
+    }
+    VirtualLinkListLock.Give();
+    if (!rc)
+    {
+        printf("VirtualLink %s, more than %zu links\n", Name, MAX_VIRTUAL_LINK_COUNT);
+        return false;
+    }
+
+    a.RegisterBufferTransmitHandler(Transmit);
+    b.RegisterBufferTransmitHandler(Transmit);
+    return true;
+}
+
+void VirtualLink::SetImpairment(const Impairment& impairment, uint32_t seed)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        // Different streams each way from the one seed
+        Lock.Take(__FILE__, __LINE__);
+        Way[i].Config = impairment;
+        Way[i].Random = ((uint64_t)seed << 1) + i + 1;
+        Lock.Give();
+    }
+}
+
+void VirtualLink::SetImpairment(const DefaultStack& from,
+                                const Impairment& impairment,
+                                uint32_t seed)
+{
+    Direction* way = Find(from);
+    if (way != nullptr)
+    {
+        Lock.Take(__FILE__, __LINE__);
+        way->Config = impairment;
+        way->Random = ((uint64_t)seed << 1) + 1;
+        Lock.Give();
+    }
+}
+
+VirtualLink::Counters VirtualLink::GetCounters(const DefaultStack& from)
+{
+    Counters rc = {};
+    Direction* way = Find(from);
+    if (way != nullptr)
+    {
+        Lock.Take(__FILE__, __LINE__);
+        rc = way->Count;
+        Lock.Give();
+    }
+    return rc;
+}
+
+VirtualLink::Direction* VirtualLink::Find(const DefaultStack& from)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (Way[i].From == &from)
+        {
+            return &Way[i];
+        }
+    }
+    return nullptr;
+}
+
+void VirtualLink::Transmit(DataBuffer* buffer)
+{
+    VirtualLink* link = nullptr;
+    Direction* way = nullptr;
+
+    VirtualLinkListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_VIRTUAL_LINK_COUNT && way == nullptr; i++)
+    {
+        link = VirtualLinkList[i];
+        for (int j = 0; link != nullptr && j < 2; j++)
+        {
+            if (link->Way[j].From != nullptr && &link->Way[j].From->MAC == buffer->MAC)
+            {
+                way = &link->Way[j];
+            }
+        }
+    }
+    VirtualLinkListLock.Give();
+
+    if (way != nullptr)
+    {
+        link->Send(*way, buffer);
+    }
+}
+
+// xorshift64*, cheap and the same everywhere for a seed
+double VirtualLink::Chance(Direction& way)
+{
+    way.Random ^= way.Random >> 12;
+    way.Random ^= way.Random << 25;
+    way.Random ^= way.Random >> 27;
+    return ((way.Random * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / (1ULL << 53));
+}
+
+void VirtualLink::Send(Direction& way, DataBuffer* buffer)
+{
+    size_t length = buffer->ChainLength();
+    bool wake;
+
+    Lock.Take(__FILE__, __LINE__);
+    way.Count.Sent++;
+    if (way.Config.Loss > 0 && Chance(way) < way.Config.Loss)
+    {
+        way.Count.Lost++;
+        Lock.Give();
+        return;
+    }
+    if (way.Queued >= way.Config.QueueLimit || way.FreeCount == 0 ||
+        length > VIRTUAL_LINK_FRAME_MAX)
+    {
+        way.Count.Dropped++;
+        Lock.Give();
+        return;
+    }
+
+    int slot = way.Free[--way.FreeCount];
+    Frame& frame = way.Frames[slot];
+    size_t offset = 0;
+    for (DataBuffer* segment = buffer; segment != nullptr; segment = segment->Next)
+    {
+        memcpy(&frame.Data[offset], segment->Packet, segment->Length);
+        offset += segment->Length;
+    }
+    frame.Length = length;
+    // Checksums left to the link count as done, as a NIC with offload would do them
+    bool header_left =
+        (buffer->MAC->GetChecksumOffload() & InterfaceMAC::OFFLOAD_TX_IPV4_CHECKSUM) != 0 &&
+        Unpack16(buffer->Packet, 12) == 0x0800;
+    frame.ChecksumVerified = buffer->ChecksumNeeded || header_left;
+
+    // The wire is busy until the frames ahead of this one are serialised
+    uint64_t now_us = osTime::GetTime_us();
+    uint64_t start_us = (way.WireFree_us > now_us ? way.WireFree_us : now_us);
+    if (way.Config.Bandwidth_bps > 0)
+    {
+        start_us += length * 8 * 1000000ULL / way.Config.Bandwidth_bps;
+    }
+    way.WireFree_us = start_us;
+    frame.Due_us = start_us + way.Config.Latency_us;
+    if (way.Config.Reorder > 0 && Chance(way) < way.Config.Reorder)
+    {
+        frame.Due_us += way.Config.ReorderDelay_us;
+        way.Count.Reordered++;
+    }
+    Queue(way, slot);
+
+    if (way.Config.Duplicate > 0 && Chance(way) < way.Config.Duplicate && way.FreeCount > 0 &&
+        way.Queued < way.Config.QueueLimit)
+    {
+        int copy = way.Free[--way.FreeCount];
+        way.Frames[copy].Due_us = frame.Due_us;
+        way.Frames[copy].Length = frame.Length;
+        way.Frames[copy].ChecksumVerified = frame.ChecksumVerified;
+        memcpy(way.Frames[copy].Data, frame.Data, frame.Length);
+        Queue(way, copy);
+        way.Count.Duplicated++;
+    }
+    wake = (way.Frames[way.Order[0]].Due_us == frame.Due_us);
+    Lock.Give();
+
+    if (wake)
+    {
+        Changed.Notify();
+    }
+}
+
+// Called with Lock held
+void VirtualLink::Queue(Direction& way, int slot)
+{
+    // Frames are nearly always due after the ones already queued, so search from the back
+    int i = way.Queued;
+    while (i > 0 && way.Frames[way.Order[i - 1]].Due_us > way.Frames[slot].Due_us)
+    {
+        way.Order[i] = way.Order[i - 1];
+        i--;
+    }
+    way.Order[i] = slot;
+    way.Queued++;
+}
+
+int VirtualLink::Deliver(uint64_t now_us)
+{
+    int count = 0;
+
+    while (1)
+    {
+        Direction* way = nullptr;
+
+        Lock.Take(__FILE__, __LINE__);
+        for (int i = 0; i < 2; i++)
+        {
+            if (Way[i].Queued > 0 && Way[i].Frames[Way[i].Order[0]].Due_us <= now_us &&
+                (way == nullptr ||
+                 Way[i].Frames[Way[i].Order[0]].Due_us < way->Frames[way->Order[0]].Due_us))
+            {
+                way = &Way[i];
+            }
+        }
+        if (way == nullptr)
+        {
+            Lock.Give();
+            break;
+        }
+        int slot = way->Order[0];
+        way->Queued--;
+        memmove(&way->Order[0], &way->Order[1], way->Queued);
+        Lock.Give();
+
+        // The slot stays out of the free list until the receiver is done with it
+        Frame& frame = way->Frames[slot];
+        way->To->ProcessRx(frame.Data, frame.Length, frame.ChecksumVerified);
+        count++;
+
+        Lock.Take(__FILE__, __LINE__);
+        way->Free[way->FreeCount++] = slot;
+        way->Count.Delivered++;
+        Lock.Give();
+    }
+
+    return count;
+}
+
+uint64_t VirtualLink::GetNextDelivery_us()
+{
+    uint64_t rc = UINT64_MAX;
+
+    Lock.Take(__FILE__, __LINE__);
+    for (int i = 0; i < 2; i++)
+    {
+        if (Way[i].Queued > 0 && Way[i].Frames[Way[i].Order[0]].Due_us < rc)
+        {
+            rc = Way[i].Frames[Way[i].Order[0]].Due_us;
+        }
+    }
+    Lock.Give();
+    return rc;
+}
+
+void VirtualLink::Start()
+{
+    if (!Running.exchange(true))
+    {
+        Thread.Create(Entry, Name, 1024 * 32, 10, this);
+    }
+}
+
+void VirtualLink::Stop()
+{
+    if (Running.exchange(false))
+    {
+        Changed.Notify();
+        Thread.WaitForExit();
+    }
+}
+
+void VirtualLink::Entry(void* param)
+{
+    VirtualLink* link = (VirtualLink*)param;
+
+    while (link->Running)
+    {
+        uint64_t now_us = osTime::GetTime_us();
+        uint64_t next_us = link->GetNextDelivery_us();
+
+        link->Deliver(now_us);
+        for (int i = 0; i < 2; i++)
+        {
+            DefaultStack* stack = link->Way[i].From;
+            uint64_t due_us = stack->Timers.GetNextExpiry_us();
+            if (due_us <= now_us)
+            {
+                stack->Tick();
+            }
+            next_us = (due_us < next_us ? due_us : next_us);
+        }
+
+        now_us = osTime::GetTime_us();
+        if (next_us <= now_us)
+        {
+            continue;
+        }
+        if (next_us - now_us < 1000)
+        {
+            // Finer than the event's millisecond timeout
+            osThread::USleep(next_us - now_us, __FILE__, __LINE__);
+        }
+        else
+        {
+            link->Changed.Wait(__FILE__, __LINE__, VIRTUAL_LINK_IDLE_MS);
+        }
+    }
+}
+
+void VirtualLink::dump_info(std::ostream& out)
+{
+    VirtualLinkListLock.Take(__FILE__, __LINE__);
+    for (size_t i = 0; i < MAX_VIRTUAL_LINK_COUNT; i++)
+    {
+        VirtualLink* link = VirtualLinkList[i];
+        if (link == nullptr)
+        {
+            continue;
+        }
+        out << "Virtual link " << link->Name << "\n";
+        link->Lock.Take(__FILE__, __LINE__);
+        for (int j = 0; j < 2; j++)
+        {
+            const Direction& way = link->Way[j];
+            out << "  " << (j == 0 ? "a to b" : "b to a") << ": " << way.Queued << " queued, "
+                << way.Count.Sent << " sent, " << way.Count.Delivered << " delivered, "
+                << way.Count.Lost << " lost, " << way.Count.Reordered << " reordered, "
+                << way.Count.Duplicated << " duplicated, " << way.Count.Dropped << " dropped\n";
+        }
+        link->Lock.Give();
+    }
+    VirtualLinkListLock.Give();
+}
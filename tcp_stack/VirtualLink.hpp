@@ -0,0 +1,150 @@
+//----------------------------------------------------------------------------
+// Copyright(c) 2015-2021, Robert Kimball
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//----------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <atomic>
+#include <inttypes.h>
+#include <iostream>
+#include "Config.hpp"
+#include "DefaultStack.hpp"
+#include "osEvent.hpp"
+#include "osMutex.hpp"
+#include "osThread.hpp"
+
+// Frames in flight each way on a VirtualLink
+#define VIRTUAL_LINK_QUEUE_MAX (64)
+// Largest frame a VirtualLink carries, larger frames are dropped
+#define VIRTUAL_LINK_FRAME_MAX (DATA_BUFFER_MTU_SIZE)
+
+/// An Ethernet cable between two DefaultStacks in one process, for testing and benchmarking
+/// the stack without a network. Each direction is a bounded queue that can shape and impair
+/// the traffic.
+///
+/// Attach registers the link as the buffer transmit handler of both stacks. A transmitted frame
+/// is copied into the queue and handed to the other stack's ProcessRx later, by Deliver or by
+/// the link's own thread, never from inside the sender. Delivering from inside the sender
+/// would run the peer's reply on a thread that may hold the sender's locks.
+///
+/// Frames whose L4 or IPv4 header checksum was left to the link arrive marked ChecksumVerified.
+/// Set OFFLOAD_TX_L4_CHECKSUM and OFFLOAD_TX_IPV4_CHECKSUM on both stacks to skip checksums as
+/// a NIC with offload would.
+class VirtualLink
+{
+public:
+    struct Impairment
+    {
+        uint64_t Bandwidth_bps; // 0 for no limit, frames are serialised one after another
+        uint32_t Latency_us;    // Added to every frame after it is serialised
+        double Loss;            // Chance a frame is dropped
+        double Reorder;         // Chance a frame is held back ReorderDelay_us so later ones pass
+        uint32_t ReorderDelay_us;
+        double Duplicate;       // Chance a frame is delivered twice
+        int QueueLimit;         // Frames queued before tail drop, at most VIRTUAL_LINK_QUEUE_MAX
+    };
+
+    struct Counters
+    {
+        uint64_t Sent;
+        uint64_t Delivered;
+        uint64_t Lost;
+        uint64_t Reordered;
+        uint64_t Duplicated;
+        uint64_t Dropped; // Queue full or frame too large
+    };
+
+    VirtualLink(const char* name);
+    ~VirtualLink();
+
+    /// @brief Connect two stacks, each stack can be on one link only
+    bool Attach(DefaultStack& a, DefaultStack& b);
+    /// @brief Impair both directions the same way
+    /// @param seed Impairments are random but repeat for the same seed and traffic
+    void SetImpairment(const Impairment&, uint32_t seed = 1);
+    /// @brief Impair the traffic stack sends
+    void SetImpairment(const DefaultStack& from, const Impairment&, uint32_t seed = 1);
+    Counters GetCounters(const DefaultStack& from);
+
+    /// @brief Hand over every frame due at or before now_us, in order of arrival
+    /// @return The number of frames delivered
+    int Deliver(uint64_t now_us);
+    /// @return The time the next frame is due, UINT64_MAX if no frame is in flight
+    uint64_t GetNextDelivery_us();
+
+    /// @brief Run a thread that delivers frames as they fall due and runs both stacks' timers,
+    /// nothing else should call their Tick meanwhile
+    void Start();
+    void Stop();
+
+    const char* GetName() const { return Name; }
+    static void dump_info(std::ostream&);
+
+private:
+    struct Frame
+    {
+        uint64_t Due_us;
+        uint16_t Length;
+        bool ChecksumVerified;
+        uint8_t Data[VIRTUAL_LINK_FRAME_MAX];
+    };
+
+    struct Direction
+    {
+        DefaultStack* From;
+        DefaultStack* To;
+        Impairment Config;
+        uint64_t Random;
+        uint64_t WireFree_us; // When the last queued frame is serialised
+        Counters Count;
+        Frame Frames[VIRTUAL_LINK_QUEUE_MAX];
+        uint8_t Order[VIRTUAL_LINK_QUEUE_MAX]; // Queued frames, earliest due first
+        int Queued;
+        uint8_t Free[VIRTUAL_LINK_QUEUE_MAX];
+        int FreeCount;
+    };
+
+    static void Transmit(DataBuffer* buffer);
+    static void Entry(void* param);
+    void Send(Direction& way, DataBuffer* buffer);
+    void Queue(Direction& way, int slot);
+    double Chance(Direction& way);
+    Direction* Find(const DefaultStack& from);
+
+    const char* Name;
+    osMutex Lock;
+    osEvent Changed;
+    osThread Thread;
+    std::atomic<bool> Running;
+    Direction Way[2];
+
+    VirtualLink(VirtualLink&);
+};
@@ -0,0 +1,61 @@
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "osEvent.hpp"
+
+TEST(osEventTest, NotifyBeforeWaitIsRemembered) {
+    static osEvent event("remembered");
+
+    event.Notify();
+    event.Notify();
+    EXPECT_TRUE(event.Wait(__FILE__, __LINE__, 0));
+    // Signals don't count up, both notifies were consumed by the one wait
+    EXPECT_FALSE(event.Wait(__FILE__, __LINE__, 0));
+}
+
+TEST(osEventTest, WaitTimesOut) {
+    static osEvent event("timeout");
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(event.Wait(__FILE__, __LINE__, 20));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, std::chrono::milliseconds(20));
+    EXPECT_LT(elapsed, std::chrono::seconds(2));
+}
+
+TEST(osEventTest, NotifyWakesBlockedWaiter) {
+    static osEvent event("wake");
+    std::atomic<bool> woken(false);
+
+    std::thread waiter([&]() {
+        EXPECT_TRUE(event.Wait(__FILE__, __LINE__));
+        woken = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_FALSE(woken);
+    event.Notify();
+    waiter.join();
+    EXPECT_TRUE(woken);
+}
+
+TEST(osEventTest, PredicateWaitIgnoresStaleSignals) {
+    static osEvent event("predicate");
+    std::atomic<int> value(0);
+
+    // A stale signal must not satisfy the wait
+    event.Notify();
+    std::thread producer([&]() {
+        for (int i = 1; i <= 100; i++)
+        {
+            value = i;
+            event.Notify();
+            std::this_thread::yield();
+        }
+    });
+    EXPECT_TRUE(event.Wait(__FILE__, __LINE__, [&]() { return value == 100; }));
+    producer.join();
+
+    EXPECT_FALSE(event.Wait(__FILE__, __LINE__, [&]() { return value == 101; }, 10));
+}
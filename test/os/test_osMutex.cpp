@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "osMutex.hpp"
+
+TEST(osMutexTest, TryTakeFailsWhileHeld) {
+    static osMutex mutex("try take");
+
+    mutex.Take(__FILE__, __LINE__);
+    EXPECT_FALSE(mutex.TryTake());
+    mutex.Give();
+    EXPECT_TRUE(mutex.TryTake());
+    mutex.Give();
+}
+
+TEST(osMutexTest, ContendedTakeExcludesOtherThreads) {
+    static osMutex mutex("contended");
+    const int thread_count = 4;
+    const int iterations = 20000;
+    int counter = 0;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < iterations; i++)
+            {
+                mutex.Take(__FILE__, __LINE__);
+                int value = counter;
+                if ((i & 0xFF) == 0)
+                {
+                    // Hold the lock across a reschedule so the others have to sleep
+                    std::this_thread::yield();
+                }
+                counter = value + 1;
+                mutex.Give();
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(counter, thread_count * iterations);
+    EXPECT_TRUE(mutex.TryTake());
+    mutex.Give();
+}
+
+TEST(osMutexTest, DumpInfoShowsState) {
+    static osMutex mutex("dump state");
+    std::stringstream ss;
+
+    mutex.Take(__FILE__, __LINE__);
+    osMutex::dump_info(ss);
+    mutex.Give();
+
+    std::string line;
+    bool found = false;
+    while (std::getline(ss, line))
+    {
+        if (line.find("dump state") != std::string::npos)
+        {
+            found = true;
+            EXPECT_NE(line.find("taken"), std::string::npos);
+        }
+    }
+    EXPECT_TRUE(found);
+}
+
+TEST(osMutexTest, ProfileCountsTakesAcrossThreads) {
+    static osMutex mutex("profiled");
+    const int thread_count = 3;
+    const int iterations = 1000;
+    std::vector<std::thread> threads;
+
+    osMutex::EnableProfile(true);
+    osMutex::ResetProfile();
+    for (int t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < iterations; i++)
+            {
+                mutex.Take(__FILE__, __LINE__);
+                if ((i & 0x3F) == 0)
+                {
+                    std::this_thread::yield();
+                }
+                mutex.Give();
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    // Takes after profiling is turned off are not counted
+    osMutex::EnableProfile(false);
+    mutex.Take(__FILE__, __LINE__);
+    mutex.Give();
+
+    osMutex::Profile profile = mutex.GetProfile();
+    EXPECT_EQ(profile.Takes, (uint64_t)(thread_count * iterations));
+    EXPECT_LE(profile.Contended, profile.Takes);
+    EXPECT_LE(profile.WaitMax_ns, profile.WaitTotal_ns);
+    uint64_t holds = 0;
+    for (int i = 0; i < osMutex::HOLD_BUCKETS; i++)
+    {
+        holds += profile.Hold[i];
+    }
+    EXPECT_EQ(holds, profile.Takes);
+
+    std::stringstream ss;
+    osMutex::dump_profile(ss);
+    EXPECT_NE(ss.str().find("profiled"), std::string::npos);
+
+    osMutex::ResetProfile();
+    EXPECT_EQ(mutex.GetProfile().Takes, 0u);
+}
+
+TEST(osMutexTest, DestroyedMutexesFreeTheirProfileSlot) {
+    osMutex::EnableProfile(true);
+    for (int i = 0; i < 2 * MAX_MUTEX; i++)
+    {
+        osMutex mutex("short lived");
+        mutex.Take(__FILE__, __LINE__);
+        mutex.Give();
+        // Each one reuses the slot of the last and starts counting from zero
+        EXPECT_EQ(mutex.GetProfile().Takes, 1u);
+    }
+    osMutex::EnableProfile(false);
+}
+
+TEST(osMutexTest, DumpProfileWhileMutexesComeAndGo) {
+    std::atomic<bool> done(false);
+
+    osMutex::EnableProfile(true);
+    std::thread churn([&]() {
+        for (int i = 0; i < 2000; i++)
+        {
+            std::unique_ptr<osMutex> mutex(new osMutex("coming and going"));
+            mutex->Take(__FILE__, __LINE__);
+            mutex->Give();
+        }
+        done.store(true);
+    });
+    while (!done.load())
+    {
+        std::stringstream ss;
+        osMutex::dump_profile(ss);
+        EXPECT_NE(ss.str().find("profiling is on"), std::string::npos);
+    }
+    churn.join();
+    osMutex::EnableProfile(false);
+}
+
+#ifndef NDEBUG
+TEST(osMutexDeathTest, RecursiveTakeAsserts) {
+    static osMutex mutex("recursive");
+
+    mutex.Take(__FILE__, __LINE__);
+    EXPECT_DEATH(mutex.Take(__FILE__, __LINE__), "taken recursively");
+    mutex.Give();
+}
+#endif
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "osMutex.hpp"
+#include "osPool.hpp"
+
+struct PoolItem
+{
+    std::atomic<int> Owner;
+    uint8_t Payload[60];
+};
+
+TEST(osPoolTest, GetAndPutEveryObject) {
+    static PoolItem items[4];
+    static std::atomic<uint32_t> links[4];
+    static osPool pool("TestPool", items, sizeof(PoolItem), 4, links);
+    pool.Fill();
+
+    std::vector<void*> taken;
+    void* item;
+    while ((item = pool.Get()) != nullptr)
+    {
+        taken.push_back(item);
+    }
+    ASSERT_EQ(taken.size(), 4u);
+    EXPECT_EQ(pool.GetCount(), 0);
+    EXPECT_EQ(pool.GetStatistics().Empty, 1u);
+    EXPECT_EQ(pool.GetStatistics().LowWater, 0);
+
+    for (void* object : taken)
+    {
+        EXPECT_GE((PoolItem*)object, &items[0]);
+        EXPECT_LE((PoolItem*)object, &items[3]);
+        pool.Put(object);
+    }
+    EXPECT_EQ(pool.GetCount(), 4);
+}
+
+TEST(osPoolTest, ThreadsNeverShareAnObject) {
+    static const int COUNT = 64;
+    static PoolItem items[COUNT];
+    static std::atomic<uint32_t> links[COUNT];
+    static osPool pool("StressPool", items, sizeof(PoolItem), COUNT, links);
+    pool.Fill();
+
+    std::atomic<int> errors(0);
+    std::vector<std::thread> threads;
+    for (int t = 1; t <= 4; t++)
+    {
+        threads.emplace_back([t, &errors]() {
+            PoolItem* held[8];
+            for (int i = 0; i < 20000; i++)
+            {
+                int count = 1 + i % 8;
+                int got = 0;
+                for (; got < count; got++)
+                {
+                    held[got] = (PoolItem*)pool.Get();
+                    if (held[got] == nullptr)
+                    {
+                        break;
+                    }
+                    if (held[got]->Owner.exchange(t) != 0)
+                    {
+                        errors++;
+                    }
+                }
+                for (int j = 0; j < got; j++)
+                {
+                    held[j]->Owner.store(0);
+                    pool.Put(held[j]);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(errors.load(), 0);
+    // Objects cached by the threads were returned when they exited
+    EXPECT_EQ(pool.GetCount(), COUNT);
+    EXPECT_GT(pool.GetStatistics().CacheHits, 0u);
+}
+
+// Takes of the named mutex in an osMutex::dump_profile
+static uint64_t ProfiledTakes(const char* name)
+{
+    std::stringstream ss;
+    osMutex::dump_profile(ss);
+    std::string text = ss.str();
+    size_t position = text.find(std::string(name) + "|");
+    if (position == std::string::npos)
+    {
+        return 0;
+    }
+    return std::stoull(text.substr(text.find('|', position) + 1));
+}
+
+TEST(osPoolTest, UncachedPoolsStayOffTheListLock) {
+    static const int POOLS = 24;
+    static const int COUNT = 16;
+    static PoolItem items[POOLS][COUNT];
+    static std::atomic<uint32_t> links[POOLS][COUNT];
+    std::vector<std::unique_ptr<osPool>> pools;
+    for (int i = 0; i < POOLS; i++)
+    {
+        pools.emplace_back(new osPool("ManyPool", items[i], sizeof(PoolItem), COUNT, links[i]));
+        pools.back()->Fill();
+    }
+
+    // More pools than a thread has magazines for, the ones left over are used uncached
+    osMutex::EnableProfile(true);
+    osMutex::ResetProfile();
+    std::thread worker([&]() {
+        for (int i = 0; i < 100; i++)
+        {
+            for (std::unique_ptr<osPool>& pool : pools)
+            {
+                pool->Put(pool->Get());
+            }
+        }
+    });
+    worker.join();
+    osMutex::EnableProfile(false);
+
+    // At most one look for a magazine to reclaim and the return of the magazines at exit
+    EXPECT_LE(ProfiledTakes("pool list lock"), 2u);
+    EXPECT_GT(pools[0]->GetStatistics().CacheHits, 0u);
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "osRing.hpp"
+
+TEST(osRingTest, SizeRoundsUpToPowerOfTwo) {
+    EXPECT_EQ(osRingSize(1), 1u);
+    EXPECT_EQ(osRingSize(20), 32u);
+    EXPECT_EQ(osRingSize(64), 64u);
+    EXPECT_EQ(osRingSize(65), 128u);
+}
+
+TEST(osRingTest, SPSCKeepsOrderAndWraps) {
+    static osRing<int, 8, osRingType::SPSC> ring;
+    int items[8];
+    int value = 0;
+    int expected = 0;
+
+    for (int lap = 0; lap < 10; lap++)
+    {
+        for (int i = 0; i < 5; i++)
+        {
+            items[i] = value++;
+        }
+        EXPECT_EQ(ring.PutN(items, 5), 5u);
+        EXPECT_EQ(ring.GetCount(), 5u);
+        EXPECT_EQ(ring.GetN(items, 8), 5u);
+        for (int i = 0; i < 5; i++)
+        {
+            EXPECT_EQ(items[i], expected++);
+        }
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        EXPECT_TRUE(ring.Put(i));
+    }
+    EXPECT_FALSE(ring.Put(8));
+    EXPECT_EQ(ring.PutN(items, 3), 0u);
+}
+
+TEST(osRingTest, MPMCFullAndEmpty) {
+    static osRing<int, 4> ring;
+    int item;
+
+    EXPECT_FALSE(ring.Get(item));
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_TRUE(ring.Put(i));
+    }
+    EXPECT_FALSE(ring.Put(4));
+    EXPECT_EQ(ring.GetCount(), 4u);
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(ring.Get(item));
+        EXPECT_EQ(item, i);
+    }
+    EXPECT_FALSE(ring.Get(item));
+}
+
+TEST(osRingTest, MPMCDeliversEveryItemOnce) {
+    static osRing<uint32_t, 64> ring;
+    static const uint32_t PER_PRODUCER = 50000;
+    static const int PRODUCERS = 3;
+    static const int CONSUMERS = 3;
+    std::vector<std::atomic<int>> seen(PER_PRODUCER * PRODUCERS);
+    std::atomic<uint32_t> consumed(0);
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < PRODUCERS; p++)
+    {
+        threads.emplace_back([p]() {
+            for (uint32_t i = 0; i < PER_PRODUCER; i++)
+            {
+                while (!ring.Put(p * PER_PRODUCER + i))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int c = 0; c < CONSUMERS; c++)
+    {
+        threads.emplace_back([&]() {
+            uint32_t items[8];
+            while (consumed.load() < PER_PRODUCER * PRODUCERS)
+            {
+                size_t count = ring.GetN(items, 8);
+                if (count == 0)
+                {
+                    std::this_thread::yield();
+                }
+                for (size_t i = 0; i < count; i++)
+                {
+                    seen[items[i]]++;
+                }
+                consumed += (uint32_t)count;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    int missing = 0;
+    for (std::atomic<int>& count : seen)
+    {
+        missing += (count.load() != 1);
+    }
+    EXPECT_EQ(missing, 0);
+    EXPECT_EQ(ring.GetCount(), 0u);
+}
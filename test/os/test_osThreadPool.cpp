@@ -0,0 +1,85 @@
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <thread>
+
+#include "osThreadPool.hpp"
+
+static std::atomic<int> RunCount(0);
+static std::atomic<bool> Release(false);
+
+static void CountWork(void* param)
+{
+    ((std::atomic<int>*)param)->fetch_add(1);
+}
+
+static void BlockingWork(void*)
+{
+    while (!Release)
+    {
+        std::this_thread::yield();
+    }
+    RunCount++;
+}
+
+static void WaitForCompleted(osThreadPool& pool, uint64_t count)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (pool.GetStatistics().Completed < count && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::yield();
+    }
+}
+
+TEST(osThreadPoolTest, RunsEverySubmittedItem) {
+    static osThreadPool pool("test workers");
+    std::atomic<int> count(0);
+
+    pool.Start(3, 1024 * 32, 100);
+    EXPECT_EQ(pool.GetWorkerCount(), 3);
+    for (int i = 0; i < 200; i++)
+    {
+        while (!pool.Submit(CountWork, &count))
+        {
+            std::this_thread::yield();
+        }
+    }
+    WaitForCompleted(pool, 200);
+
+    osThreadPool::Statistics stats = pool.GetStatistics();
+    EXPECT_EQ(count, 200);
+    EXPECT_EQ(stats.Completed, 200u);
+    EXPECT_EQ(stats.Submitted, 200u);
+    EXPECT_GE(stats.QueueWaitTotal_us, stats.QueueWaitMax_us);
+    EXPECT_GE(stats.QueueHighWater, 1);
+
+    std::stringstream ss;
+    osThreadPool::dump_info(ss);
+    EXPECT_NE(ss.str().find("test workers"), std::string::npos);
+}
+
+TEST(osThreadPoolTest, QueueFillsWhenWorkersAreBusy) {
+    static osThreadPool pool("busy workers");
+
+    pool.Start(2, 1024 * 32, 100);
+    EXPECT_TRUE(pool.Submit(BlockingWork, nullptr));
+    EXPECT_TRUE(pool.Submit(BlockingWork, nullptr));
+    while (pool.GetStatistics().Busy < 2)
+    {
+        std::this_thread::yield();
+    }
+
+    int queued = 0;
+    while (pool.Submit(BlockingWork, nullptr))
+    {
+        queued++;
+    }
+    EXPECT_EQ(queued, (int)osThreadPool::QUEUE_MAX);
+    EXPECT_EQ(pool.GetStatistics().Rejected, 1u);
+
+    Release = true;
+    WaitForCompleted(pool, 2 + queued);
+    EXPECT_EQ(RunCount, 2 + queued);
+    EXPECT_EQ(pool.GetStatistics().Busy, 0);
+}
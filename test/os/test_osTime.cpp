@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <time.h>
+
+#include "osTime.hpp"
+
+static uint64_t SystemTime_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ExpectTracksSystemClock()
+{
+    uint64_t previous = osTime::GetTime_ns();
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t now = osTime::GetTime_ns();
+        EXPECT_GE(now, previous);
+        previous = now;
+    }
+
+    // Within a millisecond of the system clock, which covers a preemption between the reads
+    int64_t offset = (int64_t)(osTime::GetTime_ns() - SystemTime_ns());
+    EXPECT_LT(offset < 0 ? -offset : offset, 1000000);
+}
+
+TEST(osTimeTest, UnitsAgree) {
+    uint64_t us = osTime::GetTime_us();
+    uint64_t ns = osTime::GetTime_ns();
+    EXPECT_GE(ns / 1000, us);
+    EXPECT_LT(ns / 1000 - us, 1000u);
+    EXPECT_GE(osTime::GetTime(), us);
+}
+
+TEST(osTimeTest, SystemSource) {
+    osTime::ClockSource source = osTime::GetClockSource();
+
+    EXPECT_TRUE(osTime::SetClockSource(osTime::SOURCE_SYSTEM));
+    EXPECT_EQ(osTime::GetClockSource(), osTime::SOURCE_SYSTEM);
+    ExpectTracksSystemClock();
+    osTime::SetClockSource(source);
+}
+
+TEST(osTimeTest, TSCSource) {
+    osTime::ClockSource source = osTime::GetClockSource();
+
+    if (!osTime::SetClockSource(osTime::SOURCE_TSC))
+    {
+        // Falls back to the system clock when the TSC isn't invariant
+        EXPECT_EQ(osTime::GetClockSource(), source);
+        EXPECT_EQ(osTime::GetTSCFrequency(), 0u);
+        return;
+    }
+    EXPECT_TRUE(osTime::IsTSCInvariant());
+    EXPECT_GT(osTime::GetTSCFrequency(), 100000000u);
+    ExpectTracksSystemClock();
+    osTime::SetClockSource(source);
+}
+
+TEST(osTimeTest, BatchCachesNow) {
+    uint64_t outer;
+    {
+        osTime::Batch batch;
+        outer = osTime::Now_ns();
+        timespec delay = {0, 1000000};
+        nanosleep(&delay, nullptr);
+        EXPECT_EQ(osTime::Now_ns(), outer);
+        EXPECT_EQ(osTime::Now_us(), outer / 1000);
+        EXPECT_GT(osTime::GetTime_ns(), outer);
+        {
+            // A nested batch keeps the outer time
+            osTime::Batch nested;
+            EXPECT_EQ(osTime::Now_ns(), outer);
+        }
+        EXPECT_EQ(osTime::Now_ns(), outer);
+    }
+    // Outside of a batch Now reads the clock
+    EXPECT_GT(osTime::Now_ns(), outer);
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "osTime.hpp"
+#include "osTimerWheel.hpp"
+
+static std::vector<int> Fired;
+
+static void Record(void* param)
+{
+    Fired.push_back((int)(intptr_t)param);
+}
+
+TEST(osTimerWheelTest, FiresInOrder) {
+    static osTimerWheel wheel("order", 1000);
+    osTimer a("a", Record, (void*)1);
+    osTimer b("b", Record, (void*)2);
+    osTimer c("c", Record, (void*)3);
+    uint64_t now = osTime::GetTime() / 1000 * 1000; // On a tick boundary
+
+    Fired.clear();
+    wheel.Start(&c, 30000, now);
+    wheel.Start(&a, 10000, now);
+    wheel.Start(&b, 20000, now);
+    EXPECT_EQ(wheel.GetCount(), 3);
+
+    EXPECT_EQ(wheel.Advance(now + 5000), 0);
+    EXPECT_EQ(wheel.Advance(now + 25000), 2);
+    EXPECT_EQ(wheel.Advance(now + 40000), 1);
+    ASSERT_EQ(Fired.size(), 3u);
+    EXPECT_EQ(Fired[0], 1);
+    EXPECT_EQ(Fired[1], 2);
+    EXPECT_EQ(Fired[2], 3);
+    EXPECT_EQ(wheel.GetCount(), 0);
+    EXPECT_FALSE(a.IsPending());
+}
+
+TEST(osTimerWheelTest, NeverFiresEarly) {
+    static osTimerWheel wheel("early", 1000);
+    osTimer timer("timer", Record, (void*)1);
+    uint64_t now = osTime::GetTime() / 1000 * 1000; // On a tick boundary
+
+    Fired.clear();
+    wheel.Start(&timer, 1500, now);
+    EXPECT_EQ(wheel.Advance(now + 1400), 0);
+    EXPECT_EQ(wheel.Advance(now + 3000), 1);
+}
+
+TEST(osTimerWheelTest, CascadesLongDelays) {
+    static osTimerWheel wheel("cascade", 1000);
+    // One per level plus one beyond the span of the wheel
+    uint64_t delays[] = {50, 3000, 200000, 10000000, 20000000};
+    osTimer t0("t0", Record, (void*)0);
+    osTimer t1("t1", Record, (void*)1);
+    osTimer t2("t2", Record, (void*)2);
+    osTimer t3("t3", Record, (void*)3);
+    osTimer t4("t4", Record, (void*)4);
+    osTimer* timers[] = {&t0, &t1, &t2, &t3, &t4};
+    uint64_t now = osTime::GetTime() / 1000 * 1000; // On a tick boundary
+
+    Fired.clear();
+    for (int i = 4; i >= 0; i--)
+    {
+        wheel.Start(timers[i], delays[i] * 1000, now);
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        // Due exactly at its time and not a tick before
+        EXPECT_EQ(wheel.Advance(now + delays[i] * 1000 - 1000), 0) << i;
+        EXPECT_EQ(wheel.GetNextExpiry_us() <= now + delays[i] * 1000, true) << i;
+        EXPECT_EQ(wheel.Advance(now + delays[i] * 1000), 1) << i;
+    }
+    ASSERT_EQ(Fired.size(), 5u);
+    for (int i = 0; i < 5; i++)
+    {
+        EXPECT_EQ(Fired[i], i);
+    }
+}
+
+TEST(osTimerWheelTest, StopAndRestart) {
+    static osTimerWheel wheel("stop", 1000);
+    osTimer a("a", Record, (void*)1);
+    osTimer b("b", Record, (void*)2);
+    uint64_t now = osTime::GetTime() / 1000 * 1000; // On a tick boundary
+
+    Fired.clear();
+    wheel.Start(&a, 10000, now);
+    wheel.Start(&b, 10000, now);
+    wheel.Stop(&a);
+    EXPECT_FALSE(a.IsPending());
+    // Restarting moves a pending timer rather than adding it twice
+    wheel.Start(&b, 50000, now);
+    EXPECT_EQ(wheel.GetCount(), 1);
+    EXPECT_EQ(wheel.Advance(now + 20000), 0);
+    EXPECT_EQ(wheel.Advance(now + 50000), 1);
+    ASSERT_EQ(Fired.size(), 1u);
+    EXPECT_EQ(Fired[0], 2);
+}
+
+TEST(osTimerWheelTest, NextExpiry) {
+    static osTimerWheel wheel("next", 1000);
+    osTimer timer("timer", Record, (void*)1);
+    uint64_t now = osTime::GetTime() / 1000 * 1000; // On a tick boundary
+
+    EXPECT_EQ(wheel.GetNextExpiry_us(), UINT64_MAX);
+    wheel.Start(&timer, 5000, now);
+    EXPECT_GE(wheel.GetNextExpiry_us(), now + 4000);
+    EXPECT_LE(wheel.GetNextExpiry_us(), now + 6000);
+    wheel.Stop(&timer);
+    EXPECT_EQ(wheel.GetNextExpiry_us(), UINT64_MAX);
+}
+
+struct Periodic
+{
+    Periodic(osTimerWheel* wheel, osTimerCallback callback, uint64_t now)
+        : Wheel(wheel)
+        , Timer("periodic", callback, this)
+        , Now(now)
+        , Count(0)
+    {
+    }
+
+    osTimerWheel* Wheel;
+    osTimer Timer;
+    uint64_t Now;
+    int Count;
+};
+
+static void Rearm(void* param)
+{
+    Periodic* periodic = (Periodic*)param;
+    periodic->Count++;
+    if (periodic->Count < 3)
+    {
+        periodic->Wheel->Start(&periodic->Timer, 10000, periodic->Now);
+    }
+}
+
+TEST(osTimerWheelTest, CallbackRestartsTimer) {
+    static osTimerWheel wheel("rearm", 1000);
+    uint64_t now = osTime::GetTime() / 1000 * 1000; // On a tick boundary
+    Periodic periodic(&wheel, Rearm, now);
+
+    wheel.Start(&periodic.Timer, 10000, now);
+    for (int i = 1; i <= 5; i++)
+    {
+        periodic.Now = now + i * 10000;
+        wheel.Advance(periodic.Now);
+    }
+    EXPECT_EQ(periodic.Count, 3);
+    EXPECT_FALSE(periodic.Timer.IsPending());
+}
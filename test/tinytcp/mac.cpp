@@ -1,5 +1,16 @@
+#include <string.h>
+
+#include "FCS.hpp"
+#include "Utility.hpp"
 #include "mac.hpp"
 
+const uint8_t StackMAC[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+const uint8_t PeerMAC[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+const uint8_t StackIP[4] = {10, 0, 0, 2};
+const uint8_t PeerIP[4] = {10, 0, 0, 1};
+const uint16_t StackPort = 80;
+const uint16_t PeerPort = 1234;
+
 LocalMAC::LocalMAC(LocalMAC::TxHandler, const uint8_t* mac)
 {
 }
@@ -16,3 +27,68 @@ void LocalMAC::Send(const uint8_t* dest, const uint8_t* data, size_t len)
 {
 }
 
+void ConfigureStack(DefaultStack& stack)
+{
+    uint8_t frame[60] = {};
+    size_t offset;
+
+    ProtocolIPv4::AddressInfo info = {};
+    info.DataValid = true;
+    memcpy(info.Address, StackIP, 4);
+    memcpy(info.SubnetMask, "\xFF\xFF\xFF\x00", 4);
+    stack.SetMACAddress((uint8_t*)StackMAC);
+    stack.IP.SetAddressInfo(info);
+    stack.SetChecksumOffload(InterfaceMAC::OFFLOAD_RX_CHECKSUM);
+
+    // Unsolicited ARP reply
+    offset = PackBytes(frame, 0, StackMAC, 6);
+    offset = PackBytes(frame, offset, PeerMAC, 6);
+    offset = Pack16(frame, offset, 0x0806);
+    offset = Pack16(frame, offset, 0x0001);
+    offset = Pack16(frame, offset, 0x0800);
+    offset = Pack8(frame, offset, 6);
+    offset = Pack8(frame, offset, 4);
+    offset = Pack16(frame, offset, 2);
+    offset = PackBytes(frame, offset, PeerMAC, 6);
+    offset = PackBytes(frame, offset, PeerIP, 4);
+    offset = PackBytes(frame, offset, StackMAC, 6);
+    offset = PackBytes(frame, offset, StackIP, 4);
+    stack.ProcessRx(frame, sizeof(frame));
+}
+
+void SendSegment(DefaultStack& stack,
+                 uint8_t flags,
+                 uint32_t sequence,
+                 uint32_t acknowledgement,
+                 const char* data,
+                 uint16_t window)
+{
+    uint8_t frame[128] = {};
+    size_t dataLength = strlen(data);
+    size_t offset;
+
+    offset = PackBytes(frame, 0, StackMAC, 6);
+    offset = PackBytes(frame, offset, PeerMAC, 6);
+    offset = Pack16(frame, offset, 0x0800);
+    uint8_t* ip = &frame[offset];
+    offset = Pack8(frame, offset, 0x45);
+    offset = Pack8(frame, offset, 0);
+    offset = Pack16(frame, offset, 20 + 20 + dataLength);
+    offset = Pack32(frame, offset, 0);
+    offset = Pack8(frame, offset, 64);
+    offset = Pack8(frame, offset, 0x06);
+    offset = Pack16(frame, offset, 0);
+    offset = PackBytes(frame, offset, PeerIP, 4);
+    offset = PackBytes(frame, offset, StackIP, 4);
+    Pack16(ip, 10, FCS::Checksum(ip, 20));
+    offset = Pack16(frame, offset, PeerPort);
+    offset = Pack16(frame, offset, StackPort);
+    offset = Pack32(frame, offset, sequence);
+    offset = Pack32(frame, offset, acknowledgement);
+    offset = Pack8(frame, offset, 0x50);
+    offset = Pack8(frame, offset, flags);
+    offset = Pack16(frame, offset, window);
+    offset = Pack32(frame, offset, 0);
+    offset = PackBytes(frame, offset, (const uint8_t*)data, dataLength);
+    stack.ProcessRx(frame, offset < 60 ? 60 : offset);
+}
@@ -1,3 +1,6 @@
+#pragma once
+
+#include "DefaultStack.hpp"
 #include "InterfaceMAC.hpp"
 
 class LocalMAC: public InterfaceMAC {
@@ -13,3 +16,23 @@ private:
     TxHandler RxCallback;
     uint8_t MAC[6];
 };
+
+// The stack under test and the peer the tests play, sending it frames by hand
+extern const uint8_t StackMAC[6];
+extern const uint8_t PeerMAC[6];
+extern const uint8_t StackIP[4];
+extern const uint8_t PeerIP[4];
+extern const uint16_t StackPort;
+extern const uint16_t PeerPort;
+
+// Give the stack StackIP and an ARP entry for PeerIP, so replies are not held on ARP.
+// Received checksums count as verified, the segments from SendSegment have none.
+void ConfigureStack(DefaultStack& stack);
+
+// Hand the stack a TCP segment from PeerPort to StackPort
+void SendSegment(DefaultStack& stack,
+                 uint8_t flags,
+                 uint32_t sequence,
+                 uint32_t acknowledgement,
+                 const char* data = "",
+                 uint16_t window = 0xFFFF);
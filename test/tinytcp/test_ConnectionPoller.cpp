@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "ConnectionPoller.hpp"
+#include "DefaultStack.hpp"
+#include "mac.hpp"
+
+static void DiscardFrame(void*, size_t)
+{
+}
+
+static void Configure(DefaultStack& stack)
+{
+    ConfigureStack(stack);
+    stack.RegisterDataTransmitHandler(DiscardFrame);
+}
+
+TEST(ConnectionPollerTest, ReportsAcceptReadAndClose) {
+    static DefaultStack stack;
+    static ConnectionPoller poller("test poller");
+    ConnectionPoller::Ready ready[4];
+    int listenerContext;
+    char data[16];
+
+    Configure(stack);
+    TCPConnection* listener = stack.TCP.NewServer(&stack.MAC, StackPort);
+    ASSERT_NE(listener, nullptr);
+    ASSERT_TRUE(poller.Add(listener, ConnectionPoller::POLL_ACCEPT, &listenerContext));
+    EXPECT_FALSE(poller.Add(listener, ConnectionPoller::POLL_READ));
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 0);
+
+    // Handshake, the stack starts its sequence numbers at 1
+    SendSegment(stack, FLAG_SYN, 100, 0);
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 0);
+    SendSegment(stack, FLAG_ACK, 101, 2);
+    ASSERT_EQ(poller.Wait(ready, 4, 0), 1);
+    EXPECT_EQ(ready[0].Connection, listener);
+    EXPECT_EQ(ready[0].Context, &listenerContext);
+    EXPECT_EQ(ready[0].Events, ConnectionPoller::POLL_ACCEPT);
+
+    // Level triggered, still ready until accepted
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 1);
+    TCPConnection* connection = listener->Accept();
+    ASSERT_NE(connection, nullptr);
+    EXPECT_EQ(listener->Accept(), nullptr);
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 0);
+
+    ASSERT_TRUE(poller.Add(connection, ConnectionPoller::POLL_READ | ConnectionPoller::POLL_CLOSE));
+    EXPECT_EQ(poller.GetCount(), 2);
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 0);
+    poller.Modify(connection, ConnectionPoller::POLL_WRITE);
+    ASSERT_EQ(poller.Wait(ready, 4, 0), 1);
+    EXPECT_EQ(ready[0].Events, ConnectionPoller::POLL_WRITE);
+    poller.Modify(connection, ConnectionPoller::POLL_READ | ConnectionPoller::POLL_CLOSE);
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 0);
+
+    SendSegment(stack, FLAG_ACK | FLAG_PSH, 101, 2, "hello");
+    ASSERT_EQ(poller.Wait(ready, 4, 0), 1);
+    EXPECT_EQ(ready[0].Connection, connection);
+    EXPECT_EQ(ready[0].Events, ConnectionPoller::POLL_READ);
+    EXPECT_EQ(connection->Read(data, sizeof(data)), 5);
+    EXPECT_EQ(memcmp(data, "hello", 5), 0);
+    EXPECT_EQ(connection->Read(data, sizeof(data)), 0);
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 0);
+
+    // A segment arriving while Wait is blocked wakes it
+    std::thread sender([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        SendSegment(stack, FLAG_ACK | FLAG_FIN, 106, 2);
+    });
+    ASSERT_EQ(poller.Wait(ready, 4, 2000), 1);
+    sender.join();
+    EXPECT_EQ(ready[0].Events, ConnectionPoller::POLL_CLOSE);
+
+    poller.Remove(connection);
+    poller.Remove(listener);
+    EXPECT_EQ(poller.GetCount(), 0);
+    EXPECT_EQ(poller.Wait(ready, 4, 0), 0);
+    connection->Close();
+}
+
+TEST(ConnectionPollerTest, WaitTimesOutOrIsWoken) {
+    static ConnectionPoller poller("idle poller");
+    ConnectionPoller::Ready ready[1];
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(poller.Wait(ready, 1, 10), 0);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(10));
+
+    std::thread waker([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        poller.Wake();
+    });
+    EXPECT_EQ(poller.Wait(ready, 1), 0);
+    waker.join();
+}
+
+TEST(ConnectionPollerTest, ReadyConnectionMovesToAnotherPoller) {
+    static DefaultStack stack;
+    static ConnectionPoller first("first poller");
+    static ConnectionPoller second("second poller");
+    ConnectionPoller::Ready ready[4];
+
+    Configure(stack);
+    TCPConnection* listener = stack.TCP.NewServer(&stack.MAC, StackPort);
+    ASSERT_NE(listener, nullptr);
+    SendSegment(stack, FLAG_SYN, 100, 0);
+    SendSegment(stack, FLAG_ACK, 101, 2);
+
+    // Queued as ready by every Add, and taken off again by every Remove
+    for (int i = 0; i < 2 * POLLER_MAX_CONNECTIONS; i++)
+    {
+        ASSERT_TRUE(first.Add(listener, ConnectionPoller::POLL_ACCEPT));
+        first.Remove(listener);
+    }
+    ASSERT_TRUE(second.Add(listener, ConnectionPoller::POLL_ACCEPT));
+    EXPECT_EQ(first.Wait(ready, 4, 0), 0);
+    ASSERT_EQ(second.Wait(ready, 4, 0), 1);
+    EXPECT_EQ(ready[0].Connection, listener);
+    EXPECT_EQ(ready[0].Events, ConnectionPoller::POLL_ACCEPT);
+
+    second.Remove(listener);
+    TCPConnection* connection = listener->Accept();
+    ASSERT_NE(connection, nullptr);
+    connection->Close();
+}
@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include "FCS.hpp"
+
+static const FCS::Engine AllEngines[] = {
+    FCS::Engine::Scalar, FCS::Engine::Word64, FCS::Engine::SSE2, FCS::Engine::AVX2};
+
+// The original word at a time loop, used as the reference for every engine
+static uint32_t ReferenceChecksumAdd(const uint8_t* buffer, int length, uint32_t checksum) {
+    for (int i = 0; i < length / 2; i++) {
+        checksum += (uint32_t)((buffer[i * 2] << 8) | buffer[i * 2 + 1]);
+    }
+    return checksum;
+}
+
+TEST(FCSTest, KnownHeaderChecksum) {
+    // IPv4 header example from RFC 1071 discussions, checksum field zeroed
+    uint8_t header[] = {0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11,
+                        0x00, 0x00, 0xC0, 0xA8, 0x00, 0x01, 0xC0, 0xA8, 0x00, 0xC7};
+    FCS::Engine original = FCS::GetEngine();
+    for (FCS::Engine engine : AllEngines) {
+        if (FCS::SetEngine(engine)) {
+            EXPECT_EQ(FCS::Checksum(header, sizeof(header)), 0xB861) << FCS::GetEngineName(engine);
+        }
+    }
+    FCS::SetEngine(original);
+}
+
+TEST(FCSTest, EnginesMatchReference) {
+    static uint8_t data[4096 + 64];
+    srand(1234);
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)rand();
+    }
+
+    FCS::Engine original = FCS::GetEngine();
+    for (FCS::Engine engine : AllEngines) {
+        if (!FCS::SetEngine(engine)) {
+            continue;
+        }
+        for (int offset = 0; offset < 8; offset++) {
+            for (int length = 0; length < 300; length++) {
+                ASSERT_EQ(FCS::ChecksumAdd(&data[offset], length, 0x12345),
+                          ReferenceChecksumAdd(&data[offset], length, 0x12345))
+                    << FCS::GetEngineName(engine) << " offset " << offset << " length " << length;
+            }
+        }
+        EXPECT_EQ(FCS::ChecksumAdd(data, 4096, 7), ReferenceChecksumAdd(data, 4096, 7))
+            << FCS::GetEngineName(engine);
+    }
+    FCS::SetEngine(original);
+}
+
+TEST(FCSTest, AllOnesDoesNotOverflow) {
+    // 9000 bytes of 0xFF exercises the lane overflow handling in the wide engines
+    static uint8_t data[9000];
+    memset(data, 0xFF, sizeof(data));
+
+    FCS::Engine original = FCS::GetEngine();
+    for (FCS::Engine engine : AllEngines) {
+        if (FCS::SetEngine(engine)) {
+            EXPECT_EQ(FCS::ChecksumAdd(data, sizeof(data), 0), 4500u * 0xFFFF)
+                << FCS::GetEngineName(engine);
+        }
+    }
+    FCS::SetEngine(original);
+}
+
+TEST(FCSTest, IncrementalUpdateMatchesRecompute) {
+    uint8_t header[40];
+    srand(42);
+    for (int trial = 0; trial < 1000; trial++) {
+        for (size_t i = 0; i < sizeof(header); i++) {
+            header[i] = (uint8_t)rand();
+        }
+        header[16] = 0;
+        header[17] = 0;
+        uint16_t checksum = FCS::Checksum(header, sizeof(header));
+
+        // Rewrite a 32 bit field at offset 8 and a 16 bit field at offset 14
+        uint32_t oldAck = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11];
+        uint32_t newAck = (uint32_t)rand() * 7919u;
+        uint16_t oldWindow = (header[14] << 8) | header[15];
+        uint16_t newWindow = (uint16_t)rand();
+        header[8] = newAck >> 24;
+        header[9] = newAck >> 16;
+        header[10] = newAck >> 8;
+        header[11] = newAck;
+        header[14] = newWindow >> 8;
+        header[15] = newWindow;
+
+        checksum = FCS::ChecksumUpdate32(checksum, oldAck, newAck);
+        checksum = FCS::ChecksumUpdate16(checksum, oldWindow, newWindow);
+
+        // A valid checksum verifies to zero, 0x0000 and 0xFFFF are the same in ones' complement
+        header[16] = checksum >> 8;
+        header[17] = checksum;
+        uint16_t verify = FCS::Checksum(header, sizeof(header));
+        EXPECT_TRUE(verify == 0 || verify == 0xFFFF) << "trial " << trial;
+    }
+}
+
+TEST(FCSTest, ChecksumCompleteFoldsAllCarries) {
+    // 0xFFFF + 0x0001 carries twice when folded
+    EXPECT_EQ(FCS::ChecksumComplete(0x0001FFFF), (uint16_t)~0x0001);
+    EXPECT_EQ(FCS::ChecksumComplete(0xFFFFFFFF), 0x0000);
+}
+
+TEST(FCSTest, ChecksumCopyInPiecesMatchesChecksum) {
+    static uint8_t source[1500];
+    static uint8_t target[1500];
+    srand(99);
+    for (size_t i = 0; i < sizeof(source); i++) {
+        source[i] = (uint8_t)rand();
+    }
+
+    FCS::Engine original = FCS::GetEngine();
+    for (FCS::Engine engine : AllEngines) {
+        if (!FCS::SetEngine(engine)) {
+            continue;
+        }
+        for (int trial = 0; trial < 50; trial++) {
+            int length = 1 + rand() % (int)sizeof(source);
+            memset(target, 0, sizeof(target));
+
+            // Copy in randomly sized pieces the way TCPConnection::Write does
+            uint32_t checksum = 0;
+            int offset = 0;
+            while (offset < length) {
+                int piece = 1 + rand() % 97;
+                if (piece > length - offset) {
+                    piece = length - offset;
+                }
+                checksum =
+                    FCS::ChecksumCopy(&target[offset], &source[offset], piece, offset, checksum);
+                offset += piece;
+            }
+
+            ASSERT_EQ(memcmp(source, target, length), 0) << FCS::GetEngineName(engine);
+            // ChecksumAdd ignores an odd trailing byte, ChecksumCopy pads it with zero
+            target[length] = 0;
+            EXPECT_EQ(FCS::ChecksumComplete(checksum), FCS::Checksum(target, length + 1))
+                << FCS::GetEngineName(engine) << " length " << length;
+        }
+    }
+    FCS::SetEngine(original);
+}
+
+TEST(FCSTest, ChecksumAddAtInPiecesMatchesChecksum) {
+    static uint8_t source[1500];
+    srand(7);
+    for (size_t i = 0; i < sizeof(source); i++) {
+        source[i] = (uint8_t)rand();
+    }
+
+    for (int trial = 0; trial < 50; trial++) {
+        int length = 1 + rand() % (int)sizeof(source);
+
+        // Sum in randomly sized pieces the way a chain of segments is summed
+        uint32_t checksum = 0;
+        int offset = 0;
+        while (offset < length) {
+            int piece = 1 + rand() % 97;
+            if (piece > length - offset) {
+                piece = length - offset;
+            }
+            checksum = FCS::ChecksumAddAt(&source[offset], piece, offset, checksum);
+            offset += piece;
+        }
+
+        uint8_t padded[sizeof(source) + 1] = {};
+        memcpy(padded, source, length);
+        EXPECT_EQ(FCS::ChecksumComplete(checksum), FCS::Checksum(padded, length + (length & 1)));
+    }
+}
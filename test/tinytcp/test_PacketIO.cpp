@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "PacketIO.hpp"
+
+#ifdef __linux__
+// Send a frame to the filtered end of the pair
+// @return true if it came through the filter
+static bool Passes(int* pair, const uint8_t* destination)
+{
+    uint8_t frame[60] = {};
+    uint8_t received[60];
+
+    memcpy(frame, destination, 6);
+    frame[12] = 0x08;
+    EXPECT_EQ(send(pair[0], frame, sizeof(frame), 0), (ssize_t)sizeof(frame));
+    return recv(pair[1], received, sizeof(received), MSG_DONTWAIT) == (ssize_t)sizeof(frame);
+}
+
+TEST(PacketIOTest, AddressFilterPassesUnicastAndBroadcast) {
+    static const uint8_t local[] = {0x10, 0xBF, 0x48, 0x44, 0x55, 0x66};
+    static const uint8_t otherHigh[] = {0x10, 0xBE, 0x48, 0x44, 0x55, 0x66};
+    static const uint8_t otherLow[] = {0x10, 0xBF, 0x48, 0x44, 0x55, 0x67};
+    static const uint8_t broadcast[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    static const uint8_t halfBroadcast[] = {0x10, 0xBF, 0xFF, 0xFF, 0xFF, 0xFF};
+    static const uint8_t moved[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x09};
+    int pair[2];
+
+    // The kernel runs the same program on any socket, a datagram pair needs no privileges
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, pair), 0);
+    ASSERT_TRUE(PacketIO::AttachAddressFilter(pair[1], local));
+
+    EXPECT_TRUE(Passes(pair, local));
+    EXPECT_TRUE(Passes(pair, broadcast));
+    EXPECT_FALSE(Passes(pair, otherHigh));
+    EXPECT_FALSE(Passes(pair, otherLow));
+    EXPECT_FALSE(Passes(pair, halfBroadcast));
+
+    // A new address replaces the old filter
+    ASSERT_TRUE(PacketIO::AttachAddressFilter(pair[1], moved));
+    EXPECT_TRUE(Passes(pair, moved));
+    EXPECT_FALSE(Passes(pair, local));
+    EXPECT_TRUE(Passes(pair, broadcast));
+
+    close(pair[0]);
+    close(pair[1]);
+}
+#endif
@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "DataBuffer.hpp"
+#include "PcapFile.hpp"
+
+static std::string TempPath(const char* name)
+{
+    return testing::TempDir() + name;
+}
+
+static void WriteFile(const std::string& path, const std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+static void PutBE16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(value >> 8);
+    out.push_back(value & 0xFF);
+}
+
+static void PutBE32(std::vector<uint8_t>& out, uint32_t value)
+{
+    PutBE16(out, value >> 16);
+    PutBE16(out, value & 0xFFFF);
+}
+
+// A big endian pcapng block, body padded to 4 bytes
+static void PutBlock(std::vector<uint8_t>& out, uint32_t type, std::vector<uint8_t> body)
+{
+    while (body.size() % 4 != 0)
+    {
+        body.push_back(0);
+    }
+    PutBE32(out, type);
+    PutBE32(out, body.size() + 12);
+    out.insert(out.end(), body.begin(), body.end());
+    PutBE32(out, body.size() + 12);
+}
+
+TEST(PcapFileTest, WriterRoundTrip) {
+    std::string path = TempPath("roundtrip.pcap");
+    uint8_t first[60];
+    uint8_t head[14];
+    uint8_t tail[100];
+    DataBuffer a;
+    DataBuffer b;
+
+    for (int i = 0; i < 100; i++)
+    {
+        tail[i] = i;
+    }
+    memset(first, 0x11, sizeof(first));
+    memset(head, 0x22, sizeof(head));
+    a.SetStorage(head, sizeof(head));
+    b.SetStorage(tail, sizeof(tail));
+    a.Initialize(nullptr);
+    b.Initialize(nullptr);
+    a.Length = sizeof(head);
+    b.Length = sizeof(tail);
+    a.Append(&b);
+
+    PcapWriter writer;
+    ASSERT_TRUE(writer.Open(path.c_str()));
+    writer.Write(1500000000123456789ULL, first, sizeof(first));
+    writer.Write(1500000001000000000ULL, &a);
+    EXPECT_EQ(writer.GetFrameCount(), 2);
+    writer.Close();
+
+    PcapReader reader;
+    uint8_t frame[200];
+    uint64_t time_ns;
+    ASSERT_TRUE(reader.Open(path.c_str()));
+    ASSERT_EQ(reader.Next(frame, sizeof(frame), &time_ns), 60);
+    EXPECT_EQ(time_ns, 1500000000123456789ULL);
+    EXPECT_EQ(memcmp(frame, first, sizeof(first)), 0);
+    ASSERT_EQ(reader.Next(frame, sizeof(frame), &time_ns), 114);
+    EXPECT_EQ(time_ns, 1500000001000000000ULL);
+    EXPECT_EQ(memcmp(frame, head, sizeof(head)), 0);
+    EXPECT_EQ(memcmp(&frame[14], tail, sizeof(tail)), 0);
+    EXPECT_EQ(reader.Next(frame, sizeof(frame), &time_ns), -1);
+}
+
+TEST(PcapFileTest, FramesLargerThanTheBufferAreCutShort) {
+    std::string path = TempPath("microseconds.pcap");
+    std::vector<uint8_t> file;
+
+    // Big endian, microsecond classic pcap
+    PutBE32(file, 0xA1B2C3D4);
+    PutBE16(file, 2);
+    PutBE16(file, 4);
+    PutBE32(file, 0);
+    PutBE32(file, 0);
+    PutBE32(file, 65535);
+    PutBE32(file, 1);
+    for (int i = 0; i < 2; i++)
+    {
+        PutBE32(file, 10 + i);
+        PutBE32(file, 500);
+        PutBE32(file, 20);
+        PutBE32(file, 20);
+        for (int j = 0; j < 20; j++)
+        {
+            file.push_back(i * 20 + j);
+        }
+    }
+    WriteFile(path, file);
+
+    PcapReader reader;
+    uint8_t frame[32];
+    uint64_t time_ns;
+    memset(frame, 0xFF, sizeof(frame));
+    ASSERT_TRUE(reader.Open(path.c_str()));
+    ASSERT_EQ(reader.Next(frame, 8, &time_ns), 20);
+    EXPECT_EQ(time_ns, 10000500000ULL);
+    EXPECT_EQ(frame[7], 7);
+    EXPECT_EQ(frame[8], 0xFF);
+    ASSERT_EQ(reader.Next(frame, sizeof(frame), &time_ns), 20);
+    EXPECT_EQ(time_ns, 11000500000ULL);
+    EXPECT_EQ(frame[0], 20);
+    EXPECT_EQ(frame[19], 39);
+    EXPECT_EQ(reader.Next(frame, sizeof(frame), &time_ns), -1);
+}
+
+TEST(PcapFileTest, ReadsPcapng) {
+    std::string path = TempPath("capture.pcapng");
+    std::vector<uint8_t> file;
+    std::vector<uint8_t> body;
+
+    // Section header, big endian
+    PutBE32(body, 0x1A2B3C4D);
+    PutBE16(body, 1);
+    PutBE16(body, 0);
+    PutBE32(body, 0xFFFFFFFF);
+    PutBE32(body, 0xFFFFFFFF);
+    PutBlock(file, 0x0A0D0D0A, body);
+
+    // Interface 0, Ethernet with nanosecond timestamps
+    body.clear();
+    PutBE16(body, 1);
+    PutBE16(body, 0);
+    PutBE32(body, 65535);
+    PutBE16(body, 9);
+    PutBE16(body, 1);
+    PutBE32(body, 0x09000000);
+    PutBE32(body, 0);
+    PutBlock(file, 1, body);
+
+    // Interface 1, raw IP, its frames are skipped
+    body.clear();
+    PutBE16(body, 101);
+    PutBE16(body, 0);
+    PutBE32(body, 65535);
+    PutBlock(file, 1, body);
+
+    uint64_t stamp = 1600000000000000042ULL;
+    for (uint32_t interface = 1; interface != (uint32_t)-1; interface--)
+    {
+        body.clear();
+        PutBE32(body, interface);
+        PutBE32(body, stamp >> 32);
+        PutBE32(body, stamp & 0xFFFFFFFF);
+        PutBE32(body, 5);
+        PutBE32(body, 5);
+        for (int i = 0; i < 5; i++)
+        {
+            body.push_back(0xA0 + interface * 0x10 + i);
+        }
+        PutBlock(file, 6, body);
+    }
+
+    // An unknown block between frames
+    body.assign(8, 0);
+    PutBlock(file, 0x0BAD, body);
+
+    // Simple packet, 3 bytes captured
+    body.clear();
+    PutBE32(body, 3);
+    body.push_back(1);
+    body.push_back(2);
+    body.push_back(3);
+    PutBlock(file, 3, body);
+    WriteFile(path, file);
+
+    PcapReader reader;
+    uint8_t frame[64];
+    uint64_t time_ns = 0;
+    ASSERT_TRUE(reader.Open(path.c_str()));
+    ASSERT_EQ(reader.Next(frame, sizeof(frame), &time_ns), 5);
+    EXPECT_EQ(time_ns, stamp);
+    EXPECT_EQ(frame[0], 0xA0);
+    EXPECT_EQ(frame[4], 0xA4);
+    EXPECT_EQ(reader.GetSkipCount(), 1);
+
+    // Simple packets have no time of their own
+    time_ns = 0;
+    ASSERT_EQ(reader.Next(frame, sizeof(frame), &time_ns), 3);
+    EXPECT_EQ(time_ns, stamp);
+    EXPECT_EQ(frame[2], 3);
+    EXPECT_EQ(reader.Next(frame, sizeof(frame), &time_ns), -1);
+}
@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include "DefaultStack.hpp"
+
+static const uint8_t LocalMAC[] = {0x02, 0x00, 0x00, 0x00, 0x04, 0x01};
+static const uint8_t LocalIP[] = {10, 0, 4, 1};
+static const uint8_t FirstIP[] = {10, 0, 4, 2};
+static const uint8_t SecondIP[] = {10, 0, 4, 3};
+
+// Holds on to sent frames like a link that batches them
+static DataBuffer* Queued[8];
+static int QueuedCount;
+
+static void QueueFrame(DataBuffer* buffer)
+{
+    if (QueuedCount < 8)
+    {
+        buffer->AddRef();
+        Queued[QueuedCount++] = buffer;
+    }
+}
+
+TEST(ProtocolARPTest, QueuedRequestsAreDistinctFrames) {
+    static DefaultStack stack;
+    ProtocolIPv4::AddressInfo info = {};
+
+    info.DataValid = true;
+    memcpy(info.Address, LocalIP, 4);
+    memcpy(info.SubnetMask, "\xFF\xFF\xFF\x00", 4);
+    stack.SetMACAddress((uint8_t*)LocalMAC);
+    stack.IP.SetAddressInfo(info);
+    stack.RegisterBufferTransmitHandler(QueueFrame);
+
+    EXPECT_EQ(stack.ARP.Protocol2Hardware(FirstIP), nullptr);
+    EXPECT_EQ(stack.ARP.Protocol2Hardware(SecondIP), nullptr);
+
+    ASSERT_EQ(QueuedCount, 2);
+    EXPECT_NE(Queued[0], Queued[1]);
+    // Target protocol address of each request
+    EXPECT_EQ(memcmp(&Queued[0]->Packet[14 + 24], FirstIP, 4), 0);
+    EXPECT_EQ(memcmp(&Queued[1]->Packet[14 + 24], SecondIP, 4), 0);
+
+    for (int i = 0; i < QueuedCount; i++)
+    {
+        stack.MAC.FreeTxBuffer(Queued[i]);
+    }
+    QueuedCount = 0;
+}
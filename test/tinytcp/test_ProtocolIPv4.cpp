@@ -0,0 +1,167 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <thread>
+
+#include "DefaultStack.hpp"
+#include "FCS.hpp"
+#include "Utility.hpp"
+
+static const uint8_t LocalMAC[] = {0x02, 0x00, 0x00, 0x00, 0x05, 0x01};
+static const uint8_t LocalIP[] = {10, 0, 5, 1};
+static const uint8_t SlowMAC[] = {0x02, 0x00, 0x00, 0x00, 0x05, 0x02};
+
+static const int SENDER_COUNT = 2;
+static const int DATAGRAM_COUNT = 8;
+static const int ROUND_COUNT = 50;
+
+// How many times each datagram, numbered in its payload, reached the wire
+static std::atomic<int> Sent[SENDER_COUNT * DATAGRAM_COUNT];
+
+static void CountFrame(DataBuffer* buffer)
+{
+    if (Unpack16(buffer->Packet, 12) == 0x0800)
+    {
+        Sent[buffer->Packet[14 + 20]]++;
+    }
+}
+
+TEST(ProtocolIPv4Test, ConcurrentRetrySendsEachDatagramOnce) {
+    static DefaultStack stack;
+    ProtocolIPv4::AddressInfo info = {};
+
+    info.DataValid = true;
+    memcpy(info.Address, LocalIP, 4);
+    memcpy(info.SubnetMask, "\xFF\xFF\xFF\x00", 4);
+    stack.SetMACAddress((uint8_t*)LocalMAC);
+    stack.IP.SetAddressInfo(info);
+    stack.RegisterBufferTransmitHandler(CountFrame);
+
+    for (int round = 0; round < ROUND_COUNT; round++)
+    {
+        // A new address each round, so it starts out unresolved
+        uint8_t slowIP[] = {10, 0, 5, (uint8_t)(10 + round)};
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        std::thread senders[SENDER_COUNT];
+
+        for (int i = 0; i < SENDER_COUNT * DATAGRAM_COUNT; i++)
+        {
+            Sent[i] = 0;
+        }
+
+        for (int s = 0; s < SENDER_COUNT; s++)
+        {
+            senders[s] = std::thread([&, s]() {
+                for (int i = 0; i < DATAGRAM_COUNT; i++)
+                {
+                    DataBuffer* buffer = stack.IP.GetTxBuffer(&stack.MAC, 8);
+                    ASSERT_NE(buffer, nullptr);
+                    memset(buffer->Packet, 0, 8);
+                    buffer->Packet[0] = s * DATAGRAM_COUNT + i;
+                    buffer->Length = 8;
+                    stack.IP.Transmit(buffer, 17, slowIP, stack.IP.GetUnicastAddress());
+                }
+                ready++;
+                while (!go)
+                {
+                    std::this_thread::yield();
+                }
+                // Drain alongside the other sender and the resolver
+                stack.IP.Retry();
+            });
+        }
+
+        // The reply arrives once everything is queued, then all three drain at once
+        while (ready < SENDER_COUNT)
+        {
+            std::this_thread::yield();
+        }
+        stack.ARP.Add(slowIP, SlowMAC);
+        go = true;
+        stack.IP.Retry();
+
+        for (std::thread& sender : senders)
+        {
+            sender.join();
+        }
+
+        for (int i = 0; i < SENDER_COUNT * DATAGRAM_COUNT; i++)
+        {
+            ASSERT_EQ(Sent[i].load(), 1) << "round " << round << " datagram " << i;
+        }
+        // Nothing sent put back in the queue
+        ASSERT_EQ(stack.IP.GetUnresolvedCount(), 0u) << "round " << round;
+    }
+}
+
+static const uint8_t PeerMAC[] = {0x02, 0x00, 0x00, 0x00, 0x05, 0x03};
+static const uint8_t PeerIP[] = {10, 0, 5, 3};
+
+// The last IPv4 frame each kind of handler put on the wire
+static uint8_t Wire[64];
+
+static void CaptureData(void* data, size_t length)
+{
+    memcpy(Wire, data, length < sizeof(Wire) ? length : sizeof(Wire));
+}
+
+static void CaptureBuffer(DataBuffer* buffer)
+{
+    CaptureData(buffer->Packet, buffer->Length);
+}
+
+static void Configure(DefaultStack& stack, uint32_t offload)
+{
+    ProtocolIPv4::AddressInfo info = {};
+
+    info.DataValid = true;
+    memcpy(info.Address, LocalIP, 4);
+    memcpy(info.SubnetMask, "\xFF\xFF\xFF\x00", 4);
+    stack.SetMACAddress((uint8_t*)LocalMAC);
+    stack.IP.SetAddressInfo(info);
+    stack.SetChecksumOffload(offload);
+    stack.ARP.Add(PeerIP, PeerMAC);
+}
+
+// Send a datagram and return the header checksum that reached the wire
+static uint16_t SendHeaderChecksum(DefaultStack& stack, uint16_t* expected)
+{
+    DataBuffer* buffer = stack.IP.GetTxBuffer(&stack.MAC, 8);
+    EXPECT_NE(buffer, nullptr);
+    if (buffer == nullptr)
+    {
+        return 0;
+    }
+    memset(buffer->Packet, 0, 8);
+    buffer->Length = 8;
+    memset(Wire, 0, sizeof(Wire));
+    stack.IP.Transmit(buffer, 17, PeerIP, stack.IP.GetUnicastAddress());
+
+    EXPECT_EQ(Unpack16(Wire, 12), 0x0800);
+    uint8_t header[20];
+    memcpy(header, &Wire[14], sizeof(header));
+    uint16_t sent = Unpack16(header, 10);
+    Pack16(header, 10, 0);
+    *expected = FCS::Checksum(header, sizeof(header));
+    return sent;
+}
+
+TEST(ProtocolIPv4Test, HeaderChecksumWithoutOffload) {
+    static DefaultStack stack;
+    uint16_t expected;
+    Configure(stack, 0);
+    stack.RegisterDataTransmitHandler(CaptureData);
+    uint16_t sent = SendHeaderChecksum(stack, &expected);
+    EXPECT_NE(sent, 0);
+    EXPECT_EQ(sent, expected);
+}
+
+TEST(ProtocolIPv4Test, HeaderChecksumLeftToTheLink) {
+    static DefaultStack stack;
+    uint16_t expected;
+    Configure(stack, InterfaceMAC::OFFLOAD_TX_IPV4_CHECKSUM);
+    stack.RegisterBufferTransmitHandler(CaptureBuffer);
+    // Neither IPv4 nor the MAC spend time on it, the link owns it
+    EXPECT_EQ(SendHeaderChecksum(stack, &expected), 0);
+}
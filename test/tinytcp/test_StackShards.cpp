@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include "StackShards.hpp"
+
+static const uint8_t ShardMAC[] = {0x02, 0x00, 0x00, 0x00, 0x03, 0x01};
+static const uint8_t ShardIP[] = {10, 0, 3, 1};
+static const uint8_t PeerMAC[] = {0x02, 0x00, 0x00, 0x00, 0x03, 0x02};
+static const uint8_t PeerIP[] = {10, 0, 3, 2};
+
+TEST(StackShardsTest, HashIsSymmetric) {
+    for (uint16_t port = 1000; port < 1100; port++)
+    {
+        EXPECT_EQ(StackShards::Hash(ShardIP, port, PeerIP, 80),
+                  StackShards::Hash(PeerIP, 80, ShardIP, port));
+    }
+    EXPECT_NE(StackShards::Hash(ShardIP, 1000, PeerIP, 80),
+              StackShards::Hash(ShardIP, 1001, PeerIP, 80));
+}
+
+TEST(StackShardsTest, ShardsFollowShardZero) {
+    static DefaultStack stack0;
+    static DefaultStack stack1;
+    static DefaultStack stack2;
+    DefaultStack* stacks[] = {&stack0, &stack1, &stack2};
+    static StackShards shards;
+    ProtocolIPv4::AddressInfo info = {};
+    int used[3] = {};
+
+    stack0.SetMACAddress((uint8_t*)ShardMAC);
+    ASSERT_TRUE(shards.Attach(stacks, 3));
+    EXPECT_EQ(shards.GetCount(), 3);
+    EXPECT_EQ(memcmp(stack2.MAC.GetUnicastAddress(), ShardMAC, 6), 0);
+    EXPECT_EQ(shards.Find(&stack1.MAC), 1);
+    EXPECT_EQ(shards.Find(nullptr), -1);
+
+    // Address information given to shard 0, as DHCP does
+    info.DataValid = true;
+    memcpy(info.Address, ShardIP, 4);
+    memcpy(info.SubnetMask, "\xFF\xFF\xFF\x00", 4);
+    stack0.IP.SetAddressInfo(info);
+    EXPECT_TRUE(stack2.IP.GetAddressInfo().DataValid);
+    EXPECT_EQ(memcmp(stack2.IP.GetUnicastAddress(), ShardIP, 4), 0);
+
+    // Addresses shard 0 resolves
+    EXPECT_EQ(stack1.ARP.Protocol2Hardware(PeerIP, false), nullptr);
+    stack0.ARP.Add(PeerIP, PeerMAC);
+    const uint8_t* mac = stack1.ARP.Protocol2Hardware(PeerIP, false);
+    ASSERT_NE(mac, nullptr);
+    EXPECT_EQ(memcmp(mac, PeerMAC, 6), 0);
+
+    for (uint16_t port = 1024; port < 1124; port++)
+    {
+        int shard = shards.ShardOf(PeerIP, 80, port);
+        ASSERT_GE(shard, 0);
+        ASSERT_LT(shard, 3);
+        used[shard]++;
+    }
+    EXPECT_GT(used[0], 0);
+    EXPECT_GT(used[1], 0);
+    EXPECT_GT(used[2], 0);
+}
@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include "DefaultStack.hpp"
+#include "VirtualLink.hpp"
+#include "osThread.hpp"
+#include "osTime.hpp"
+
+static const uint8_t ClientMAC[] = {0x02, 0x00, 0x00, 0x00, 0x01, 0x01};
+static const uint8_t ServerMAC[] = {0x02, 0x00, 0x00, 0x00, 0x01, 0x02};
+static const uint8_t ClientIP[] = {10, 0, 1, 1};
+static const uint8_t ServerIP[] = {10, 0, 1, 2};
+
+static void Configure(DefaultStack& stack, const uint8_t* mac, const uint8_t* ip)
+{
+    ProtocolIPv4::AddressInfo info = {};
+    info.DataValid = true;
+    memcpy(info.Address, ip, 4);
+    memcpy(info.SubnetMask, "\xFF\xFF\xFF\x00", 4);
+    stack.SetMACAddress((uint8_t*)mac);
+    stack.IP.SetAddressInfo(info);
+}
+
+// Poll a non-blocking Read until length bytes arrive or a second passes
+static int ReadAll(TCPConnection* connection, char* buffer, int length)
+{
+    int count = 0;
+    for (int i = 0; i < 1000 && count < length; i++)
+    {
+        int rc = connection->Read(&buffer[count], length - count);
+        if (rc == 0)
+        {
+            osThread::Sleep(1, __FILE__, __LINE__);
+        }
+        count += rc;
+    }
+    return count;
+}
+
+// Send a frame the receiver ignores, to count what the link does with it
+static void SendFrame(DefaultStack& stack)
+{
+    static const uint8_t broadcast[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    DataBuffer* buffer = stack.MAC.GetTxBuffer(46);
+    ASSERT_NE(buffer, nullptr);
+    memset(buffer->Packet, 0, 46);
+    buffer->Length = 46;
+    stack.MAC.Transmit(buffer, broadcast, 0x88B5);
+}
+
+TEST(VirtualLinkTest, ConnectAndExchangeData) {
+    static DefaultStack client;
+    static DefaultStack server;
+    static VirtualLink link("test link");
+    char buffer[32] = {};
+
+    Configure(client, ClientMAC, ClientIP);
+    Configure(server, ServerMAC, ServerIP);
+    ASSERT_TRUE(link.Attach(client, server));
+    link.Start();
+
+    TCPConnection* listener = server.TCP.NewServer(&server.MAC, 80);
+    ASSERT_NE(listener, nullptr);
+    TCPConnection* connection = client.TCP.Connect(&client.MAC, ServerIP, 80, 2000);
+    ASSERT_NE(connection, nullptr);
+    EXPECT_EQ(connection->State, TCPConnection::ESTABLISHED);
+    // The send window comes from the SYN-ACK, not the 1024 byte guess made before it
+    EXPECT_EQ(connection->MaxSequenceTx - connection->SequenceNumber,
+              (uint32_t)TCP_RX_WINDOW_SIZE);
+    TCPConnection* accepted = listener->Listen();
+    ASSERT_NE(accepted, nullptr);
+
+    connection->Write((const uint8_t*)"hello", 5);
+    connection->Flush();
+    ASSERT_EQ(ReadAll(accepted, buffer, 5), 5);
+    EXPECT_EQ(memcmp(buffer, "hello", 5), 0);
+
+    accepted->Write((const uint8_t*)"world!", 6);
+    accepted->Flush();
+    ASSERT_EQ(ReadAll(connection, buffer, 6), 6);
+    EXPECT_EQ(memcmp(buffer, "world!", 6), 0);
+
+    // Referenced data is done with once the peer has acknowledged it
+    static const uint8_t referenced[] = "referenced";
+    EXPECT_TRUE(connection->WaitReferenced(0));
+    connection->WriteReference(referenced, 10);
+    EXPECT_FALSE(connection->WaitReferenced(0));
+    ASSERT_EQ(ReadAll(accepted, buffer, 10), 10);
+    EXPECT_EQ(memcmp(buffer, referenced, 10), 0);
+    // The ACK is delayed, run the server's timers until it goes out
+    bool acknowledged = false;
+    for (int i = 0; i < 1000 && !acknowledged; i++)
+    {
+        server.Tick();
+        acknowledged = connection->WaitReferenced(1);
+    }
+    EXPECT_TRUE(acknowledged);
+
+    connection->Close();
+    link.Stop();
+    // The FIN may still be in flight
+    link.Deliver(UINT64_MAX);
+
+    VirtualLink::Counters counters = link.GetCounters(client);
+    EXPECT_GT(counters.Sent, 0u);
+    EXPECT_EQ(counters.Delivered, counters.Sent);
+}
+
+TEST(VirtualLinkTest, FailedConnectReturnsTheConnection) {
+    static DefaultStack client;
+    static DefaultStack server;
+    static VirtualLink link("refusing link");
+
+    Configure(client, ClientMAC, ClientIP);
+    Configure(server, ServerMAC, ServerIP);
+    ASSERT_TRUE(link.Attach(client, server));
+    link.Start();
+
+    // Nothing listens on 81, every attempt times out and must hand its connection back
+    for (int i = 0; i < TCP_MAX_CONNECTIONS + 1; i++)
+    {
+        EXPECT_EQ(client.TCP.Connect(&client.MAC, ServerIP, 81, 50), nullptr);
+    }
+
+    TCPConnection* listener = server.TCP.NewServer(&server.MAC, 80);
+    ASSERT_NE(listener, nullptr);
+    TCPConnection* connection = client.TCP.Connect(&client.MAC, ServerIP, 80, 2000);
+    ASSERT_NE(connection, nullptr);
+    EXPECT_EQ(connection->State, TCPConnection::ESTABLISHED);
+
+    connection->Close();
+    link.Stop();
+    link.Deliver(UINT64_MAX);
+}
+
+TEST(VirtualLinkTest, ImpairmentsAreRepeatable) {
+    static DefaultStack a;
+    static DefaultStack b;
+    static VirtualLink link("impaired link");
+    uint64_t delivered[2];
+
+    Configure(a, ClientMAC, ClientIP);
+    Configure(b, ServerMAC, ServerIP);
+    ASSERT_TRUE(link.Attach(a, b));
+
+    for (int run = 0; run < 2; run++)
+    {
+        VirtualLink::Impairment impairment = {};
+        impairment.Loss = 0.1;
+        impairment.Duplicate = 0.1;
+        impairment.Reorder = 0.1;
+        impairment.ReorderDelay_us = 100;
+        impairment.QueueLimit = VIRTUAL_LINK_QUEUE_MAX;
+        link.SetImpairment(impairment, 42);
+
+        VirtualLink::Counters before = link.GetCounters(a);
+        for (int i = 0; i < 1000; i++)
+        {
+            SendFrame(a);
+            link.Deliver(UINT64_MAX);
+        }
+        VirtualLink::Counters after = link.GetCounters(a);
+        uint64_t lost = after.Lost - before.Lost;
+        uint64_t duplicated = after.Duplicated - before.Duplicated;
+        delivered[run] = after.Delivered - before.Delivered;
+
+        EXPECT_EQ(after.Sent - before.Sent, 1000u);
+        EXPECT_GT(lost, 50u);
+        EXPECT_LT(lost, 150u);
+        EXPECT_GT(duplicated, 50u);
+        EXPECT_GT(after.Reordered - before.Reordered, 50u);
+        EXPECT_EQ(delivered[run], 1000u - lost + duplicated);
+    }
+    EXPECT_EQ(delivered[0], delivered[1]);
+}
+
+TEST(VirtualLinkTest, LatencyAndBandwidthDelayFrames) {
+    static DefaultStack a;
+    static DefaultStack b;
+    static VirtualLink link("slow link");
+
+    Configure(a, ClientMAC, ClientIP);
+    Configure(b, ServerMAC, ServerIP);
+    ASSERT_TRUE(link.Attach(a, b));
+
+    // 60 byte frames at 480 kbit/s take 1 ms each on the wire
+    VirtualLink::Impairment impairment = {};
+    impairment.Bandwidth_bps = 480000;
+    impairment.Latency_us = 10000;
+    impairment.QueueLimit = 4;
+    link.SetImpairment(a, impairment);
+
+    uint64_t start_us = osTime::GetTime_us();
+    for (int i = 0; i < 6; i++)
+    {
+        SendFrame(a);
+    }
+    EXPECT_EQ(link.GetCounters(a).Dropped, 2u);
+
+    uint64_t due_us = link.GetNextDelivery_us();
+    EXPECT_GE(due_us, start_us + 11000);
+    EXPECT_EQ(link.Deliver(due_us - 1), 0);
+    EXPECT_EQ(link.Deliver(due_us), 1);
+    EXPECT_GE(link.GetNextDelivery_us(), due_us + 1000);
+    EXPECT_EQ(link.Deliver(UINT64_MAX), 3);
+    EXPECT_EQ(link.GetNextDelivery_us(), UINT64_MAX);
+}
@@ -31,6 +31,7 @@
 
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #ifdef _WIN32
 #include <pcap.h>
@@ -45,11 +46,15 @@
 #include "ProtocolARP.hpp"
 #include "ProtocolDHCP.hpp"
 #include "ProtocolTCP.hpp"
+#include "StackShards.hpp"
 #include "http_page.hpp"
 #include "httpd.hpp"
 #include "osMutex.hpp"
+#include "osPool.hpp"
 #include "osThread.hpp"
+#include "osThreadPool.hpp"
 #include "osTime.hpp"
+#include "osTimerWheel.hpp"
 
 #ifdef WIN32
 #define strcasecmp _stricmp
@@ -64,10 +69,27 @@ static osEvent StartEvent("StartEvent");
 
 DefaultStack tcpStack;
 
+// tcpStack is shard 0, the PacketIO of shard i is ShardPIO[i] with PIO the same as ShardPIO[0]
+static StackShards Shards;
+static DefaultStack ShardStack[STACK_SHARD_MAX - 1];
+static PacketIO* ShardPIO[STACK_SHARD_MAX];
+static osThread ShardThread[STACK_SHARD_MAX];
+static osThread ShardTimerThread[STACK_SHARD_MAX];
+
 struct NetworkConfig
 {
     int interfaceNumber;
+    bool rxRing;
+    int txBatch;
+    const char* tapName;
+    int tapQueues;
+    const char* replayFile;
+    bool replayRealtime;
+    const char* captureFile;
+    int shards;
+    int httpConnections;
 };
+static NetworkConfig* ShardConfig;
 
 //============================================================================
 // Callback function invoked by libpcap for every incoming packet
@@ -86,11 +108,52 @@ void RxData(uint8_t* data, size_t length)
     tcpStack.ProcessRx(data, length);
 }
 
+// Where there are shards a buffer comes from the pool of the shard that received it
+static DefaultStack& StackOf(DataBuffer* buffer)
+{
+    int shard = Shards.Find(buffer->MAC);
+    return (shard > 0 ? Shards.GetShard(shard) : tcpStack);
+}
+
+static PacketIO* PacketIOOf(DataBuffer* buffer)
+{
+    int shard = Shards.Find(buffer->MAC);
+    return (shard > 0 ? ShardPIO[shard] : PIO);
+}
+
+void RxBuffer(DataBuffer* buffer)
+{
+    StackOf(buffer).ProcessRx(buffer);
+}
+
 void TxData(void* data, size_t length)
 {
     PIO->TxData(data, length);
 }
 
+void TxBuffer(DataBuffer* buffer)
+{
+    PacketIOOf(buffer)->TxData(buffer);
+}
+
+void TxFlush()
+{
+    PIO->FlushTx();
+    for (int i = 1; i < Shards.GetCount(); i++)
+    {
+        ShardPIO[i]->FlushTx();
+    }
+}
+
+void AddressChanged(const uint8_t* address)
+{
+    PIO->SetAddressFilter(address);
+    for (int i = 1; i < Shards.GetCount(); i++)
+    {
+        ShardPIO[i]->SetAddressFilter(address);
+    }
+}
+
 void NetworkEntry(void* param)
 {
     // This is just a made-up MAC address to user for testing
@@ -119,13 +182,76 @@ void NetworkEntry(void* param)
     // This method does not return...ever
     PIO->Start(packet_handler);
 #elif __linux__
+    NetworkConfig& config = *(NetworkConfig*)param;
     PIO = new PacketIO();
+    ShardPIO[0] = PIO;
+    if (config.rxRing)
+    {
+        PIO->SetRxMode(PacketIO::RX_RING);
+    }
+    if (config.shards > 1)
+    {
+        PIO->SetFanout(getpid() & 0xFFFF, 0, config.shards);
+    }
+    if (config.tapName != nullptr)
+    {
+        PIO->SetTap(config.tapName, config.tapQueues);
+        tcpStack.SetChecksumOffload(PIO->GetChecksumOffload());
+    }
+    if (config.replayFile != nullptr)
+    {
+        PIO->SetReplay(config.replayFile, config.replayRealtime);
+    }
+    if (config.captureFile != nullptr)
+    {
+        PIO->SetCapture(config.captureFile);
+    }
+    PIO->SetTxBatch(config.txBatch, &tcpStack.Timers);
     tcpStack.RegisterDataTransmitHandler(TxData);
+    tcpStack.RegisterBufferTransmitHandler(TxBuffer);
+    tcpStack.RegisterTransmitFlushHandler(TxFlush);
+    tcpStack.RegisterAddressChangeHandler(AddressChanged);
     StartEvent.Notify();
-    PIO->Start(RxData);
+    PIO->Start(&tcpStack.MAC, RxBuffer);
+
+    // Only a replay ever gets here, it is done
+    PIO->Stop();
+    exit(0);
 #endif
 }
 
+#ifdef __linux__
+// Receive for shard 1 and up, on a socket of the fanout group shard 0 set up
+void ShardEntry(void* param)
+{
+    NetworkConfig& config = *ShardConfig;
+    int shard = (int)(intptr_t)param;
+    DefaultStack& stack = Shards.GetShard(shard);
+    PacketIO* pio = ShardPIO[shard];
+
+    if (config.rxRing)
+    {
+        pio->SetRxMode(PacketIO::RX_RING);
+    }
+    pio->SetFanout(getpid() & 0xFFFF, shard, config.shards);
+    pio->SetTxBatch(config.txBatch, &stack.Timers);
+    stack.RegisterDataTransmitHandler(TxData);
+    stack.RegisterBufferTransmitHandler(TxBuffer);
+    stack.RegisterTransmitFlushHandler(TxFlush);
+    pio->Start(&stack.MAC, RxBuffer);
+}
+
+void ShardTimerEntry(void* param)
+{
+    DefaultStack& stack = *(DefaultStack*)param;
+    while (1)
+    {
+        stack.Timers.WaitForNext(1000);
+        stack.Tick();
+    }
+}
+#endif
+
 void MainEntry(void* config) {}
 
 void HomePage(http::Page* page)
@@ -178,9 +304,38 @@ void FormsDemo(http::Page* page)
 void ShowMutex(http::Page* page)
 {
     std::ostream& out = page->get_output_stream();
+
+    // /show/mutex?profile=on, off or reset
+    for (int i = 0; i < page->argc; i++)
+    {
+        char* name;
+        char* value = nullptr;
+        page->ParseArg(page->argv[i], &name, &value);
+        if (!strcasecmp(name, "profile") && value != nullptr)
+        {
+            if (!strcasecmp(value, "on"))
+            {
+                osMutex::EnableProfile(true);
+            }
+            else if (!strcasecmp(value, "off"))
+            {
+                osMutex::EnableProfile(false);
+            }
+            else if (!strcasecmp(value, "reset"))
+            {
+                osMutex::ResetProfile();
+            }
+        }
+    }
+
     out << "<pre>";
     osMutex::dump_info(out);
+    out << "\n";
+    osMutex::dump_profile(out);
     out << "</pre>";
+    out << "<a href=\"/show/mutex?profile=on\">profile on</a> ";
+    out << "<a href=\"/show/mutex?profile=off\">profile off</a> ";
+    out << "<a href=\"/show/mutex?profile=reset\">reset</a>";
 }
 
 void ShowEvent(http::Page* page)
@@ -199,11 +354,29 @@ void ShowQueue(http::Page* page)
     out << "</pre>";
 }
 
+void ShowPool(http::Page* page)
+{
+    std::ostream& out = page->get_output_stream();
+    out << "<pre>";
+    osPool::dump_info(out);
+    out << "</pre>";
+}
+
 void ShowThread(http::Page* page)
 {
     std::ostream& out = page->get_output_stream();
     out << "<pre>";
     osThread::dump_info(out);
+    out << "\n";
+    osThreadPool::dump_info(out);
+    out << "</pre>";
+}
+
+void ShowTimer(http::Page* page)
+{
+    std::ostream& out = page->get_output_stream();
+    out << "<pre>";
+    osTimerWheel::dump_info(out);
     out << "</pre>";
 }
 
@@ -312,6 +485,10 @@ void ProcessPageRequest(http::Page* page, const char* url)
     {
         page->Process(BINARY_DIR "master.html", "$content", ShowQueue);
     }
+    else if (!strcasecmp(url, "/show/pool"))
+    {
+        page->Process(BINARY_DIR "master.html", "$content", ShowPool);
+    }
     else if (!strcasecmp(url, "/show/event"))
     {
         page->Process(BINARY_DIR "master.html", "$content", ShowEvent);
@@ -320,6 +497,10 @@ void ProcessPageRequest(http::Page* page, const char* url)
     {
         page->Process(BINARY_DIR "master.html", "$content", ShowMutex);
     }
+    else if (!strcasecmp(url, "/show/timer"))
+    {
+        page->Process(BINARY_DIR "master.html", "$content", ShowTimer);
+    }
     else
     {
         page->PageNotFound();
@@ -330,7 +511,17 @@ int main(int argc, char* argv[])
 {
     NetworkConfig config;
     config.interfaceNumber = 1;
+    config.rxRing = false;
+    config.txBatch = 1;
+    config.tapName = nullptr;
+    config.tapQueues = 1;
+    config.replayFile = nullptr;
+    config.replayRealtime = false;
+    config.captureFile = nullptr;
+    config.shards = 1;
+    config.httpConnections = HTTPD_WORKER_COUNT;
     http::Server WebServer;
+    static http::Server ShardWebServer[STACK_SHARD_MAX - 1];
 
     printf("%d bit build\n", (sizeof(void*) == 4 ? 32 : 64));
 
@@ -346,6 +537,49 @@ int main(int argc, char* argv[])
         {
             config.interfaceNumber = atoi(argv[++i]);
         }
+        else if (!strcmp(argv[i], "-ring"))
+        {
+            // Receive through a PACKET_MMAP ring rather than a recv per frame
+            config.rxRing = true;
+        }
+        else if (!strcmp(argv[i], "-txbatch"))
+        {
+            // Send up to this many frames with one sendmmsg
+            config.txBatch = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-tap"))
+        {
+            // Attach to a tap device rather than a raw socket on a NIC
+            config.tapName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-tapqueues"))
+        {
+            config.tapQueues = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-replay"))
+        {
+            // Feed the stack from a pcap or pcapng file, exit when it is done
+            config.replayFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-realtime"))
+        {
+            config.replayRealtime = true;
+        }
+        else if (!strcmp(argv[i], "-capture"))
+        {
+            // Record transmitted frames
+            config.captureFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-shards"))
+        {
+            // Spread receive over this many stacks, each on a thread of its own
+            config.shards = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-httpconnections"))
+        {
+            // Requests each web server serves at once
+            config.httpConnections = atoi(argv[++i]);
+        }
         else
         {
             printf("unknown option '%s'\n", argv[i]);
@@ -353,6 +587,26 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (config.shards < 1 || config.shards > STACK_SHARD_MAX)
+    {
+        printf("-shards takes 1 to %d\n", STACK_SHARD_MAX);
+        return -1;
+    }
+    if (config.shards > 1 && (config.tapName != nullptr || config.replayFile != nullptr))
+    {
+        // Fanout is only for raw sockets
+        printf("-shards is ignored with -tap and -replay\n");
+        config.shards = 1;
+    }
+#ifdef __linux__
+    if (config.shards > 1 && !PacketIO::FanoutProgramAvailable())
+    {
+        // The kernel's flow hash would not take a connection to the shard that opened it
+        printf("fanout program not available, running a single shard\n");
+        config.shards = 1;
+    }
+#endif
+
     WebServer.RegisterPageHandler(ProcessPageRequest);
     NetworkThread.Create(NetworkEntry, "Network", 1024, 10, &config);
 
@@ -363,17 +617,37 @@ int main(int argc, char* argv[])
 #endif
     StartEvent.Wait(__FILE__, __LINE__);
 
-    WebServer.Initialize(tcpStack.MAC, tcpStack.TCP, 80);
+    WebServer.Initialize(tcpStack.MAC, tcpStack.TCP, 80, config.httpConnections);
+
+#ifdef __linux__
+    if (config.shards > 1)
+    {
+        DefaultStack* stacks[STACK_SHARD_MAX] = {&tcpStack};
+        for (int i = 1; i < config.shards; i++)
+        {
+            stacks[i] = &ShardStack[i - 1];
+            ShardPIO[i] = new PacketIO();
+        }
+        Shards.Attach(stacks, config.shards);
+        ShardConfig = &config;
+        for (int i = 1; i < config.shards; i++)
+        {
+            DefaultStack& stack = Shards.GetShard(i);
+            // Every shard listens, a connection arrives on the shard its ports hash to
+            ShardWebServer[i - 1].RegisterPageHandler(ProcessPageRequest);
+            ShardWebServer[i - 1].Initialize(stack.MAC, stack.TCP, 80, config.httpConnections);
+            ShardThread[i].Create(ShardEntry, "Network shard", 1024, 10, (void*)(intptr_t)i);
+            ShardTimerThread[i].Create(ShardTimerEntry, "Shard timers", 1024, 10, &stack);
+        }
+    }
+#endif
 
     tcpStack.StartDHCP();
 
     while (1)
     {
-#ifdef _WIN32
-        Sleep(100);
-#elif __linux__
-        usleep(100000);
-#endif
+        // Sleeps until the next protocol timer is due rather than polling
+        tcpStack.Timers.WaitForNext(1000);
         tcpStack.Tick();
     }
 }
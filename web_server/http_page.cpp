@@ -394,8 +394,14 @@ std::streambuf::int_type http::Page::underflow()
         }
 
         // start is now the start of the buffer, proper.
-        // Read from fptr_ in to the provided buffer
-        int n = Connection->Read(start, m_char_buffer.size() - (start - base));
+        // Block for the first byte, then take whatever else has arrived
+        int n = 0;
+        int c = Connection->Read();
+        if (c != -1)
+        {
+            *start = (char)c;
+            n = 1 + Connection->Read(start + 1, m_char_buffer.size() - (start - base) - 1);
+        }
         if (n == 0)
         {
             rc = traits_type::eof();
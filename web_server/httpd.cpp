@@ -51,7 +51,9 @@
 
 http::Server::Server()
     : PagePool("HTTPPage Pool", MAX_ACTIVE_CONNECTIONS, PagePoolBuffer)
+    , PageFree("HTTPPage Free")
     , Thread()
+    , Workers("HTTPD workers")
     , ListenerConnection(nullptr)
     , CurrentConnection(nullptr)
     , PageHandler(nullptr)
@@ -222,16 +224,31 @@ void http::Server::ProcessRequest(http::Page* page)
     }
 }
 
-void http::Server::Initialize(InterfaceMAC& mac, ProtocolTCP& tcp, uint16_t port)
+void http::Server::Initialize(InterfaceMAC& mac,
+                              ProtocolTCP& tcp,
+                              uint16_t port,
+                              int connectionCount)
 {
     int i;
 
-    for (i = 0; i < MAX_ACTIVE_CONNECTIONS; i++)
+    static_assert(MAX_ACTIVE_CONNECTIONS <= osThreadPool::WORKER_MAX,
+                  "each active connection needs a worker");
+    if (connectionCount < 1 || connectionCount > MAX_ACTIVE_CONNECTIONS)
+    {
+        printf("http::Server %d connections, 1 to %d are supported\n",
+               connectionCount,
+               MAX_ACTIVE_CONNECTIONS);
+        connectionCount = (connectionCount < 1 ? 1 : MAX_ACTIVE_CONNECTIONS);
+    }
+
+    // Only connectionCount pages are handed out, which is what limits the requests served
+    for (i = 0; i < connectionCount; i++)
     {
         PagePoolPages[i]._Server = this;
         PagePool.Put(&PagePoolPages[i]);
     }
 
+    Workers.Start(connectionCount, 1024 * 32, 100);
     ListenerConnection = tcp.NewServer(&mac, port);
     Thread.Create(http::Server::TaskEntry, "HTTPD", 1024 * 32, 100, this);
 }
@@ -239,10 +256,12 @@ void http::Server::Initialize(InterfaceMAC& mac, ProtocolTCP& tcp, uint16_t port
 void http::Server::ConnectionHandlerEntry(void* param)
 {
     Page* page = (Page*)param;
+    Server* server = page->_Server;
 
-    page->_Server->ProcessRequest(page);
+    server->ProcessRequest(page);
 
-    page->_Server->PagePool.Put(page);
+    server->PagePool.Put(page);
+    server->PageFree.Notify();
 }
 
 void http::Server::TaskEntry(void* param)
@@ -260,16 +279,16 @@ void http::Server::Task()
     {
         connection = ListenerConnection->Listen();
 
-        // Spawn off a thread to handle this connection
-        page = (Page*)PagePool.Get();
-        if (page)
-        {
-            page->Initialize(connection);
-            page->Thread.Create(ConnectionHandlerEntry, "Page", 1024, 100, page);
-        }
-        else
+        // Wait for a request to finish if the most allowed are being served
+        PageFree.Wait(__FILE__, __LINE__, [&]() {
+            return (page = (Page*)PagePool.Get()) != nullptr;
+        });
+        page->Initialize(connection);
+        if (!Workers.Submit(ConnectionHandlerEntry, page))
         {
-            printf("Error: Out of pages\n");
+            printf("Error: HTTPD work queue full\n");
+            connection->Close();
+            PagePool.Put(page);
         }
     }
 }
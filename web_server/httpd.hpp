@@ -32,8 +32,14 @@
 #pragma once
 
 #include "http_page.hpp"
-
-#define MAX_ACTIVE_CONNECTIONS 3
+#include "osEvent.hpp"
+#include "osQueue.hpp"
+#include "osThreadPool.hpp"
+
+// Most requests a server can be set to serve at once, each has a page and a worker
+#define MAX_ACTIVE_CONNECTIONS 16
+// Requests served at once unless Initialize is given a count, further connections wait
+#define HTTPD_WORKER_COUNT 3
 #define HTTPD_PATH_LENGTH_MAX 256
 
 class ProtocolTCP;
@@ -57,7 +63,12 @@ public:
     void RegisterErrorHandler(ErrorMessageHandler);
     void RegisterAuthorizationHandler(AuthorizationHandler);
 
-    void Initialize(InterfaceMAC& mac, ProtocolTCP& tcp, uint16_t port);
+    /// @param connectionCount Requests served at once, 1 to MAX_ACTIVE_CONNECTIONS. Each gets
+    /// a page and a worker thread, further connections wait for one to finish.
+    void Initialize(InterfaceMAC& mac,
+                    ProtocolTCP& tcp,
+                    uint16_t port,
+                    int connectionCount = HTTPD_WORKER_COUNT);
 
     void ProcessRequest(Page* page);
 
@@ -73,8 +84,10 @@ private:
     Page PagePoolPages[MAX_ACTIVE_CONNECTIONS];
     void* PagePoolBuffer[MAX_ACTIVE_CONNECTIONS];
     osQueue PagePool;
+    osEvent PageFree;
 
     osThread Thread;
+    osThreadPool Workers;
 
     TCPConnection* ListenerConnection;
     TCPConnection* CurrentConnection;